@@ -0,0 +1,52 @@
+// Scandi: arena.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <algorithm>
+#include "arena.h"
+
+
+#define BLOCK_SIZE      (64 * 1024)
+
+
+void* Arena::allocate_block(size_t size, size_t align) {
+    // Oversized objects get a block to themselves.
+    auto bytes = std::max<size_t>(BLOCK_SIZE, sizeof(Block) + size + align);
+    auto memory = static_cast<char*>(::operator new(bytes));
+    auto block = new (memory) Block { nullptr, bytes };
+    {
+        std::lock_guard<std::mutex> locked(lock);
+        blocks.push_back(block);
+    }
+    cursor.generation = generation;
+    cursor.block = block;
+    cursor.pos = align_up(memory + sizeof(Block), align);
+    cursor.end = memory + bytes;
+
+    auto p = cursor.pos;
+    cursor.pos += size;
+    return p;
+}
+
+
+void Arena::release() {
+    std::lock_guard<std::mutex> locked(lock);
+
+    // Everything is destroyed before anything is freed, as an object's
+    // finalizer may be in a later block than the object.
+    for (auto block: blocks) {
+        for (auto f = block->finalizers; f; f = f->prev) {
+            f->destroy(f->object);
+        }
+    }
+    for (auto block: blocks) {
+        ::operator delete(block);
+    }
+    blocks.clear();
+
+    // Any thread still pointing into a freed block will start a new one.
+    generation = next_generation++;
+}
+
@@ -0,0 +1,94 @@
+// Scandi: arena.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// A bump-pointer arena. Objects in it are never freed one at a time; release
+// destroys everything at once. Each thread allocates from a block of its own,
+// so threads only take the lock when they need a new block. release must not
+// be called while another thread is still allocating.
+class Arena {
+    public:
+        Arena() : generation(next_generation++) {}
+        ~Arena() { release(); }
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        template<typename T, typename... ARGS>
+        T* make(ARGS&&... args) {
+            auto object = new (allocate(sizeof(T), alignof(T))) T(std::forward<ARGS>(args)...);
+            if constexpr (!std::is_trivially_destructible_v<T>) {
+                auto f = new (allocate(sizeof(Finalizer), alignof(Finalizer))) Finalizer {
+                    [](void* o) { static_cast<T*>(o)->~T(); },
+                    object,
+                    cursor.block->finalizers
+                };
+                cursor.block->finalizers = f;
+            }
+            return object;
+        }
+
+        // Destroys every object in the arena and frees its memory.
+        void release();
+
+    private:
+        struct Finalizer {
+            void (*destroy)(void*);
+            void* object;
+            Finalizer* prev;
+        };
+
+        struct Block {
+            Finalizer* finalizers;
+            size_t size;
+        };
+
+        // Where this thread is allocating. It belongs to whichever arena last
+        // gave the thread a block, identified by generation, which changes
+        // when that arena is released. Generations start at 1, so a thread's
+        // zeroed cursor belongs to no arena.
+        struct Cursor {
+            uint64_t generation;
+            Block* block;
+            char* pos;
+            char* end;
+        };
+
+        static inline std::atomic<uint64_t> next_generation { 1 };
+        static inline thread_local Cursor cursor;
+
+        uint64_t generation;
+        std::mutex lock;
+        std::vector<Block*> blocks;
+
+        void* allocate(size_t size, size_t align) {
+            if (cursor.generation == generation) {
+                auto p = align_up(cursor.pos, align);
+                if (p + size <= cursor.end) {
+                    cursor.pos = p + size;
+                    return p;
+                }
+            }
+            return allocate_block(size, align);
+        }
+
+        void* allocate_block(size_t size, size_t align);
+
+        static char* align_up(char* p, size_t align) {
+            auto a = reinterpret_cast<uintptr_t>(p);
+            return p + ((align - a % align) % align);
+        }
+};
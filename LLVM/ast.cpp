@@ -8,62 +8,75 @@
 #include "globals.h"
 
 
-bool AST::has_member(const string name) {
-    for (auto c: children) {
-        if (c->name == name) {
-            return true;
-        }
-    }
+Arena& ast_arena() {
+    static Arena arena;
+    return arena;
+}
 
-    // Account for named parameters also.
-    if (type == AST_FUNCTION) {
-        auto n = next;
-        while (n) {
-            if (n->type == AST_VARIABLE && n->name == name) {
-                return true;
-            }
-            n = n->next;
-        }
-    }
-    return false;
+
+bool AST::has_member(Symbol name) {
+    return find_member(name) != nullptr;
 }
 
 
-bool AST::can_see(const string name) {
+bool AST::can_see(Symbol name) {
     if (has_member(name)) {
         return true;
     } else if (parent) {
         return parent->can_see(name);
     }
     // Only really applies at the global scope.
-    return (this->name == name);
+    return (sym == name);
 }
 
 
-SHARED(AST) AST::get_member(const string name) {
-    for (auto c: children) {
-        if (c->name == name) {
-            return c;
+AST* AST::get_member(Symbol name) {
+    for (auto scope = this; scope; scope = scope->parent) {
+        if (auto found = scope->find_member(name)) {
+            return found->decl;
         }
     }
-    // Account for named parameters also.
-    if (type == AST_FUNCTION) {
-        auto n = next;
-        while (n) {
-            if (n->type == AST_VARIABLE && n->name == name) {
-                return n;
-            }
-            n = n->next;
-        }
+    return nullptr;
+}
+
+
+void AST::add_child(AST* child) {
+    children.push_back(child);
+    add_member(child, false);
+}
+
+
+// Named parameters are only visible from their function.
+void AST::index_parameter(AST* param) {
+    if (type == AST_FUNCTION && param->type == AST_VARIABLE) {
+        add_member(param, true);
     }
-    if (parent) {
-        return parent->get_member(name);
+}
+
+
+void AST::add_member(AST* decl, bool is_parameter) {
+    if (!members) {
+        members = ast_arena().make< std::unordered_map<Symbol, Member> >();
     }
-    return nullptr;
+    auto found = members->find(decl->sym);
+    if (found == members->end()) {
+        members->emplace(decl->sym, Member { decl, is_parameter });
+    } else if (found->second.is_parameter && !is_parameter) {
+        found->second = Member { decl, false };
+    }
+}
+
+
+const AST::Member* AST::find_member(Symbol name) const {
+    if (!members) {
+        return nullptr;
+    }
+    auto found = members->find(name);
+    return found == members->end() ? nullptr : &found->second;
 }
 
 
-SHARED(AST) AST::get_correct_parent(SHARED(AST) member, SHARED(AST) parent) {
+AST* AST::get_correct_parent(AST* member, AST* parent) {
     while (member->depth <= parent->depth) {
         parent = parent->parent;
     }
@@ -98,7 +111,7 @@ const string AST::shorthand() const {
 }
 
 
-ostream& line_stream(ostream& os,  const SHARED(AST)& ast, bool new_line) {
+ostream& line_stream(ostream& os,  AST* ast, bool new_line) {
     if (ast->type < 'a') {
         if (ast->depth >= 0 && new_line) {
             os << endl << string(ast->depth, ' ') << ast->shorthand();
@@ -126,6 +139,6 @@ ostream& line_stream(ostream& os,  const SHARED(AST)& ast, bool new_line) {
 }
 
 
-ostream& operator<<(ostream& os,  const SHARED(AST)& ast) {
+ostream& operator<<(ostream& os,  AST* ast) {
     return line_stream(os, ast, true);
 }
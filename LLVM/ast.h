@@ -5,6 +5,9 @@
 // License: GPL 3.0
 
 #pragma once
+#include <cstdint>
+#include <unordered_map>
+#include "arena.h"
 #include "globals.h"
 #include "lexer.h"
 
@@ -35,50 +38,75 @@ enum ASTType {
 };
 
 
+// Nodes refer to each other with plain pointers. They are all owned by the
+// arena, which frees the whole tree at once.
+Arena& ast_arena();
+#define NEW_AST( ... )      ast_arena().make< AST >( __VA_ARGS__ )
+
+
+struct Loop;
+
+
 class AST {
 
     public:
         enum ASTOptions {
             OPT_STATIC =       1,
             OPT_TARGETS_SELF = 2,
-            OPT_HAS_VARARGS =  4
+            OPT_HAS_VARARGS =  4,
+            OPT_SUBEXPRESSION = 8
         };
         
         ASTType type = AST_SCOPE;     // Used to determine which << operator to use.
         string name;                  // Used for mapping.
+        Symbol sym;                   // The interned name, for lookups.
         int depth;                    // This is useful for tree building.
         char properties;              // This is useful for semantic checking.
-        SHARED(AST) parent = nullptr; // It is necessary to know parent for semantic checking.
-        vector<SHARED(AST)> children; // Execution happens in order here.
-        SHARED(AST) next = nullptr;   // For expressions, functions, conditionals.
-        SHARED(AST) alt = nullptr;    // Extra scope information - such as RAW code
+        AST* parent = nullptr;        // It is necessary to know parent for semantic checking.
+        vector<AST*> children;        // Execution happens in order here.
+        AST* next = nullptr;          // For expressions, functions, conditionals.
+        AST* alt = nullptr;           // Extra scope information - such as RAW code
                                       // or when a conditional is false, or a link to the
                                       // target of an identifier.
         union {
             long l;
             double d;
         } numeric_value;              // Obv holds these types of values.
+        Loop* loop = nullptr;         // On a loop's label, and the jumps back to
+                                      // it, once find_loops has run.
+        int slot = -1;                // A declared variable's, in its function's
+                                      // frame or among the globals. A function's
+                                      // is how many its frame has, and global's
+                                      // how many globals there are.
+        uint8_t types = 0;            // What it can be, once infer_types has run.
+                                      // See types.h.
         
         AST(
             ASTType type,
-            string name,
+            std::string_view name,
             int depth,
             bool is_static
         ) :
             type(type),
             name(name),
+            sym(intern(name)),
             depth(depth)
         {
             properties = is_static ? OPT_STATIC : 0;
         }
         virtual ~AST() {}
 
-        bool has_member(const string) ;
-        bool can_see(const string) ;
-        SHARED(AST) get_member(const string) ;
+        bool has_member(Symbol) ;
+        bool can_see(Symbol) ;
+        AST* get_member(Symbol) ;
+
+        // Children and function parameters must be added through these, so
+        // that they can be found by name.
+        void add_child(AST*);
+        void index_parameter(AST*);
 
         // Returns the parent the provided AST should use (based on depth).
-        static SHARED(AST) get_correct_parent(SHARED(AST), SHARED(AST));
+        static AST* get_correct_parent(AST*, AST*);
 
         // Checks if the specified property is set.
         bool get_property(const char);
@@ -87,6 +115,18 @@ class AST {
         // Get the shorthand version of this AST for convenient display.
         const string shorthand() const;
 
+    private:
+        // Declarations by name. As with a search in order, the first child
+        // of a name wins, and children hide parameters.
+        struct Member {
+            AST* decl;
+            bool is_parameter;
+        };
+        std::unordered_map<Symbol, Member>* members = nullptr;
+
+        void add_member(AST*, bool is_parameter);
+        const Member* find_member(Symbol) const;
+
 };
-ostream& operator<<(ostream&, const SHARED(AST)&);
+ostream& operator<<(ostream&, AST*);
 
@@ -0,0 +1,385 @@
+// Scandi: bench/backends.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+//
+// Runs the Advent of Code examples on generated input with each way scandi
+// can run a program: as bytecode (--interp), and without its superinstructions
+// (--no-fuse), in process with the JIT (--run), and as a native executable,
+// which is timed compiling and running apart.
+// Each must print the same as the native executable. Then small programs
+// check what the backends could each get wrong in their own way, such as
+// the order operands are read in, by what each prints, with constants folded
+// and not (--no-fold). Needs ./scandi and ./runtime.o, as build.sh builds them.
+//
+//     bench/backends [--size <n>] [--repeats <n>]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+
+#define EXAMPLES    "../Examples/AdventOfCode/"
+#define WORK        "/tmp/scandi-backends-"
+
+
+struct Example {
+    std::string program;
+    std::string (*input)(int);
+};
+
+
+// Up and down floors, ending in the basement.
+std::string floors(int n) {
+    std::string s;
+    for (int i = 0; i < n; i++) {
+        s += (i * 7 % 5 < 2) ? ')' : '(';
+    }
+    return s + "\n";
+}
+
+
+// Presents, as 2015/2 reads them.
+std::string presents(int n) {
+    std::ostringstream out;
+    for (int i = 0; i < n / 20; i++) {
+        out << i % 29 + 1 << " " << i % 13 + 1 << " " << i % 7 + 1 << std::endl;
+    }
+    return out.str();
+}
+
+
+// A walk around the houses.
+std::string moves(int n) {
+    const char* step = "^>v<";
+    std::string s;
+    unsigned x = 1;
+    for (int i = 0; i < n; i++) {
+        x = x * 1103515245 + 12345;
+        s += step[(x >> 16) % 4];
+    }
+    return s + "\n";
+}
+
+
+// Sonar depths.
+std::string depths(int n) {
+    std::ostringstream out;
+    for (int i = 0; i < n / 10; i++) {
+        out << 100 + i % 97 + i / 3 << std::endl;
+    }
+    return out.str();
+}
+
+
+const std::vector<Example> examples = {
+    { "2015/1", floors },
+    { "2015/2", presents },
+    { "2015/3", moves },
+    { "2021/1", depths }
+};
+
+
+struct Check {
+    std::string name;
+    std::string source;
+    std::string expected;
+};
+
+
+#define PRELUDE     "{stream.writeline writeline}\n{system.stdout out}\n\n"
+
+const std::vector<Check> checks = {
+    // Each operand is read before the next is pushed, so calls after it
+    // can't change it, and arguments are read before the call.
+    { "calls", PRELUDE
+        "$g 1 =\n"
+        "$y 0 =\n"
+        "$t\n"
+        "@setg\n"
+        "    g 5 =\n"
+        "$n @add\n"
+        "    g g n + =\n"
+        "    add g =\n"
+        "@sett\n"
+        "    t.a 9 =\n"
+        "y g setg + =\n"
+        "y out writeline\n"
+        "y setg g + =\n"
+        "y out writeline\n"
+        "g 1 =\n"
+        "y g 10 add + =\n"
+        "y out writeline\n"
+        "g out writeline\n"
+        "t.a 2 =\n"
+        "y t.a sett + =\n"
+        "y out writeline\n"
+        "t.a out writeline\n",
+      "1\n5\n12\n11\n2\n9\n" },
+
+    // = in the middle of a line copies back to the variable its operand
+    // was read from, which the line then reads again.
+    { "assignment", PRELUDE
+        "$x 3 =\n"
+        "$y 0 =\n"
+        "$t\n"
+        "y x x 7 = x + =\n"
+        "y out writeline\n"
+        "x out writeline\n"
+        "x 1 = y 2 =\n"
+        "x out writeline\n"
+        "y out writeline\n"
+        "t.a 4 =\n"
+        "x t.a 1 + =\n"
+        "x out writeline\n",
+      "10\n7\n1\n2\n5\n" },
+
+    // A jump back can be in an alias's code, which has no identifier of
+    // its own in the line, so the loop has no latch to mark.
+    { "aliases", PRELUDE
+        "$i 0 =\n"
+        "$s 0 =\n"
+        "{i i 1 + = top again}\n"
+        "\\top\n"
+        "    s i +\n"
+        "    i 5 <\n"
+        "        again\n"
+        "s out writeline\n",
+      "15\n" },
+
+    // Folding gives what the runtime would: hexadecimal, bitwise and
+    // comparison operators, a variable set once and read as its value, and
+    // conditionals that only test constants. One that declares something
+    // is left, but must still go the same way.
+    { "folding", PRELUDE
+        "$x #ff #0f & =\n"
+        "x out writeline\n"
+        "$y 1 4 <- #f0 | 3 ^ ~ =\n"
+        "y out writeline\n"
+        "$z 3 5 < 7 7 ? + 2 9 > + =\n"
+        "z out writeline\n"
+        "$p 6 =\n"
+        "$q p p * =\n"
+        "q out writeline\n"
+        "1 2 <\n"
+        "    $w 4 =\n"
+        "    w out writeline\n"
+        ":\n"
+        "    $v 5 =\n"
+        "    v out writeline\n"
+        "'a' 'b' <\n"
+        "    'less' out writeline\n"
+        "(1) 0 >\n"
+        "    'more' out writeline\n",
+      "15\n-244\n2\n36\n4\nless\n" },
+
+    // What a variable can hold changes around a loop, and a global that a
+    // function sets can hold anything. Operating on proven longs and doubles
+    // must give what the runtime does at the edges: wrapping, dividing by a
+    // negative, even the least long by (1), NaN, which the runtime compares as
+    // equal to anything, and shifts by the count's low 6 bits.
+    { "types", PRELUDE
+        "$v 1 =\n"
+        "$n 0 =\n"
+        "\\again\n"
+        "    v out writeline\n"
+        "    v v 3 + =\n"
+        "    n n 1 + =\n"
+        "    n 2 <\n"
+        "        v '7' =\n"
+        "        again\n"
+        "    n 3 <\n"
+        "        v 2,5 =\n"
+        "        again\n"
+        "    v out writeline\n"
+        "$g 5 =\n"
+        "@setg\n"
+        "    g 'five' =\n"
+        "g out writeline\n"
+        "setg\n"
+        "g out writeline\n"
+        "$m 0 =\n"
+        "m #7fffffffffffffff ~ =\n"
+        "m m 1 + =\n"
+        "m out writeline\n"
+        "m 1 - out writeline\n"
+        "m 2 - out writeline\n"
+        "$d 0 =\n"
+        "d 9 =\n"
+        "d (1) / out writeline\n"
+        "d 1 / out writeline\n"
+        "d (1) % out writeline\n"
+        "$z 1 =\n"
+        "z 0,0 =\n"
+        "$nan z z / =\n"
+        "nan nan ? out writeline\n"
+        "nan nan < out writeline\n"
+        "nan 1 > out writeline\n"
+        "nan nan ?< out writeline\n"
+        "nan 1 ?> out writeline\n"
+        "$s 0 =\n"
+        "s 1 =\n"
+        "s 64 <- out writeline\n"
+        "s 65 <- out writeline\n"
+        "s 63 <- 64 -> out writeline\n"
+        "s 63 <- 70 >> out writeline\n"
+        "$k 0 =\n"
+        "k m 1 - =\n"
+        "k (1) / out writeline\n"
+        "k (1) % out writeline\n",
+      "1\n7\n2,5\n5,5\n5\nfive\n-9223372036854775807\n-9223372036854775808\n9223372036854775807\n-9\n9\n0\n1\n0\n0\n1\n1\n1\n2\n-9223372036854775808\n-144115188075855872\n-9223372036854775808\n0\n" }
+};
+
+
+// Runs a command with stdin and stdout from and to files, and gives how long
+// it took, in ms, or -1 if it failed.
+double run(const std::vector<std::string>& command, const std::string& in, const std::string& out) {
+    auto start = std::chrono::steady_clock::now();
+    auto pid = fork();
+    if (pid == 0) {
+        auto input = open(in.c_str(), O_RDONLY);
+        auto output = open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(input, 0);
+        dup2(output, 1);
+        std::vector<char*> argv;
+        for (auto& c: command) {
+            argv.push_back(const_cast<char*>(c.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? elapsed.count() : -1;
+}
+
+
+double best_of(int repeats, const std::vector<std::string>& command, const std::string& in, const std::string& out) {
+    double best = -1;
+    for (int r = 0; r < repeats; r++) {
+        auto ms = run(command, in, out);
+        if (ms < 0) {
+            return -1;
+        }
+        best = best < 0 ? ms : std::min(best, ms);
+    }
+    return best;
+}
+
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path);
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+
+// Runs a check with each backend, and gives how many printed something else.
+int run_check(const Check& check) {
+    auto source = WORK + check.name + ".scandi";
+    auto executable = WORK + check.name;
+    auto output = WORK + check.name + ".out";
+    std::ofstream(source) << check.source;
+
+    const std::vector<std::pair<std::string, std::vector<std::string>>> backends = {
+        { "native", { executable } },
+        { "interp", { "./scandi", "--no-cache", "--interp", source } },
+        { "unfused", { "./scandi", "--no-cache", "--interp", "--no-fuse", source } },
+        { "jit", { "./scandi", "--no-cache", "--run", source } },
+        { "unfolded interp", { "./scandi", "--no-cache", "--no-fold", "--interp", source } },
+        { "unfolded jit", { "./scandi", "--no-cache", "--no-fold", "--run", source } }
+    };
+    int failures = 0;
+    if (run({ "./scandi", "--no-cache", source, "-o", executable }, "/dev/null", "/dev/null") < 0) {
+        std::cout << "    " << check.name << ": failed to compile" << std::endl;
+        failures++;
+    }
+    for (auto& backend: backends) {
+        unlink(output.c_str());
+        if (run(backend.second, "/dev/null", output) < 0 || read_file(output) != check.expected) {
+            std::cout << "    " << check.name << ": " << backend.first << " printed something else" << std::endl;
+            failures++;
+        }
+    }
+    for (auto& path: { source, executable, output }) {
+        unlink(path.c_str());
+    }
+    return failures;
+}
+
+
+int main(int argc, char* argv[]) {
+    int size = 200000;
+    int repeats = 3;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc) {
+            size = std::max(10, std::atoi(argv[++i]));
+        } else if (arg == "--repeats" && i + 1 < argc) {
+            repeats = std::max(1, std::atoi(argv[++i]));
+        } else {
+            std::cerr << "Unknown argument " << arg << std::endl;
+            return 2;
+        }
+    }
+
+    int failures = 0;
+    std::cout << std::left << std::setw(10) << "Example" << std::right << std::setw(12) << "Input KB"
+              << std::setw(12) << "Interp" << std::setw(12) << "Unfused" << std::setw(12) << "JIT" << std::setw(12) << "Compile"
+              << std::setw(12) << "Native" << std::endl << std::setw(70) << "ms" << std::endl;
+    for (auto& example: examples) {
+        auto name = example.program;
+        std::replace(name.begin(), name.end(), '/', '_');
+        auto source = EXAMPLES + example.program + ".scandi";
+        auto input = WORK + name + ".in";
+        auto executable = WORK + name;
+        auto input_text = example.input(size);
+        std::ofstream(input) << input_text;
+
+        auto compile_ms = best_of(repeats, { "./scandi", "--no-cache", source, "-o", executable }, "/dev/null", "/dev/null");
+        auto native_ms = best_of(repeats, { executable }, input, WORK + name + ".native");
+        auto interp_ms = best_of(repeats, { "./scandi", "--no-cache", "--interp", source }, input, WORK + name + ".interp");
+        auto unfused_ms = best_of(repeats, { "./scandi", "--no-cache", "--interp", "--no-fuse", source }, input, WORK + name + ".unfused");
+        auto jit_ms = best_of(repeats, { "./scandi", "--no-cache", "--run", source }, input, WORK + name + ".jit");
+
+        std::cout << std::left << std::setw(10) << example.program << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << input_text.size() / 1024.0 << std::setw(12) << interp_ms << std::setw(12) << unfused_ms
+                  << std::setw(12) << jit_ms
+                  << std::setw(12) << compile_ms << std::setw(12) << native_ms << std::endl;
+        std::cout.unsetf(std::ios::fixed);
+
+        auto expected = read_file(WORK + name + ".native");
+        for (auto backend: { "interp", "unfused", "jit" }) {
+            if (read_file(WORK + name + "." + backend) != expected) {
+                std::cout << "    " << backend << " printed something else" << std::endl;
+                failures++;
+            }
+        }
+        if (compile_ms < 0 || native_ms < 0 || interp_ms < 0 || unfused_ms < 0 || jit_ms < 0) {
+            std::cout << "    failed to run" << std::endl;
+            failures++;
+        }
+        for (auto suffix: { "", ".in", ".native", ".interp", ".unfused", ".jit" }) {
+            unlink((WORK + name + suffix).c_str());
+        }
+    }
+
+    std::cout << std::endl << checks.size() << " checks" << std::endl;
+    for (auto& check: checks) {
+        failures += run_check(check);
+    }
+    return failures > 0 ? 1 : 0;
+}
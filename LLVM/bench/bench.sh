@@ -0,0 +1,21 @@
+#!/bin/sh
+#
+# Builds and runs the front end microbenchmarks. Run from the LLVM directory.
+# The scaling benchmark compares against bench/scaling.baseline, once one has
+# been saved with bench/scaling --save. The backends, loops and cache
+# benchmarks run scandi itself, so build.sh must have been run first.
+
+SOURCES="source.cpp symbols.cpp timing.cpp trace.cpp lexer.cpp"
+FRONT_END="$SOURCES arena.cpp ast.cpp flat_ast.cpp parser.cpp semantics.cpp"
+EXAMPLES=$(find ../Examples stdlib -name '*.scandi')
+
+clang++ --std=c++17 -Wall -O2 -pthread bench/symbols.cpp $SOURCES -o bench/symbols && ./bench/symbols
+clang++ --std=c++17 -Wall -O2 -pthread bench/lexer.cpp $SOURCES -o bench/lexer && ./bench/lexer $EXAMPLES
+clang++ --std=c++17 -Wall -O2 -pthread -DSCANDI_NO_SIMD bench/lexer.cpp $SOURCES -o bench/lexer_scalar && ./bench/lexer_scalar $EXAMPLES
+clang++ --std=c++17 -Wall -O2 -pthread bench/parser.cpp $FRONT_END -o bench/parser && ./bench/parser
+clang++ --std=c++17 -Wall -O2 -pthread bench/lookup.cpp $FRONT_END -o bench/lookup && ./bench/lookup
+clang++ --std=c++17 -Wall -O2 -pthread bench/traverse.cpp $FRONT_END -o bench/traverse && ./bench/traverse
+clang++ --std=c++17 -Wall -O2 -pthread bench/scaling.cpp $FRONT_END -o bench/scaling && ./bench/scaling
+clang++ --std=c++17 -Wall -O2 bench/backends.cpp -o bench/backends && ./bench/backends
+clang++ --std=c++17 -Wall -O2 bench/loops.cpp -o bench/loops && ./bench/loops
+clang++ --std=c++17 -Wall -O2 bench/cache.cpp -o bench/cache && ./bench/cache
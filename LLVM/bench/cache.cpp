@@ -0,0 +1,193 @@
+// Scandi: bench/cache.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+//
+// Damages a build cache entry in the ways a bad disk or another program
+// could, and checks that scandi ignores it: the program must still compile
+// and print what it should, parsed afresh rather than loaded. Each damage is
+// to the layout cache.cpp describes. Needs ./scandi and ./runtime.o, as
+// build.sh builds them.
+
+#include <cstdint>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+
+#define WORK            "/tmp/scandi-cache-"
+#define HEADERS         48                      // CacheHeader, then ModuleHeader.
+#define NODE_COUNT      32                      // Within them.
+#define NODE_BYTES      48
+#define NODE_NEXT       24                      // Within a CachedNode.
+#define NODE_TYPE       40
+#define NO_NODE         0xffffffffu
+
+
+const std::string SOURCE =
+    "{stream.writeline writeline}\n"
+    "{system.stdout out}\n"
+    "$i 0 =\n"
+    "\\loop\n"
+    "   i 3 ?\n"
+    "      done\n"
+    "   i out writeline\n"
+    "   i 1 +\n"
+    "   loop\n"
+    "\\done\n";
+
+const std::string EXPECTED = "0\n1\n2\n";
+
+
+struct Damage {
+    std::string name;
+    void (*apply)(std::string& entry);
+};
+
+
+uint32_t read_u32(const std::string& entry, size_t at) {
+    uint32_t value;
+    std::memcpy(&value, entry.data() + at, sizeof(value));
+    return value;
+}
+
+
+void write_u32(std::string& entry, size_t at, uint32_t value) {
+    std::memcpy(&entry[at], &value, sizeof(value));
+}
+
+
+size_t node_at(uint32_t id) {
+    return HEADERS + id * NODE_BYTES;
+}
+
+
+size_t children_at(const std::string& entry) {
+    return node_at(read_u32(entry, NODE_COUNT));
+}
+
+
+const std::vector<Damage> damages = {
+    { "node type", [](std::string& entry) {
+        entry[node_at(1) + NODE_TYPE] = static_cast<char>(0xff);
+    } },
+    { "child is its own parent", [](std::string& entry) {
+        write_u32(entry, children_at(entry), 0);
+    } },
+    { "next is an earlier node", [](std::string& entry) {
+        for (uint32_t id = 1; id < read_u32(entry, NODE_COUNT); id++) {
+            if (read_u32(entry, node_at(id) + NODE_NEXT) != NO_NODE) {
+                write_u32(entry, node_at(id) + NODE_NEXT, id - 1);
+                return;
+            }
+        }
+    } },
+    { "child given twice", [](std::string& entry) {
+        write_u32(entry, children_at(entry) + sizeof(uint32_t), read_u32(entry, children_at(entry)));
+    } }
+};
+
+
+// Runs a command with its stdout to a file, and gives whether it succeeded.
+// A command that loops forever on a damaged tree is stopped after a minute.
+bool run(const std::vector<std::string>& command, const std::string& out) {
+    auto pid = fork();
+    if (pid == 0) {
+        auto output = open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(output, 1);
+        alarm(60);
+        std::vector<char*> argv;
+        for (auto& c: command) {
+            argv.push_back(const_cast<char*>(c.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+
+// The one entry in the cache directory.
+std::string entry_path(const std::string& dir) {
+    std::string found;
+    if (auto listing = opendir(dir.c_str())) {
+        while (auto entry = readdir(listing)) {
+            std::string name = entry->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".ast") == 0) {
+                found = dir + name;
+            }
+        }
+        closedir(listing);
+    }
+    return found;
+}
+
+
+int main() {
+    auto dir = std::string(WORK) + "dir/";
+    auto source = WORK + std::string("program.scandi");
+    auto executable = WORK + std::string("program");
+    auto trace = WORK + std::string("trace");
+    auto output = WORK + std::string("output");
+    mkdir(dir.c_str(), 0777);
+    std::ofstream(source) << SOURCE;
+    const std::vector<std::string> compile = { "./scandi", "--cache-dir", dir, "--debug=driver:1", source, "-o", executable };
+
+    int failures = 0;
+    auto path = entry_path(dir);
+    if (!path.empty()) {
+        unlink(path.c_str());
+    }
+    path = run(compile, trace) ? entry_path(dir) : "";
+    auto entry = read_file(path);
+    if (path.empty() || entry.size() < node_at(2)) {
+        std::cout << "    unable to write a cache entry" << std::endl;
+        failures++;
+    }
+
+    for (size_t d = 0; !path.empty() && d < damages.size(); d++) {
+        auto& damage = damages[d];
+        auto damaged = entry;
+        damage.apply(damaged);
+        unlink(path.c_str());
+        std::ofstream(path, std::ios::binary) << damaged;
+        unlink(executable.c_str());
+        if (!run(compile, trace)) {
+            std::cout << "    " << damage.name << ": failed to compile" << std::endl;
+            failures++;
+        } else if (read_file(trace).find("lexing and parsing 0 hits") == std::string::npos) {
+            std::cout << "    " << damage.name << ": the damaged entry was loaded" << std::endl;
+            failures++;
+        } else if (!run({ executable }, output) || read_file(output) != EXPECTED) {
+            std::cout << "    " << damage.name << ": printed something else" << std::endl;
+            failures++;
+        }
+    }
+
+    for (auto& file: { path, source, executable, trace, output }) {
+        unlink(file.c_str());
+    }
+    rmdir(dir.c_str());
+    std::cout << damages.size() << " checks, " << failures << " failed" << std::endl;
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,69 @@
+// Scandi: bench/lexer.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+//
+// Reports lexing throughput over the given files and a synthetic large file.
+// Build with -DSCANDI_NO_SIMD to measure the scalar scanner.
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../globals.h"
+#include "../lexer.h"
+#include "../scanner.h"
+#include "../source.h"
+
+
+// Long identifiers, numbers, strings and deep indentation, in roughly the mix
+// generated programs have.
+std::string synthetic_program(size_t size) {
+    std::ostringstream out;
+    for (int n = 0; out.tellp() < static_cast<std::streamoff>(size); n++) {
+        int depth = (n % 12) * 4;
+        out << std::string(depth, ' ') << "$generatedVariableName" << n << " 1234567890,125 =" << std::endl;
+        out << std::string(depth, ' ') << "generatedVariableName" << n << " anotherLongIdentifier" << n
+            << " #DEADBEEF + 42 * =    ` trailing comment" << std::endl;
+        out << std::string(depth, ' ') << "\"a reasonably long string literal for line " << n << "\" out writeline" << std::endl;
+        out << std::string(depth, ' ') << "table[index" << n << "] 'continued ''string' ?" << std::endl;
+    }
+    return out.str();
+}
+
+
+void measure(const std::string& name, uint32_t file_id, int repeats) {
+    std::vector<Token> tokens;
+    size_t bytes = source_file(file_id).text.size();
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; r++) {
+        tokens.clear();
+        tokenize_source(tokens, file_id);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ": " << bytes << " bytes, " << tokens.size() << " tokens, "
+              << (bytes * repeats / seconds / 1e6) << " MB/s" << std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
+#if defined(SCAN_AVX2)
+    std::cout << "Scanner: AVX2" << std::endl;
+#elif defined(SCAN_SSE2)
+    std::cout << "Scanner: SSE2" << std::endl;
+#else
+    std::cout << "Scanner: scalar" << std::endl;
+#endif
+    for (int i = 1; i < argc; i++) {
+        try {
+            measure(argv[i], open_source_file(argv[i], argv[i]), 2000);
+        } catch (domain_error& de) {
+            std::cerr << de.what() << std::endl;
+        }
+    }
+    std::istringstream synthetic(synthetic_program(64 << 20));
+    measure("synthetic", open_source_stream(synthetic, "synthetic"), 3);
+    return 0;
+}
@@ -0,0 +1,96 @@
+// Scandi: bench/lookup.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+//
+// Reports name resolution time for programs with thousands of declarations
+// per scope, against a search of each scope in order.
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "../ast.h"
+#include "../globals.h"
+#include "../lexer.h"
+#include "../parser.h"
+#include "../semantics.h"
+#include "../source.h"
+
+
+// A few functions, each declaring its variables and then using them.
+std::string wide_program(int scopes, int declarations) {
+    std::ostringstream out;
+    for (int s = 0; s < scopes; s++) {
+        out << "@scope" << s << std::endl;
+        for (int d = 0; d < declarations; d++) {
+            out << "    $v" << d << " " << d << " =" << std::endl;
+        }
+        for (int d = 0; d < declarations; d++) {
+            out << "    v" << d << " v" << (d * 7) % declarations << " +" << std::endl;
+        }
+    }
+    return out.str();
+}
+
+
+// The old lookup: each scope's children in order, then up to the parent.
+AST* linear_member(AST* scope, Symbol name) {
+    for (; scope; scope = scope->parent) {
+        for (auto c: scope->children) {
+            if (c->sym == name) {
+                return c;
+            }
+        }
+    }
+    return nullptr;
+}
+
+
+size_t linear_links(AST* ast) {
+    size_t found = 0;
+    if (ast->type == AST_IDENTIFIER && linear_member(ast, ast->sym)) {
+        found++;
+    }
+    if (ast->next) {
+        found += linear_links(ast->next);
+    }
+    for (auto c: ast->children) {
+        found += linear_links(c);
+    }
+    return found;
+}
+
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+void measure(int scopes, int declarations) {
+    std::istringstream text(wide_program(scopes, declarations));
+    auto global = NEW_AST(AST_SCOPE, "global", -1, true);
+    TokenStream tokens(open_source_stream(text, "wide"));
+    parse_to_ast(tokens, global);
+
+    auto start = std::chrono::steady_clock::now();
+    analyse_semantics(global);
+    double indexed = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    size_t found = linear_links(global);
+    double linear = seconds_since(start);
+
+    std::cout << scopes << " x " << declarations << " declarations, " << found << " links: indexed "
+              << indexed * 1e3 << " ms, linear " << linear * 1e3 << " ms" << std::endl;
+    ast_arena().release();
+}
+
+
+int main() {
+    for (int declarations: { 100, 1000, 4000 }) {
+        measure(4, declarations);
+    }
+    return 0;
+}
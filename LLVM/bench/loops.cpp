@@ -0,0 +1,157 @@
+// Scandi: bench/loops.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+//
+// Checks the loops find_loops finds in the README's fibonacci and in the
+// library's math.minx and string.split: the induction variable each steps,
+// the test that leaves it, and whether codegen marks the loop as sure to
+// end. Reads them from what scandi traces with --debug. Needs ./scandi, as
+// build.sh builds it.
+
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+
+#define WORK        "/tmp/scandi-loops-"
+
+
+struct Check {
+    std::string name;
+    std::string source;
+    std::vector<std::vector<std::string>> lines;    // Each what a traced line holds, in order.
+};
+
+
+const std::string PRELUDE =
+    "{stream.writeline writeline}\n"
+    "{system.stdout out}\n";
+
+
+const std::vector<Check> checks = {
+    { "fibonacci",
+      "$a $b $n @fibonacci\n"
+      "   n 1 <\n"
+      "      \"Error: this example is unable to calculate a negative fibonacci index.\" out writeline\n"
+      "      fibonacci 0 =\n"
+      "   n 1 ?\n"
+      "      fibonacci a =\n"
+      "   $pos 2 =\n"
+      "   $sum a b + =\n"
+      "   \\loop\n"
+      "      pos n ?\n"
+      "         fibonacci sum =\n"
+      "      sum a b + =\n"
+      "      a b =\n"
+      "      b sum =\n"
+      "      pos 1 +\n"
+      "      loop\n"
+      "$result 0 1 12 fibonacci =\n"
+      "\"The 12th fibonnacci number is \" result + out writeline\n",
+      { { "LOOP loop AT DEPTH 1, ", " LINES, 1 JUMPS BACK" },
+        { "INDUCTION pos STEP 1" },
+        { "EXIT WHEN ?_", " HOLDS ON pos AGAINST ", "n EACH TIME" },
+        { "LATCH loop MUST PROGRESS" } } },
+    { "minx",
+      "{math.minx minx}\n"
+      "3 7 2 9 minx out writeline\n",
+      { { "LOOP loop AT DEPTH 1, ", " LINES, 1 JUMPS BACK" },
+        { "INDUCTION b STEP 1" },
+        { "EXIT WHEN ?_math_", " HOLDS ON b EACH TIME" },
+        { "LATCH loop" } } },
+    { "split",
+      "{string.split split}\n"
+      "$parts \"a,b,c\" \",\" split =\n"
+      "parts[1] out writeline\n",
+      { { "LOOP loop AT DEPTH 1, ", " LINES, 1 JUMPS BACK" },
+        { "INDUCTION p STEP 1" },
+        { "EXIT WHEN ?_string_", " HOLDS ON p EACH TIME" },
+        { "LATCH loop" } } }
+};
+
+
+// Runs a command with its stdout to a file, and gives whether it succeeded.
+bool run(const std::vector<std::string>& command, const std::string& out) {
+    auto pid = fork();
+    if (pid == 0) {
+        auto output = open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(output, 1);
+        std::vector<char*> argv;
+        for (auto& c: command) {
+            argv.push_back(const_cast<char*>(c.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+// Whether the line holds each part, in order, and nothing after the last.
+bool holds(const std::string& line, const std::vector<std::string>& parts) {
+    auto text = line.substr(std::min(line.find_first_not_of(' '), line.size()));
+    size_t at = 0;
+    for (size_t p = 0; p < parts.size(); p++) {
+        auto found = text.find(parts[p], at);
+        if (found == std::string::npos || (p == 0 && found != 0)) {
+            return false;
+        }
+        at = found + parts[p].size();
+    }
+    return at == text.size();
+}
+
+
+// Runs a check, and gives how many of its lines weren't traced.
+int run_check(const Check& check) {
+    auto source = WORK + check.name + ".scandi";
+    auto ir = WORK + check.name + ".ll";
+    auto trace = WORK + check.name + ".trace";
+    std::ofstream(source) << PRELUDE << check.source;
+
+    int failures = 0;
+    if (!run({ "./scandi", "--no-cache", "--debug=semantics,codegen", "--emit-llvm", source, "-o", ir }, trace)) {
+        std::cout << "    " << check.name << ": failed to compile" << std::endl;
+        failures++;
+    }
+    std::ifstream in(trace);
+    std::string line;
+    size_t next = 0;
+    while (next < check.lines.size() && std::getline(in, line)) {
+        if (holds(line, check.lines[next])) {
+            next++;
+        }
+    }
+    for (; next < check.lines.size(); next++) {
+        std::cout << "    " << check.name << ": no line with";
+        for (auto& part: check.lines[next]) {
+            std::cout << " \"" << part << "\"";
+        }
+        std::cout << std::endl;
+        failures++;
+    }
+    for (auto& path: { source, ir, trace }) {
+        unlink(path.c_str());
+    }
+    return failures;
+}
+
+
+int main() {
+    int failures = 0;
+    for (auto& check: checks) {
+        failures += run_check(check);
+    }
+    std::cout << checks.size() << " checks, " << failures << " failed" << std::endl;
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,68 @@
+// Scandi: bench/parser.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+//
+// Checks which lines the parser auto-assigns (x 1 + is x x 1 + =): lines of
+// their own do, while conditionals, the keys of references and aliases
+// don't, as each would assign to its first operand by surprise. Counts the
+// assignments each source parses to.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../ast.h"
+#include "../globals.h"
+#include "../lexer.h"
+#include "../parser.h"
+#include "../source.h"
+
+
+struct Check {
+    std::string name;
+    std::string source;
+    int assignments;
+};
+
+
+const std::vector<Check> checks = {
+    { "line", "$x 0 =\nx 1 +\n", 2 },
+    { "conditional", "$p 0 =\n$s 'ab' =\np s! ?\n    p 1 +\n", 3 },
+    { "reference key", "$t\n$i 0 =\nt[i 1 +] 2 =\n", 2 },
+    { "alias", "$i 0 =\n{i 1 + next}\n", 1 }
+};
+
+
+int assignments(AST* ast) {
+    int total = ast->type == AST_OPERATOR && ast->name == CHAR_STR(LEX_ASSIGNMENT);
+    if (ast->next) {
+        total += assignments(ast->next);
+    }
+    if (ast->type != AST_IDENTIFIER && ast->alt) {
+        total += assignments(ast->alt);
+    }
+    for (auto c: ast->children) {
+        total += assignments(c);
+    }
+    return total;
+}
+
+
+int main() {
+    int failures = 0;
+    for (auto& check: checks) {
+        std::istringstream text(check.source);
+        auto global = NEW_AST(AST_SCOPE, "global", -1, true);
+        TokenStream tokens(open_source_stream(text, check.name));
+        parse_to_ast(tokens, global);
+        auto found = assignments(global);
+        if (found != check.assignments) {
+            std::cout << check.name << ": " << found << " assignments, expected " << check.assignments << std::endl;
+            failures++;
+        }
+    }
+    std::cout << checks.size() << " checks, " << failures << " failed" << std::endl;
+    return failures > 0 ? 1 : 0;
+}
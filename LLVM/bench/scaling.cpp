@@ -0,0 +1,404 @@
+// Scandi: bench/scaling.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+//
+// Times lexing, parsing and semantic analysis over generated programs of each
+// shape the front end has to scale with, and compares them with a saved
+// baseline. Run with --save before a change and without it after; any phase
+// that got slower, or any shape that takes more memory, is reported, and the
+// benchmark exits with 1.
+//
+//     bench/scaling [--scale <n>] [--repeats <n>] [--tolerance <percent>]
+//                   [--baseline <file>] [--save]
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "../ast.h"
+#include "../globals.h"
+#include "../lexer.h"
+#include "../parser.h"
+#include "../semantics.h"
+#include "../source.h"
+#include "../timing.h"
+
+
+#define BASELINE        "bench/scaling.baseline"
+#define MEMORY_TOLERANCE 5                // Percent. Allocations barely vary from run to run.
+
+
+// A program as the driver would see it: one or more named files.
+typedef std::vector<std::pair<std::string, std::string>> Program;
+
+
+// Conditionals nested ever deeper, so that each line is indented further than
+// the last.
+Program deep_nesting(int n) {
+    std::ostringstream out;
+    for (int f = 0; f < n / 200 + 1; f++) {
+        out << "$v @deep" << f << std::endl;
+        for (int d = 1; d <= 200; d++) {
+            out << std::string(d * 4, ' ') << "v " << d << " < ?" << std::endl;
+        }
+        out << std::string(201 * 4, ' ') << "v 1 + out writeline" << std::endl;
+    }
+    return { { "deep", out.str() } };
+}
+
+
+// One scope declaring everything, so every lookup searches a large scope.
+Program wide_scope(int n) {
+    std::ostringstream out;
+    out << "@wide" << std::endl;
+    for (int d = 0; d < n; d++) {
+        out << "    $v" << d << " " << d << " =" << std::endl;
+    }
+    for (int d = 0; d < n; d++) {
+        out << "    v" << d << " v" << (d * 7) % n << " +" << std::endl;
+    }
+    return { { "wide", out.str() } };
+}
+
+
+// Long lines of arithmetic, each one a chain of expressions.
+Program expression_chains(int n) {
+    std::ostringstream out;
+    out << "$x @chains" << std::endl;
+    for (int l = 0; l < n / 100 + 1; l++) {
+        out << "    x";
+        for (int t = 1; t <= 100; t++) {
+            out << " " << t << " " << "+-*/"[t % 4];
+        }
+        out << std::endl;
+    }
+    return { { "chains", out.str() } };
+}
+
+
+// References within references, such as table[a[b[c]]].
+Program nested_references(int n) {
+    std::ostringstream out;
+    out << "$table $a $b $c @references" << std::endl;
+    for (int l = 0; l < n / 10 + 1; l++) {
+        out << "    table";
+        for (int r = 0; r < 10; r++) {
+            out << "[" << "abc"[r % 3] << " " << r << " +";
+        }
+        out << std::string(10, ']') << " 1 + out writeline" << std::endl;
+    }
+    return { { "references", out.str() } };
+}
+
+
+// Aliases of declarations, each used in turn.
+Program many_aliases(int n) {
+    std::ostringstream out;
+    for (int a = 0; a < n; a++) {
+        out << "$v" << a << std::endl;
+        out << "{v" << a << " a" << a << "}" << std::endl;
+    }
+    out << "@aliases" << std::endl;
+    for (int a = 0; a < n; a++) {
+        out << "    a" << a << " a" << (a * 7) % n << " + out writeline" << std::endl;
+    }
+    return { { "aliases", out.str() } };
+}
+
+
+// Many small files, each calling into the one before.
+Program many_files(int n) {
+    Program files;
+    for (int f = 0; f < n / 20 + 1; f++) {
+        std::ostringstream out;
+        out << "$x @function" << f << std::endl;
+        for (int s = 0; s < 20; s++) {
+            out << "    x " << s << " + " << (f ? "function" + std::to_string(f - 1) : "out writeline") << std::endl;
+        }
+        files.push_back({ "file" + std::to_string(f), out.str() });
+    }
+    return files;
+}
+
+
+struct Shape {
+    const char* name;
+    Program (*generate)(int);
+    int size;                         // At scale 1.
+};
+
+
+const Shape shapes[] = {
+    { "deep",       deep_nesting,       4000 },
+    { "wide",       wide_scope,         50000 },
+    { "chains",     expression_chains,  100000 },
+    { "references", nested_references,  50000 },
+    { "aliases",    many_aliases,       40000 },
+    { "files",      many_files,         50000 }
+};
+
+
+struct Result {
+    std::string shape;
+    size_t bytes = 0;
+    size_t nodes = 0;
+    double lex_ms = 1e30;             // CPU time, the least of the repeats.
+    double parse_ms = 1e30;           // Less the lexing it does.
+    double semantics_ms = 1e30;
+    uint64_t allocations = 0;
+    long peak_rss_kb = 0;
+};
+
+
+size_t count_nodes(AST* ast) {
+    size_t count = 1;
+    if (ast->next) {
+        count += count_nodes(ast->next);
+    }
+    if (ast->type != AST_IDENTIFIER && ast->alt) {
+        count += count_nodes(ast->alt);
+    }
+    for (auto c: ast->children) {
+        count += count_nodes(c);
+    }
+    return count;
+}
+
+
+// Compiles the program as the driver would, each file under its own root and
+// then merged, and keeps the least CPU time of each phase, which varies less
+// than elapsed time on a busy machine. Lexing is timed on
+// its own first, as timing it a scope at a time within parsing would mostly
+// time the clock.
+void compile(const Program& program, Result& result) {
+    Stopwatch lexing;
+    Stopwatch parsing;
+    Stopwatch analysing;
+    auto start_allocations = thread_allocations();
+
+    auto global = NEW_AST(AST_SCOPE, "global", -1, true);
+    std::vector<AST*> roots;
+    for (auto& file: program) {
+        std::istringstream text(file.second);
+        auto file_id = open_source_stream(text, file.first);
+        {
+            lexing.start();
+            TokenStream tokens(file_id);
+            TokenStream::Iterator begin, end;
+            while (tokens.next_scope(begin, end)) {
+            }
+            lexing.stop();
+        }
+
+        auto root = NEW_AST(AST_SCOPE, global->name, global->depth, true);
+        parsing.start();
+        TokenStream tokens(file_id);
+        parse_to_ast(tokens, root);
+        tokens.finish();
+        parsing.stop();
+        if (tokens.failed()) {
+            std::cerr << "Lexing " << file.first << " failed" << std::endl;
+            std::exit(2);
+        }
+        roots.push_back(root);
+    }
+    for (auto root: roots) {
+        for (auto c: root->children) {
+            c->parent = global;
+            global->add_child(c);
+        }
+    }
+
+    analysing.start();
+    analyse_semantics(global);
+    analysing.stop();
+
+    result.nodes = count_nodes(global);
+    result.allocations = thread_allocations() - start_allocations;
+    result.lex_ms = std::min(result.lex_ms, lexing.cpu_ms);
+    result.parse_ms = std::min(result.parse_ms, std::max(0.0, parsing.cpu_ms - lexing.cpu_ms));
+    result.semantics_ms = std::min(result.semantics_ms, analysing.cpu_ms);
+
+    ast_arena().release();
+    close_source_files();
+}
+
+
+std::string result_line(const Result& r) {
+    std::ostringstream out;
+    out << r.shape << " " << r.bytes << " " << r.nodes << " " << r.lex_ms << " " << r.parse_ms << " "
+        << r.semantics_ms << " " << r.allocations << " " << r.peak_rss_kb;
+    return out.str();
+}
+
+
+bool read_result(std::istream& in, Result& r) {
+    return static_cast<bool>(
+        in >> r.shape >> r.bytes >> r.nodes >> r.lex_ms >> r.parse_ms >> r.semantics_ms >> r.allocations >> r.peak_rss_kb
+    );
+}
+
+
+// Each shape runs in a process of its own, so that its peak memory is its own.
+Result measure(const Shape& shape, int scale, int repeats) {
+    int results[2];
+    if (pipe(results) != 0) {
+        std::perror("pipe");
+        std::exit(2);
+    }
+    auto child = fork();
+    if (child == 0) {
+        close(results[0]);
+        Result result;
+        result.shape = shape.name;
+        auto program = shape.generate(shape.size * scale);
+        for (auto& file: program) {
+            result.bytes += file.second.size();
+        }
+        for (int r = 0; r < repeats; r++) {
+            compile(program, result);
+        }
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        result.peak_rss_kb = usage.ru_maxrss;
+        auto line = result_line(result);
+        auto written = write(results[1], line.data(), line.size());
+        _exit(written == static_cast<ssize_t>(line.size()) ? 0 : 2);
+    }
+
+    close(results[1]);
+    std::string line;
+    char buffer[256];
+    ssize_t got;
+    while ((got = read(results[0], buffer, sizeof(buffer))) > 0) {
+        line.append(buffer, got);
+    }
+    close(results[0]);
+    int status;
+    waitpid(child, &status, 0);
+
+    Result result;
+    std::istringstream in(line);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !read_result(in, result)) {
+        std::cerr << shape.name << " failed" << std::endl;
+        std::exit(2);
+    }
+    return result;
+}
+
+
+double mb_per_s(size_t bytes, double ms) {
+    return ms > 0 ? bytes / (ms * 1e3) : 0;
+}
+
+
+// Reports each measure that got worse than the baseline by more than the
+// tolerance. Baselines of other sizes can't be compared.
+int compare(const Result& now, const Result& base, double tolerance) {
+    if (now.bytes != base.bytes) {
+        std::cout << "    " << now.shape << ": baseline is of another size, not compared" << std::endl;
+        return 0;
+    }
+    int regressions = 0;
+    auto check = [&](const char* measure, double was, double is, double percent) {
+        if (is > was * (1 + percent / 100)) {
+            std::cout << "    " << now.shape << " " << measure << ": " << was << " -> " << is
+                      << " (+" << std::fixed << std::setprecision(1) << (is / was - 1) * 100 << "%)" << std::endl;
+            std::cout.unsetf(std::ios::fixed);
+            std::cout.precision(6);
+            regressions++;
+        }
+    };
+    check("lex CPU ms", base.lex_ms, now.lex_ms, tolerance);
+    check("parse CPU ms", base.parse_ms, now.parse_ms, tolerance);
+    check("semantics CPU ms", base.semantics_ms, now.semantics_ms, tolerance);
+    check("allocations", base.allocations, now.allocations, MEMORY_TOLERANCE);
+    check("peak RSS KB", base.peak_rss_kb, now.peak_rss_kb, MEMORY_TOLERANCE);
+    return regressions;
+}
+
+
+int main(int argc, char* argv[]) {
+    int scale = 1;
+    int repeats = 5;
+    double tolerance = 25;
+    std::string baseline = BASELINE;
+    bool save = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--scale" && i + 1 < argc) {
+            scale = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--repeats" && i + 1 < argc) {
+            repeats = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            tolerance = std::atof(argv[++i]);
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            baseline = argv[++i];
+        } else if (arg == "--save") {
+            save = true;
+        } else {
+            std::cerr << "Unknown argument " << arg << std::endl;
+            return 2;
+        }
+    }
+
+    std::vector<Result> results;
+    std::cout << std::left << std::setw(12) << "Shape" << std::right << std::setw(10) << "KB"
+              << std::setw(10) << "Nodes" << std::setw(10) << "Lex" << std::setw(10) << "Parse"
+              << std::setw(10) << "Semantic" << std::setw(12) << "Allocs" << std::setw(12) << "Peak KB"
+              << std::endl << std::setw(52) << "MB/s" << std::endl;
+    for (auto& shape: shapes) {
+        auto r = measure(shape, scale, repeats);
+        std::cout << std::left << std::setw(12) << r.shape << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << r.bytes / 1024.0 << std::setw(10) << r.nodes
+                  << std::setw(10) << mb_per_s(r.bytes, r.lex_ms) << std::setw(10) << mb_per_s(r.bytes, r.parse_ms)
+                  << std::setw(10) << mb_per_s(r.bytes, r.semantics_ms) << std::setw(12) << r.allocations
+                  << std::setw(12) << r.peak_rss_kb << std::endl;
+        std::cout.unsetf(std::ios::fixed);
+        std::cout.precision(6);
+        results.push_back(r);
+    }
+
+    if (save) {
+        std::ofstream out(baseline);
+        for (auto& r: results) {
+            out << result_line(r) << std::endl;
+        }
+        if (!out) {
+            std::cerr << "Unable to write " << baseline << std::endl;
+            return 2;
+        }
+        std::cout << "Saved " << baseline << std::endl;
+        return 0;
+    }
+
+    std::ifstream in(baseline);
+    if (!in) {
+        std::cout << "No baseline, run with --save to keep one" << std::endl;
+        return 0;
+    }
+    std::vector<Result> base;
+    Result r;
+    while (read_result(in, r)) {
+        base.push_back(r);
+    }
+    int regressions = 0;
+    std::cout << "Against " << baseline << ":" << std::endl;
+    for (auto& now: results) {
+        auto was = std::find_if(base.begin(), base.end(), [&](const Result& b) { return b.shape == now.shape; });
+        if (was != base.end()) {
+            regressions += compare(now, *was, tolerance);
+        }
+    }
+    std::cout << "    " << regressions << " regressions" << std::endl;
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+// Scandi: bench/symbols.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+//
+// Compares the table-driven get_symbol against the previous substr/rfind chain
+// on an operator-heavy line.
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../globals.h"
+#include "../lexer.h"
+
+
+size_t get_symbol(LexContext& context, std::string_view line_in, int line_no, size_t pos);
+
+
+// The previous implementation, kept here for comparison only.
+std::vector<int> legacy_operators {
+    LEX_REFERENCE_END, LEX_ASSIGNMENT, LEX_NEGATE_BEGIN, LEX_NEGATE_END, LEX_ADDRESS, LEX_ADD, LEX_SUB,
+    LEX_MULTIPLY, LEX_DIVIDE, LEX_MODULUS, LEX_COMPLEMENT, LEX_AND, LEX_OR, LEX_XOR, LEX_EQ, LEX_LT,
+    LEX_GT, LEX_ELSE
+};
+
+#define TOK_ADD( ... )                  context.tokens_out.push_back(Token( __VA_ARGS__ ))
+#define DEBUG_POS                       context.file_id, line_no, (pos + 1)
+#define CONSIDERING_STRING(TEST)        if (local.rfind(TEST, 0) == 0) {
+#define ALSO_CONSIDERING_STRING(TEST)   } else if (local.rfind(TEST, 0) == 0) {
+#define CONSIDERING_CHAR(TEST)          if (local[0] == TEST) {
+#define ALSO_CONSIDERING_CHAR(TEST)     } else if (local[0] == TEST) {
+#define STOP_CONSIDERING                }
+#define RETURN_POS_INC                  return ++pos
+#define RETURN_POS_INC2                 return pos + 2
+
+size_t legacy_get_symbol(LexContext& context, std::string line_in, int line_no, size_t pos) {
+    std::string local = line_in.substr(pos);
+    bool in_context = (pos > 0 && line_in[pos - 1] != LEX_SPACE && line_in[pos - 1] != LEX_ALIAS_BEGIN);
+
+    CONSIDERING_CHAR(LEX_COUNT)                     TOK_ADD(TOK_OPERATOR, LEX_COUNT, 0L, false, !in_context, DEBUG_POS);               RETURN_POS_INC;
+    ALSO_CONSIDERING_CHAR(LEX_DOT)                  TOK_ADD(TOK_OPERATOR, LEX_DOT, 0L, false, !in_context, DEBUG_POS);                 RETURN_POS_INC;
+    ALSO_CONSIDERING_STRING(LEX_VARARGS_CONTENTS)   TOK_ADD(TOK_OPERATOR, SYM_VARARGS_CONTENTS, 0L, false, !in_context, DEBUG_POS);    RETURN_POS_INC2;
+    ALSO_CONSIDERING_CHAR(LEX_REFERENCE_BEGIN)      TOK_ADD(TOK_OPERATOR, LEX_REFERENCE_BEGIN, 0L, false, !in_context, DEBUG_POS);     RETURN_POS_INC;
+    ALSO_CONSIDERING_STRING(LEX_RAW_BEGIN)                                                                                              RETURN_POS_INC2;
+    ALSO_CONSIDERING_STRING(LEX_VARIABLE_STATIC)    TOK_ADD(TOK_VARIABLE, SYM_EMPTY, 0L, true, false, DEBUG_POS);                      RETURN_POS_INC2;
+    ALSO_CONSIDERING_STRING(LEX_FUNCTION_STATIC)    TOK_ADD(TOK_FUNCTION, SYM_EMPTY, 0L, true, false, DEBUG_POS);                      RETURN_POS_INC2;
+    ALSO_CONSIDERING_STRING(LEX_NULL)               TOK_ADD(TOK_VALUE, SYM_NULL, 0L, true, false, DEBUG_POS);                          RETURN_POS_INC2;
+    ALSO_CONSIDERING_STRING(LEX_SHL)                TOK_ADD(TOK_OPERATOR, SYM_SHL, 0L, true, false, DEBUG_POS);                        RETURN_POS_INC2;
+    ALSO_CONSIDERING_STRING(LEX_SHR)                TOK_ADD(TOK_OPERATOR, SYM_SHR, 0L, true, false, DEBUG_POS);                        RETURN_POS_INC2;
+    ALSO_CONSIDERING_STRING(LEX_SSHR)               TOK_ADD(TOK_OPERATOR, SYM_SSHR, 0L, true, false, DEBUG_POS);                       RETURN_POS_INC2;
+    ALSO_CONSIDERING_STRING(LEX_GTE)                TOK_ADD(TOK_OPERATOR, SYM_GTE, 0L, true, false, DEBUG_POS);                        RETURN_POS_INC2;
+    ALSO_CONSIDERING_STRING(LEX_LTE)                TOK_ADD(TOK_OPERATOR, SYM_LTE, 0L, true, false, DEBUG_POS);                        RETURN_POS_INC2;
+    ALSO_CONSIDERING_CHAR(LEX_LABEL_DECL)           TOK_ADD(TOK_LABEL, SYM_EMPTY, 0L, false, false, DEBUG_POS);                        RETURN_POS_INC;
+    ALSO_CONSIDERING_CHAR(LEX_VARIABLE_DECL)        TOK_ADD(TOK_VARIABLE, SYM_EMPTY, 0L, false, false, DEBUG_POS);                     RETURN_POS_INC;
+    ALSO_CONSIDERING_CHAR(LEX_FUNCTION_DECL)        TOK_ADD(TOK_FUNCTION, SYM_EMPTY, 0L, false, false, DEBUG_POS);                     RETURN_POS_INC;
+    ALSO_CONSIDERING_CHAR(LEX_ALIAS_BEGIN)          TOK_ADD(TOK_ALIAS_BEGIN, SYM_EMPTY, 0L, false, false, DEBUG_POS);                  RETURN_POS_INC;
+    ALSO_CONSIDERING_CHAR(LEX_ALIAS_END)            TOK_ADD(TOK_ALIAS_END, SYM_EMPTY, 0L, false, false, DEBUG_POS);                    RETURN_POS_INC;
+    STOP_CONSIDERING
+
+    for (auto op: legacy_operators) {
+        CONSIDERING_CHAR(op)                        TOK_ADD(TOK_OPERATOR, op, 0L, false, false, DEBUG_POS);                            RETURN_POS_INC;
+        STOP_CONSIDERING
+    }
+    throw domain_error("Unknown symbol");
+}
+
+
+template <typename LEX>
+double time_line(LEX lex, const std::string& line, int repeats, size_t& tokens) {
+    std::vector<Token> tokens_out;
+    tokens_out.reserve(line.size());
+    LexContext context { tokens_out, 0 };
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; r++) {
+        tokens_out.clear();
+        size_t pos = 0;
+        while (pos < line.size()) {
+            pos = lex(context, line, 1, pos);
+        }
+    }
+    tokens = tokens_out.size();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+int main(int argc, char* argv[]) {
+    // Every symbol scandi has, digraphs included, without spaces between them.
+    const std::string pattern = "<-->>>?<?>()[]+-*/%~&|^?<>:=_]![.$$@@\\${}";
+    for (size_t length: { 64, 1024, 16384 }) {
+        std::string line;
+        while (line.size() < length) {
+            line += pattern;
+        }
+        int repeats = 4000000 / length;
+        size_t new_tokens, old_tokens;
+        double t_new = time_line(get_symbol, line, repeats, new_tokens);
+        double t_old = time_line(legacy_get_symbol, line, repeats, old_tokens);
+        if (new_tokens != old_tokens) {
+            std::cerr << "Token count mismatch: " << new_tokens << " vs " << old_tokens << std::endl;
+            return 1;
+        }
+        double symbols = static_cast<double>(new_tokens) * repeats;
+        std::cout << "line " << line.size() << " chars: table " << (t_new * 1e9 / symbols) << " ns/symbol, "
+                  << "legacy " << (t_old * 1e9 / symbols) << " ns/symbol ("
+                  << (t_old / t_new) << "x)" << std::endl;
+    }
+    return 0;
+}
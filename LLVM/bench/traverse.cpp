@@ -0,0 +1,107 @@
+// Scandi: bench/traverse.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+//
+// Compares walking the pointer AST with walking the flat layout, both for a
+// plain visit of every node and for semantic analysis. Also checks the two
+// layouts dump the same after analysis.
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "../ast.h"
+#include "../flat_ast.h"
+#include "../globals.h"
+#include "../lexer.h"
+#include "../parser.h"
+#include "../semantics.h"
+#include "../source.h"
+
+
+// Functions of nested conditionals and expressions with references, so the
+// tree has depth as well as width.
+std::string deep_program(int functions, int statements) {
+    std::ostringstream out;
+    for (int f = 0; f < functions; f++) {
+        out << "@function" << f << std::endl;
+        for (int s = 0; s < statements; s++) {
+            out << "    $v" << s << " " << s << " =" << std::endl;
+        }
+        for (int s = 0; s < statements; s++) {
+            out << "    v" << s << " 10 < ?" << std::endl;
+            out << "        v" << s << " table[v" << (s * 7) % statements << " 1 +] * 3 +" << std::endl;
+            out << "        v" << s << " 2 / out writeline" << std::endl;
+        }
+    }
+    return out.str();
+}
+
+
+long visit(AST* ast) {
+    long total = ast->depth;
+    if (ast->next) {
+        total += visit(ast->next);
+    }
+    if (ast->type != AST_IDENTIFIER && ast->alt) {
+        total += visit(ast->alt);
+    }
+    for (auto c: ast->children) {
+        total += visit(c);
+    }
+    return total;
+}
+
+
+long visit(const FlatAST& ast) {
+    long total = 0;
+    for (NodeId id = 0; id < ast.size(); id++) {
+        total += ast.depth[id];
+    }
+    return total;
+}
+
+
+template<typename PASS>
+double time_per_run(int repeats, PASS pass) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; r++) {
+        pass();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeats;
+}
+
+
+int main() {
+    std::istringstream text(deep_program(50, 400));
+    auto global = NEW_AST(AST_SCOPE, "global", -1, true);
+    TokenStream tokens(open_source_stream(text, "deep"));
+    parse_to_ast(tokens, global);
+
+    double flatten = time_per_run(5, [&]() { FlatAST flat(global); });
+    FlatAST flat(global);
+    std::cout << flat.size() << " nodes, flattened in " << flatten * 1e3 << " ms" << std::endl;
+
+    long sum = 0;
+    double pointer_visit = time_per_run(50, [&]() { sum += visit(global); });
+    double flat_visit = time_per_run(50, [&]() { sum += visit(flat); });
+    std::cout << "visit: pointer " << pointer_visit * 1e3 << " ms, flat " << flat_visit * 1e3
+              << " ms (" << sum % 10 << ")" << std::endl;
+
+    double pointer_semantics = time_per_run(5, [&]() { analyse_semantics(global); });
+    double flat_semantics = time_per_run(5, [&]() { analyse_semantics(flat); });
+    std::cout << "semantics: pointer " << pointer_semantics * 1e3 << " ms, flat "
+              << flat_semantics * 1e3 << " ms" << std::endl;
+
+    std::ostringstream pointer_dump;
+    std::ostringstream flat_dump;
+    pointer_dump << global;
+    flat_dump << flat;
+    if (pointer_dump.str() != flat_dump.str()) {
+        std::cout << "Dumps differ" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -2,7 +2,9 @@
 #
 
 clear
-clang++ --std=c++11 -Wall -g scandi.cpp lexer.cpp ast.cpp parser.cpp semantics.cpp codegen.cpp -o scandi
+# The runtime is always optimised, as programs spend their time in it.
+clang++ --std=c++17 -Wall -O2 -c runtime.cpp -o runtime.o
+clang++ --std=c++17 -Wall -g -pthread scandi.cpp arena.cpp source.cpp symbols.cpp lexer.cpp ast.cpp flat_ast.cpp cache.cpp parser.cpp semantics.cpp fold.cpp loops.cpp types.cpp codegen.cpp bytecode.cpp interpreter.cpp jit.cpp runtime.o server.cpp timing.cpp trace.cpp -I$(llvm-config --includedir) $(llvm-config --ldflags) -lLLVM-14 -o scandi
 
 # Test
 ./scandi $@
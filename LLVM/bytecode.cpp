@@ -0,0 +1,663 @@
+// Scandi: bytecode.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include "bytecode.h"
+#include "codegen.h"
+#include "globals.h"
+#include "lines.h"
+
+
+/*
+ *  Lines are followed as codegen follows them, by lines.h. Here, though,
+ *  operands are pushed onto the VM's stack as they are read, so that they are
+ *  there in order. A field target keeps its container and key on the stack
+ *  until it is assigned to, and the container's own, so it can be stored
+ *  back. = copies any other value back to the variable it was read from.
+ */
+
+// Values are on the VM's stack, so operands only say what they are.
+typedef Operand<NoPayload> Item;
+
+
+struct LoweringFunction {
+    AST* owner;                       // Null for main.
+    BytecodeFunction* function;
+    std::unordered_map<AST*, int32_t> labels;
+    vector<std::pair<size_t, AST*>> jumps;
+    uint32_t depth = 0;
+};
+
+
+struct Lowering {
+    Bytecode* program;
+    std::unordered_map<AST*, uint32_t> functions;
+    std::unordered_map<string, uint32_t> natives;
+    std::unordered_map<string, uint32_t> strings;
+    int64_t null_constant = -1;
+    LoweringFunction* current = nullptr;
+};
+
+Lowering* low = nullptr;
+
+
+/*
+ *  Instructions.
+ */
+
+// How many operands each instruction leaves, less how many it takes.
+// Superinstructions are only made after lowering, so aren't here.
+int stack_effect(const Instruction& i) {
+    switch (i.op) {
+        case BC_PUSH:
+        case BC_LOAD_LOCAL:
+        case BC_LOAD_GLOBAL:
+        case BC_LOAD_NAME:
+        case BC_LOAD_FRAME:
+        case BC_COUNT_ARGUMENTS:
+        case BC_NATIVE_VALUE:   return 1;
+        case BC_DUP2:           return 2;
+        case BC_COMPLEMENT:
+        case BC_COUNT:
+        case BC_JUMP:
+        case BC_RETURN_NULL:    return 0;
+        case BC_SET:
+        case BC_BRANCH_UNLESS:  return -2;
+        case BC_DROP:
+        case BC_NIP:            return -i.count;
+        case BC_CALL:
+        case BC_CALL_NATIVE:    return 1 - i.count;
+        default:                return -1;
+    }
+}
+
+
+size_t emit(Opcode op, int32_t arg = 0, size_t count = 0, uint8_t operation = 0) {
+    if (count > std::numeric_limits<uint16_t>::max()) {
+        DERR("Not yet implemented: more than 65535 operands");
+    }
+    auto current = low->current;
+    Instruction i { op, operation, static_cast<uint16_t>(count), arg };
+    current->function->code.push_back(i);
+    current->depth += stack_effect(i);
+    current->function->max_stack = std::max(current->function->max_stack, current->depth);
+    return current->function->code.size() - 1;
+}
+
+
+uint32_t constant(Value value) {
+    low->program->constants.push_back(value);
+    return low->program->constants.size() - 1;
+}
+
+
+static uint32_t string_constant(const string& text) {
+    auto found = low->strings.find(text);
+    if (found == low->strings.end()) {
+        found = low->strings.emplace(text, constant(scandi_string(text.data(), text.size()))).first;
+    }
+    return found->second;
+}
+
+
+uint32_t null_constant() {
+    if (low->null_constant < 0) {
+        low->null_constant = constant({ TAG_NULL, 0 });
+    }
+    return low->null_constant;
+}
+
+
+uint32_t native(const string& name) {
+    auto found = low->natives.find(name);
+    if (found == low->natives.end()) {
+        low->program->natives.push_back(name);
+        found = low->natives.emplace(name, low->program->natives.size() - 1).first;
+    }
+    return found->second;
+}
+
+
+// Jumps are dropped from wherever they are in a line, so the label finds the
+// stack as every line starts it. Code after one is never reached, and is
+// lowered as though the jump didn't happen.
+void jump(AST* label) {
+    auto depth = low->current->depth;
+    if (depth > 0) {
+        emit(BC_DROP, 0, depth);
+    }
+    low->current->jumps.push_back({ emit(BC_JUMP), label });
+    low->current->depth = depth;
+}
+
+
+/*
+ *  Operands.
+ */
+
+void load_variable(const Item& variable) {
+    if (!variable.decl) {
+        emit(BC_LOAD_NAME, string_constant(variable.name));
+    } else if (is_local(variable.decl, low->current->owner)) {
+        emit(BC_LOAD_LOCAL, variable.decl->slot);
+    } else {
+        emit(BC_LOAD_GLOBAL, variable.decl->slot);
+    }
+}
+
+
+void store_variable(const Item& variable) {
+    if (!variable.decl) {
+        emit(BC_STORE_NAME, string_constant(variable.name));
+    } else if (is_local(variable.decl, low->current->owner)) {
+        emit(BC_STORE_LOCAL, variable.decl->slot);
+    } else {
+        emit(BC_STORE_GLOBAL, variable.decl->slot);
+    }
+}
+
+
+void store(const Item& target) {
+    switch (target.kind) {
+        case Item::VALUE:
+            if (!target.decl && target.name.empty()) {
+                DERR("Can't assign to a value");
+            }
+            store_variable(target);
+            emit(BC_DROP, 0, 1);
+            return;
+        case Item::VARIABLE:
+            store_variable(target);
+            return;
+        case Item::FIELD:
+            emit(BC_SET);
+            if (target.container) {
+                store(*target.container);
+            } else {
+                emit(BC_DROP, 0, 1);
+            }
+            return;
+        case Item::RESULT:
+            emit(BC_RETURN);
+            return;
+        default:
+            DERR("Can't assign to a value");
+    }
+}
+
+
+/*
+ *  Lines.
+ */
+
+void lower_code(AST*);
+
+
+// Lowers each item as lines.h follows the line.
+struct LineLowerer : LinePass {
+    typedef ::Item Item;
+
+    LineLowerer() {
+        owner = low->current->owner;
+    }
+
+    void read(Item& operand) {
+        switch (operand.kind) {
+            case Item::VARIABLE:    load_variable(operand);         break;
+            case Item::FIELD:       emit(BC_GET);                   break;
+            case Item::RESULT:      emit(BC_PUSH, null_constant()); break;
+            default:                break;
+        }
+    }
+
+    void constant(AST* ast, Item&) {
+        switch (ast->type) {
+            case AST_BINARY:
+            case AST_STRING:
+                emit(BC_PUSH, string_constant(ast->name));
+                return;
+            case AST_LONG:
+                emit(BC_PUSH, ::constant({ TAG_LONG, ast->numeric_value.l }));
+                return;
+            case AST_DOUBLE: {
+                Value value { TAG_DOUBLE, 0 };
+                std::memcpy(&value.bits, &ast->numeric_value.d, sizeof(value.bits));
+                emit(BC_PUSH, ::constant(value));
+                return;
+            }
+            default:
+                emit(BC_PUSH, null_constant());
+                return;
+        }
+    }
+
+    // Pushes the value of container, which was the top operand, so that a key
+    // can be pushed after it. A target field's container keeps its own.
+    void field(Item& container, bool is_target, Item&) {
+        switch (container.kind) {
+            case Item::VARIABLE:
+                load_variable(container);
+                break;
+            case Item::FIELD:
+                if (is_target) {
+                    emit(BC_DUP2);
+                }
+                emit(BC_GET);
+                break;
+            case Item::RESULT:
+                emit(BC_PUSH, null_constant());
+                break;
+            default:
+                break;
+        }
+    }
+
+    void context_field(Item&) {
+        low->current->function->uses_frame = true;
+        emit(BC_LOAD_FRAME);
+    }
+
+    void name_key(AST* member, Item&) {
+        emit(BC_PUSH, string_constant(member->name));
+    }
+
+    // The key's other operands are dropped from under it.
+    void key(AST*, vector<Item>& key, Item&) {
+        if (key.empty()) {
+            emit(BC_PUSH, null_constant());
+            return;
+        }
+        auto under = std::count_if(key.begin(), key.end() - 1, [](const Item& i) { return i.kind == Item::VALUE; });
+        if (under > 0) {
+            emit(BC_NIP, 0, under);
+        }
+    }
+
+    void call(AST* function, vector<Item>& args, Item&) {
+        if (has_raw(function)) {
+            emit(BC_CALL_NATIVE, native(runtime_name(function)), args.size());
+        } else {
+            emit(BC_CALL, low->functions.at(function), args.size());
+        }
+    }
+
+    void jump(AST* label, AST*) {
+        ::jump(label);
+    }
+
+    void assign(AST*, Item& target, Item&) {
+        store(target);
+    }
+
+    void operate(AST*, int64_t operation, Item&, Item&, Item&) {
+        emit(static_cast<Opcode>(BC_ADD + operation));
+    }
+
+    void complement(AST*, Item&, Item&) {
+        emit(BC_COMPLEMENT);
+    }
+
+    void count(AST*, Item* a, Item&) {
+        emit(a ? BC_COUNT : BC_COUNT_ARGUMENTS);
+    }
+};
+
+
+/*
+ *  Structure.
+ */
+
+void lower_expression(AST* ast) {
+    LineLowerer pass;
+    follow_line(ast, pass);
+    // The stack is cleared at the end of each line.
+    if (low->current->depth > 0) {
+        emit(BC_DROP, 0, low->current->depth);
+    }
+    for (auto c: ast->children) {
+        lower_code(c);
+    }
+}
+
+
+void lower_conditional(AST* ast) {
+    LineLowerer pass;
+    vector<Item> stack;
+    follow_chain(ast->next, stack, 0, pass);
+    size_t to_false;
+    if (stack.size() >= 2) {
+        auto operation = operation_of(ast->name.substr(0, ast->name.find('_')));
+        if (operation < 0) {
+            DERR("Not yet implemented: conditional " + ast->name);
+        }
+        take(stack, 2, pass);
+        if (stack.empty() && operation >= OP_EQ && operation <= OP_GTE) {
+            to_false = emit(BC_BRANCH_UNLESS, 0, 0, operation);
+        } else {
+            emit(static_cast<Opcode>(BC_ADD + operation));
+            if (low->current->depth > 1) {
+                emit(BC_NIP, 0, low->current->depth - 1);
+            }
+            to_false = emit(BC_BRANCH_FALSE);
+        }
+    } else if (stack.size() == 1) {
+        take(stack, 1, pass);
+        to_false = emit(BC_BRANCH_FALSE);
+    } else {
+        to_false = emit(BC_JUMP);
+    }
+
+    auto& code = low->current->function->code;
+    for (auto c: ast->children) {
+        lower_code(c);
+    }
+    if (ast->alt) {
+        auto to_end = emit(BC_JUMP);
+        code[to_false].arg = code.size();
+        for (auto e: ast->alt->children) {
+            lower_code(e);
+        }
+        code[to_end].arg = code.size();
+    } else {
+        code[to_false].arg = code.size();
+    }
+}
+
+
+void lower_label(AST* ast) {
+    low->current->labels[ast] = low->current->function->code.size();
+    for (auto c: ast->children) {
+        lower_code(c);
+    }
+}
+
+
+void lower_variable(AST* ast) {
+    for (auto c: ast->children) {
+        lower_code(c);
+    }
+}
+
+
+void lower_scope(AST* ast) {
+    for (auto c: ast->children) {
+        lower_code(c);
+    }
+}
+
+
+void finish_function(LoweringFunction& state) {
+    emit(BC_RETURN_NULL);
+    for (auto& j: state.jumps) {
+        state.function->code[j.first].arg = state.labels.at(j.second);
+    }
+    state.function->slots = state.owner ? state.owner->slot : 0;
+}
+
+
+void lower_function(AST* ast) {
+    if (has_raw(ast)) {
+        return;
+    }
+    auto caller = low->current;
+    LoweringFunction state { ast, &low->program->functions[low->functions.at(ast)] };
+    low->current = &state;
+    state.function->named = parameters(ast).size();
+
+    for (auto c: ast->children) {
+        lower_code(c);
+    }
+    finish_function(state);
+    low->current = caller;
+}
+
+
+void lower_code(AST* ast) {
+    switch (ast->type) {
+        case AST_SCOPE:         lower_scope(ast);        break;
+        case AST_RAW:                                    break;
+        case AST_LABEL:         lower_label(ast);        break;
+        case AST_VARIABLE:      lower_variable(ast);     break;
+        case AST_FUNCTION:      lower_function(ast);     break;
+        case AST_ALIAS:                                  break;
+        case AST_CONDITIONAL:   lower_conditional(ast);  break;
+        case AST_EXPRESSION:
+        case AST_IDENTIFIER:
+        case AST_BINARY:
+        case AST_STRING:
+        case AST_LONG:
+        case AST_DOUBLE:
+        case AST_NULL:
+        case AST_REFERENCE:
+        case AST_OPERATOR:      lower_expression(ast);   break;
+        default: DERR("Unknown AST. This is probably a bug.");
+    }
+}
+
+
+/*
+ *  The program.
+ */
+
+static void declare_functions(AST* global) {
+    for (auto f: declarations_of(global, AST_FUNCTION)) {
+        if (!has_raw(f)) {
+            low->functions.emplace(f, low->program->functions.size());
+            low->program->functions.push_back({ qualified_name(f) });
+        }
+    }
+}
+
+
+static void initialise_variables(AST* global) {
+    for (auto v: declarations_of(global, AST_VARIABLE)) {
+        if (has_raw(v) && is_global(v)) {
+            emit(BC_NATIVE_VALUE, native(runtime_name(v)));
+            emit(BC_STORE_GLOBAL, v->slot);
+        }
+    }
+}
+
+
+Bytecode lower_program(AST* global) {
+    Bytecode program {};
+    Lowering lowering;
+    lowering.program = &program;
+    low = &lowering;
+    try {
+        program.functions.push_back({ "main" });
+        program.globals = global->slot;
+        declare_functions(global);
+
+        LoweringFunction state { nullptr, &program.functions[0] };
+        lowering.current = &state;
+        initialise_variables(global);
+        lower_code(global);
+        finish_function(state);
+    } catch (...) {
+        low = nullptr;
+        throw;
+    }
+    low = nullptr;
+    return program;
+}
+
+
+/*
+ *  Fusion. Each superinstruction replaces a sequence that nothing jumps into
+ *  the middle of, and jumps are moved to where their targets went.
+ */
+
+static bool is_branch(Opcode op) {
+    switch (op) {
+        case BC_JUMP:
+        case BC_BRANCH_FALSE:
+        case BC_BRANCH_UNLESS:
+        case BC_BRANCH_UNLESS_COUNT:
+        case BC_GET_BRANCH_UNLESS:
+        case BC_GET_BRANCH_UNLESS_CONSTANT:   return true;
+        default:                            return false;
+    }
+}
+
+
+static bool is_comparison(Opcode op) {
+    return op >= BC_EQ && op <= BC_GTE;
+}
+
+
+// Gives the superinstruction for the sequence at pc, and sets length to how
+// many instructions it replaces, or gives code[pc] and 1 if there isn't one.
+static Instruction fuse(const vector<Instruction>& code, size_t pc, const vector<bool>& is_target, size_t& length) {
+    auto within = [&](size_t n) {
+        if (pc + n > code.size()) {
+            return false;
+        }
+        for (size_t i = pc + 1; i < pc + n; i++) {
+            if (is_target[i]) {
+                return false;
+            }
+        }
+        return true;
+    };
+    auto fits = [](int32_t index) { return index <= std::numeric_limits<uint16_t>::max(); };
+    auto& i = code[pc];
+
+    // x 1 +, or x 1 -
+    if ((i.op == BC_LOAD_LOCAL || i.op == BC_LOAD_GLOBAL) && within(4) && code[pc + 1].op == BC_PUSH
+        && fits(code[pc + 1].arg) && (code[pc + 2].op == BC_ADD || code[pc + 2].op == BC_SUB)
+        && code[pc + 3].op == i.op + 1 && code[pc + 3].arg == i.arg) {
+        length = 4;
+        auto op = i.op == BC_LOAD_LOCAL ? BC_INCREMENT_LOCAL : BC_INCREMENT_GLOBAL;
+        return { op, static_cast<uint8_t>(code[pc + 2].op - BC_ADD), static_cast<uint16_t>(code[pc + 1].arg), i.arg };
+    }
+    if (i.op == BC_GET && within(3) && code[pc + 1].op == BC_PUSH && fits(code[pc + 1].arg)
+        && code[pc + 2].op == BC_BRANCH_UNLESS) {
+        length = 3;
+        return { BC_GET_BRANCH_UNLESS_CONSTANT, code[pc + 2].operation, static_cast<uint16_t>(code[pc + 1].arg), code[pc + 2].arg };
+    }
+    if ((i.op == BC_GET || i.op == BC_COUNT) && within(2) && code[pc + 1].op == BC_BRANCH_UNLESS) {
+        length = 2;
+        auto op = i.op == BC_GET ? BC_GET_BRANCH_UNLESS : BC_BRANCH_UNLESS_COUNT;
+        return { op, code[pc + 1].operation, 0, code[pc + 1].arg };
+    }
+    if (is_comparison(i.op) && within(2) && code[pc + 1].op == BC_BRANCH_FALSE) {
+        length = 2;
+        return { BC_BRANCH_UNLESS, static_cast<uint8_t>(i.op - BC_ADD), 0, code[pc + 1].arg };
+    }
+    length = 1;
+    return i;
+}
+
+
+void fuse_instructions(Bytecode& program) {
+    for (auto& f: program.functions) {
+        auto& code = f.code;
+        vector<bool> is_target(code.size() + 1);
+        for (auto& i: code) {
+            if (is_branch(i.op)) {
+                is_target[i.arg] = true;
+            }
+        }
+
+        vector<Instruction> fused;
+        vector<int32_t> moved(code.size() + 1);
+        for (size_t pc = 0; pc < code.size(); ) {
+            size_t length;
+            auto i = fuse(code, pc, is_target, length);
+            for (size_t n = 0; n < length; n++) {
+                moved[pc + n] = fused.size();
+            }
+            fused.push_back(i);
+            pc += length;
+        }
+        moved[code.size()] = fused.size();
+        for (auto& i: fused) {
+            if (is_branch(i.op)) {
+                i.arg = moved[i.arg];
+            }
+        }
+        code = std::move(fused);
+    }
+}
+
+
+/*
+ *  Listing.
+ */
+
+const char* opcode_name(Opcode op) {
+    static const char* names[] = {
+        "PUSH", "LOAD_LOCAL", "STORE_LOCAL", "LOAD_GLOBAL", "STORE_GLOBAL", "LOAD_NAME", "STORE_NAME", "LOAD_FRAME",
+        "ADD", "SUB", "MULTIPLY", "DIVIDE", "MODULUS", "AND", "OR", "XOR", "SHL", "SHR", "SSHR",
+        "EQ", "LT", "LTE", "GT", "GTE", "COMPLEMENT",
+        "COUNT", "COUNT_ARGUMENTS", "GET", "SET", "DUP2", "DROP", "NIP",
+        "JUMP", "BRANCH_FALSE", "BRANCH_UNLESS",
+        "CALL", "CALL_NATIVE", "NATIVE_VALUE", "RETURN", "RETURN_NULL",
+        "INCREMENT_LOCAL", "INCREMENT_GLOBAL", "BRANCH_UNLESS_COUNT", "GET_BRANCH_UNLESS", "GET_BRANCH_UNLESS_CONSTANT"
+    };
+    return names[op];
+}
+
+
+static void list_constant(ostream& os, const Value& value) {
+    if (value.tag == TAG_STRING) {
+        os << " \"" << reinterpret_cast<const String*>(value.bits)->text << "\"";
+    } else if (value.tag == TAG_NULL) {
+        os << " ()";
+    } else {
+        os << " " << value.bits;
+    }
+}
+
+
+ostream& operator<<(ostream& os, const Bytecode& program) {
+    for (auto& f: program.functions) {
+        os << f.name << ": " << f.named << " named, " << f.slots << " slots, stack " << f.max_stack
+           << (f.uses_frame ? ", local context" : "") << std::endl;
+        for (size_t pc = 0; pc < f.code.size(); pc++) {
+            auto& i = f.code[pc];
+            os << "    " << pc << " " << opcode_name(i.op);
+            switch (i.op) {
+                case BC_PUSH:
+                case BC_LOAD_NAME:
+                case BC_STORE_NAME:     list_constant(os, program.constants[i.arg]); break;
+                case BC_CALL:           os << " " << program.functions[i.arg].name << " " << i.count; break;
+                case BC_CALL_NATIVE:    os << " " << program.natives[i.arg] << " " << i.count; break;
+                case BC_NATIVE_VALUE:   os << " " << program.natives[i.arg]; break;
+                case BC_DROP:
+                case BC_NIP:            os << " " << i.count; break;
+                case BC_BRANCH_UNLESS:
+                case BC_BRANCH_UNLESS_COUNT:
+                case BC_GET_BRANCH_UNLESS:
+                    os << " " << opcode_name(static_cast<Opcode>(BC_ADD + i.operation)) << " " << i.arg;
+                    break;
+                case BC_GET_BRANCH_UNLESS_CONSTANT:
+                    os << " " << opcode_name(static_cast<Opcode>(BC_ADD + i.operation));
+                    list_constant(os, program.constants[i.count]);
+                    os << " " << i.arg;
+                    break;
+                case BC_INCREMENT_LOCAL:
+                case BC_INCREMENT_GLOBAL:
+                    os << " " << i.arg << " " << opcode_name(static_cast<Opcode>(BC_ADD + i.operation));
+                    list_constant(os, program.constants[i.count]);
+                    break;
+                case BC_LOAD_LOCAL:
+                case BC_STORE_LOCAL:
+                case BC_LOAD_GLOBAL:
+                case BC_STORE_GLOBAL:
+                case BC_JUMP:
+                case BC_BRANCH_FALSE:   os << " " << i.arg; break;
+                default:                break;
+            }
+            os << std::endl;
+        }
+    }
+    return os;
+}
@@ -0,0 +1,116 @@
+// Scandi: bytecode.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <cstdint>
+#include "ast.h"
+#include "globals.h"
+#include "runtime.h"
+
+
+// The bytecode backend, for --interp. It is lowered from the analysed tree
+// much as codegen generates IR: operands are read in the same order, and
+// values are those of runtime.h, so programs print the same either way, which
+// bench/backends checks. Declared variables are kept in the slots semantics
+// gave them, in each call's frame, or among the globals.
+//
+// Operands are on a stack, as in the language. Most instructions take theirs
+// from the top and push their result.
+enum Opcode : uint8_t {
+    BC_PUSH,                          // constants[arg]
+    BC_LOAD_LOCAL,                    // The frame's slot arg.
+    BC_STORE_LOCAL,
+    BC_LOAD_GLOBAL,                   // The global slot arg.
+    BC_STORE_GLOBAL,
+    BC_LOAD_NAME,                     // The global named by constants[arg].
+    BC_STORE_NAME,
+    BC_LOAD_FRAME,                    // The local context table.
+
+    // In the order of runtime.h's Operation. BC_ADD + op is op.
+    BC_ADD,
+    BC_SUB,
+    BC_MULTIPLY,
+    BC_DIVIDE,
+    BC_MODULUS,
+    BC_AND,
+    BC_OR,
+    BC_XOR,
+    BC_SHL,
+    BC_SHR,
+    BC_SSHR,
+    BC_EQ,
+    BC_LT,
+    BC_LTE,
+    BC_GT,
+    BC_GTE,
+    BC_COMPLEMENT,
+
+    BC_COUNT,
+    BC_COUNT_ARGUMENTS,               // How many arguments weren't named.
+    BC_GET,                           // container key -> value
+    BC_SET,                           // container key value -> container
+    BC_DUP2,
+    BC_DROP,                          // count operands.
+    BC_NIP,                           // count operands under the top one.
+
+    BC_JUMP,                          // To arg.
+    BC_BRANCH_FALSE,                  // Pops a value, and jumps to arg unless it is true.
+    BC_BRANCH_UNLESS,                 // Pops two, and jumps to arg unless operation holds.
+
+    BC_CALL,                          // functions[arg] with count operands.
+    BC_CALL_NATIVE,                   // natives[arg], embedded code, likewise.
+    BC_NATIVE_VALUE,                  // The first value of embedded variable natives[arg].
+    BC_RETURN,                        // Returns the top operand.
+    BC_RETURN_NULL,
+
+    // Superinstructions, which fuse_instructions makes of common sequences.
+    BC_INCREMENT_LOCAL,               // Slot arg operation= constants[count], as x 1 + lowers.
+    BC_INCREMENT_GLOBAL,
+    BC_BRANCH_UNLESS_COUNT,           // BC_COUNT then BC_BRANCH_UNLESS, as in n line! ?
+    BC_GET_BRANCH_UNLESS,             // BC_GET then BC_BRANCH_UNLESS, as in a [b] <
+    BC_GET_BRANCH_UNLESS_CONSTANT     // The same, against constants[count], as in line[n] '(' ?
+};
+
+
+struct Instruction {
+    Opcode op;
+    uint8_t operation;                // For branches and increments, an Operation.
+    uint16_t count;
+    int32_t arg;
+};
+
+
+struct BytecodeFunction {
+    string name;
+    vector<Instruction> code;
+    uint32_t named;                   // Parameters, which are the first slots.
+    uint32_t slots;
+    uint32_t max_stack;
+    bool uses_frame;                  // Whether it needs its local context table.
+};
+
+
+// Function 0 is main, which runs each file's top level code in file order.
+struct Bytecode {
+    vector<Value> constants;
+    vector<BytecodeFunction> functions;
+    vector<string> natives;           // By runtime.h name.
+    uint32_t globals;
+};
+
+
+Bytecode lower_program(AST* global);
+
+// Replaces the sequences Scandi's idioms lower to with superinstructions,
+// so that there are fewer to dispatch and less for them to push and pop.
+void fuse_instructions(Bytecode&);
+
+// Gives the program's exit status. The runtime exits the process itself if
+// the program fails.
+int interpret(const Bytecode&);
+
+// A listing, for tracing.
+ostream& operator<<(ostream&, const Bytecode&);
@@ -0,0 +1,548 @@
+// Scandi: cache.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include "cache.h"
+#include "flat_ast.h"
+#include "globals.h"
+#include "source.h"
+
+
+#define CACHE_MAGIC         "SCANDILC"
+#define CACHE_VERSION       2
+#define BUILD_MAGIC         "SCANDIBC"
+#define BUILD_VERSION       2
+#define BUILD_SUFFIX        ".ast"
+#define GLOBAL_LINK         (NO_NODE - 1)
+#define PADDED( bytes )     (((bytes) + 7) & ~static_cast<size_t>(7))
+
+
+/*
+ *  The cache is written in host byte order, with every section padded to 8
+ *  bytes, so that the mapped file can be read in place:
+ *
+ *  CacheHeader
+ *  For each module:
+ *      ModuleHeader
+ *      CachedNode[node_count]    Nodes in FlatAST order, the root first.
+ *      uint32_t[child_count]     Children of each node, in order.
+ *      char[string_bytes]        Names, each stored once.
+ *
+ *  A build cache entry is the same, with a magic of its own and one module,
+ *  followed by:
+ *
+ *  uint32_t                      link_count, either 0 or node_count.
+ *  uint32_t[link_count]          What each identifier is linked to: a node in
+ *                                the module, GLOBAL_LINK if it was looked up
+ *                                from the global scope, or NO_NODE.
+ */
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t module_count;
+    uint64_t content_hash;
+};
+
+
+struct ModuleHeader {
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t node_count;
+    uint32_t child_count;
+    uint32_t string_bytes;
+    uint32_t reserved;
+};
+
+
+struct CachedNode {
+    decltype(AST::numeric_value) numeric_value;
+    uint32_t name_offset;
+    uint32_t name_length;
+    int32_t depth;
+    uint32_t parent;
+    uint32_t next;
+    uint32_t alt;
+    uint32_t first_child;
+    uint32_t child_count;
+    uint8_t type;
+    char properties;
+    uint16_t reserved;
+};
+static_assert(sizeof(CachedNode) == 48, "CachedNode is part of the cache format");
+
+
+uint64_t hash_bytes(std::string_view bytes, uint64_t seed) {
+    uint64_t hash = seed;
+    for (unsigned char c: bytes) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+template<typename T>
+void append_raw(std::string& out, const T* items, size_t count) {
+    out.append(reinterpret_cast<const char*>(items), sizeof(T) * count);
+    out.append(PADDED(out.size()) - out.size(), '\0');
+}
+
+
+void append_module(std::string& out, const string& module, AST* root) {
+    FlatAST flat(root);
+    std::string strings;
+    std::unordered_map<Symbol, uint32_t> offsets;
+    auto add_string = [&](std::string_view text) {
+        uint32_t offset = strings.size();
+        strings.append(text);
+        return offset;
+    };
+
+    ModuleHeader header {};
+    header.name_offset = add_string(module);
+    header.name_length = module.size();
+    header.node_count = flat.size();
+    header.child_count = flat.child_list.size();
+
+    vector<CachedNode> nodes(flat.size());
+    for (NodeId id = 0; id < flat.size(); id++) {
+        auto& node = nodes[id];
+        auto found = offsets.find(flat.name[id]);
+        if (found == offsets.end()) {
+            found = offsets.emplace(flat.name[id], add_string(symbol_name(flat.name[id]))).first;
+        }
+        node.numeric_value = flat.numeric_value[id];
+        node.name_offset = found->second;
+        node.name_length = symbol_name(flat.name[id]).size();
+        node.depth = flat.depth[id];
+        node.parent = flat.parent[id];
+        node.next = flat.next[id];
+        node.alt = flat.alt[id];
+        node.first_child = flat.first_child[id];
+        node.child_count = flat.first_child[id + 1] - flat.first_child[id];
+        node.type = flat.type[id];
+        node.properties = flat.properties[id];
+    }
+    header.string_bytes = strings.size();
+
+    append_raw(out, &header, 1);
+    append_raw(out, nodes.data(), nodes.size());
+    append_raw(out, flat.child_list.data(), flat.child_list.size());
+    append_raw(out, strings.data(), strings.size());
+}
+
+
+// Cache files the compile server has read or written, by path, so that later
+// compiles needn't go to disk. Only the latest build entry of each source is
+// kept, so that edits don't pile up.
+bool keep_resident = false;
+std::unordered_map<std::string, std::string> resident;
+std::unordered_map<std::string, std::string> resident_entries;     // By the source's prefix.
+
+
+void keep_caches_resident() {
+    keep_resident = true;
+}
+
+
+void keep_entry_resident(const std::string& source, const std::string& path) {
+    auto& kept = resident_entries[source];
+    if (!kept.empty() && kept != path) {
+        resident.erase(kept);
+    }
+    kept = path;
+}
+
+
+// Gives the contents of the cache file, from memory if the server has them.
+bool read_cache_file(SourceFile& file, std::string_view& data) {
+    if (keep_resident) {
+        auto found = resident.find(file.path);
+        if (found != resident.end()) {
+            data = found->second;
+            return true;
+        }
+    }
+    if (!file.map_file()) {
+        return false;
+    }
+    data = file.text;
+    if (keep_resident) {
+        data = resident[file.path] = string(file.text);
+    }
+    return true;
+}
+
+
+// Written aside and renamed into place, so another compile never maps a half
+// written cache.
+bool write_cache_file(const std::string& path, const std::string& out) {
+    if (keep_resident) {
+        resident[path] = out;
+    }
+    auto temp_path = path + "." + std::to_string(getpid());
+    std::ofstream file(temp_path, std::ios::binary);
+    file.write(out.data(), out.size());
+    file.close();
+    if (!file || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+void append_cache_header(std::string& out, const char* magic, uint32_t version, uint32_t module_count, uint64_t content_hash) {
+    CacheHeader header {};
+    std::memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    header.module_count = module_count;
+    header.content_hash = content_hash;
+    append_raw(out, &header, 1);
+}
+
+
+bool save_library_cache(
+    const std::string& path,
+    uint64_t content_hash,
+    const vector<string>& modules,
+    const vector<AST*>& roots
+) {
+    std::string out;
+    append_cache_header(out, CACHE_MAGIC, CACHE_VERSION, roots.size(), content_hash);
+    for (size_t m = 0; m < roots.size(); m++) {
+        append_module(out, modules[m], roots[m]);
+    }
+    return write_cache_file(path, out);
+}
+
+
+// Takes the next section of the mapped cache, or nullptr if it would run past
+// the end.
+const char* take_section(std::string_view data, size_t& offset, size_t bytes) {
+    if (offset > data.size() || bytes > data.size() - offset) {
+        return nullptr;
+    }
+    auto section = data.data() + offset;
+    offset += PADDED(bytes);
+    return section;
+}
+
+
+bool take_cache_header(std::string_view data, size_t& offset, const char* magic, uint32_t version, uint32_t module_count, uint64_t content_hash) {
+    auto header = reinterpret_cast<const CacheHeader*>(take_section(data, offset, sizeof(CacheHeader)));
+    return (
+        header
+     && std::memcmp(header->magic, magic, sizeof(header->magic)) == 0
+     && header->version == version
+     && header->content_hash == content_hash
+     && header->module_count == module_count
+    );
+}
+
+
+bool is_ast_type(uint8_t type) {
+    switch (type) {
+        case AST_SCOPE: case AST_RAW:
+        case AST_LABEL: case AST_VARIABLE: case AST_FUNCTION: case AST_ALIAS: case AST_EXPRESSION: case AST_CONDITIONAL:
+        case AST_IDENTIFIER: case AST_BINARY: case AST_STRING: case AST_LONG: case AST_DOUBLE: case AST_NULL:
+        case AST_REFERENCE: case AST_OPERATOR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+// Builds the module's tree if it is wanted, giving its nodes in FlatAST order.
+// Modules that aren't wanted are still checked, so a damaged cache is never
+// partly used.
+bool load_module(std::string_view data, size_t& offset, const string& module, bool wanted, vector<AST*>& built) {
+    auto header = reinterpret_cast<const ModuleHeader*>(take_section(data, offset, sizeof(ModuleHeader)));
+    if (!header) {
+        return false;
+    }
+    auto nodes = reinterpret_cast<const CachedNode*>(take_section(data, offset, sizeof(CachedNode) * header->node_count));
+    auto children = reinterpret_cast<const uint32_t*>(take_section(data, offset, sizeof(uint32_t) * header->child_count));
+    auto strings = take_section(data, offset, header->string_bytes);
+    if (!nodes || !children || !strings || header->node_count == 0) {
+        return false;
+    }
+    auto in_strings = [&](uint32_t at, uint32_t length) {
+        return at <= header->string_bytes && length <= header->string_bytes - at;
+    };
+    auto in_nodes = [&](uint32_t id) {
+        return id == NO_NODE || id < header->node_count;
+    };
+    if (!in_strings(header->name_offset, header->name_length)
+     || std::string_view(strings + header->name_offset, header->name_length) != module) {
+        return false;
+    }
+
+    // Check everything before building anything, as a stale or damaged cache
+    // is simply ignored. Nodes are in the order flat_order gives, so each
+    // comes after its parent, and is the next, branch or child of only one
+    // node before it: anything else could make a cycle.
+    vector<bool> placed(header->node_count, false);
+    auto place = [&](uint32_t id, uint32_t after) {
+        if (id == NO_NODE) {
+            return true;
+        }
+        if (id <= after || placed[id]) {
+            return false;
+        }
+        placed[id] = true;
+        return true;
+    };
+    for (uint32_t id = 0; id < header->node_count; id++) {
+        auto& node = nodes[id];
+        if (!in_strings(node.name_offset, node.name_length) || !is_ast_type(node.type)
+         || !in_nodes(node.parent) || !in_nodes(node.next) || !in_nodes(node.alt)
+         || (node.parent != NO_NODE && node.parent >= id)
+         || !place(node.next, id) || (node.type != AST_IDENTIFIER && !place(node.alt, id))
+         || node.first_child > header->child_count
+         || node.child_count > header->child_count - node.first_child) {
+            return false;
+        }
+        for (uint32_t c = node.first_child; c < node.first_child + node.child_count; c++) {
+            if (children[c] >= header->node_count || !place(children[c], id)) {
+                return false;
+            }
+        }
+    }
+
+    built.clear();
+    if (!wanted) {
+        return true;
+    }
+
+    built.resize(header->node_count);
+    for (uint32_t id = 0; id < header->node_count; id++) {
+        auto& node = nodes[id];
+        auto name = std::string_view(strings + node.name_offset, node.name_length);
+        built[id] = NEW_AST(static_cast<ASTType>(node.type), name, node.depth, false);
+        built[id]->properties = node.properties;
+        built[id]->numeric_value = node.numeric_value;
+    }
+    for (uint32_t id = 0; id < header->node_count; id++) {
+        auto& node = nodes[id];
+        auto ast = built[id];
+        ast->parent = node.parent == NO_NODE ? nullptr : built[node.parent];
+        ast->next = node.next == NO_NODE ? nullptr : built[node.next];
+        ast->alt = node.alt == NO_NODE ? nullptr : built[node.alt];
+        for (uint32_t c = node.first_child; c < node.first_child + node.child_count; c++) {
+            ast->add_child(built[children[c]]);
+        }
+    }
+
+    // Parameters are only all linked once every node is.
+    for (auto ast: built) {
+        if (ast->type == AST_FUNCTION) {
+            for (auto p = ast->next; p; p = p->next) {
+                ast->index_parameter(p);
+            }
+        }
+    }
+    return true;
+}
+
+
+bool load_library_cache(
+    const std::string& path,
+    uint64_t content_hash,
+    const vector<string>& modules,
+    const vector<bool>& wanted,
+    vector<AST*>& roots_out
+) {
+    SourceFile cache("library cache", path);
+    std::string_view data;
+    size_t offset = 0;
+    if (!read_cache_file(cache, data) || !take_cache_header(data, offset, CACHE_MAGIC, CACHE_VERSION, modules.size(), content_hash)) {
+        return false;
+    }
+
+    vector<AST*> roots(modules.size(), nullptr);
+    vector<AST*> built;
+    for (size_t m = 0; m < modules.size(); m++) {
+        if (!load_module(data, offset, modules[m], wanted[m], built)) {
+            return false;
+        }
+        roots[m] = built.empty() ? nullptr : built[0];
+    }
+    roots_out = std::move(roots);
+    return true;
+}
+
+
+// The order FlatAST numbers nodes in.
+void flat_order(AST* ast, vector<AST*>& order) {
+    order.push_back(ast);
+    if (ast->next) {
+        flat_order(ast->next, order);
+    }
+    if (ast->alt && ast->type != AST_IDENTIFIER) {
+        flat_order(ast->alt, order);
+    }
+    for (auto c: ast->children) {
+        flat_order(c, order);
+    }
+}
+
+
+// Entries are named after the source file's full path, then its contents, so
+// that the entries a source has had can be found by the first part.
+std::string build_entry_prefix(const std::string& source) {
+    char full[PATH_MAX];
+    auto path = realpath(source.c_str(), full) ? std::string(full) : source;
+    std::ostringstream prefix;
+    prefix << std::hex << std::setw(16) << std::setfill('0') << hash_bytes(path) << "-";
+    return prefix.str();
+}
+
+
+std::string build_entry_path(const std::string& dir, const std::string& prefix, uint64_t content_hash) {
+    std::ostringstream path;
+    path << dir << prefix << std::hex << std::setw(16) << std::setfill('0') << content_hash << BUILD_SUFFIX;
+    return path.str();
+}
+
+
+// Removes the entries the source had before this one, so that the cache only
+// grows with the number of sources built, not with every edit to them.
+void remove_superseded_entries(const std::string& dir, const std::string& prefix, const std::string& current) {
+    auto found = opendir(dir.c_str());
+    if (!found) {
+        return;
+    }
+    while (auto entry = readdir(found)) {
+        std::string name = entry->d_name;
+        if (
+            name.compare(0, prefix.size(), prefix) == 0 && name.size() > std::strlen(BUILD_SUFFIX)
+         && name.compare(name.size() - std::strlen(BUILD_SUFFIX), std::string::npos, BUILD_SUFFIX) == 0
+         && dir + name != current
+        ) {
+            std::remove((dir + name).c_str());
+        }
+    }
+    closedir(found);
+}
+
+
+bool load_build_entry(
+    const std::string& dir,
+    const std::string& source,
+    uint64_t content_hash,
+    const string& module,
+    AST*& root_out,
+    bool& linked_out,
+    vector<BuildLink>& links_out
+) {
+    auto prefix = build_entry_prefix(source);
+    SourceFile entry("build cache", build_entry_path(dir, prefix, content_hash));
+    std::string_view data;
+    size_t offset = 0;
+    vector<AST*> built;
+    if (
+        !read_cache_file(entry, data)
+     || !take_cache_header(data, offset, BUILD_MAGIC, BUILD_VERSION, 1, content_hash)
+     || !load_module(data, offset, module, true, built)
+    ) {
+        return false;
+    }
+    if (keep_resident) {
+        keep_entry_resident(prefix, entry.path);
+    }
+    auto link_count = reinterpret_cast<const uint32_t*>(take_section(data, offset, sizeof(uint32_t)));
+    if (!link_count || (*link_count != 0 && *link_count != built.size())) {
+        return false;
+    }
+    auto links = reinterpret_cast<const uint32_t*>(take_section(data, offset, sizeof(uint32_t) * *link_count));
+    if (!links) {
+        return false;
+    }
+    for (uint32_t id = 0; id < *link_count; id++) {
+        if (links[id] != NO_NODE && (built[id]->type != AST_IDENTIFIER || (links[id] >= built.size() && links[id] != GLOBAL_LINK))) {
+            return false;
+        }
+    }
+
+    links_out.clear();
+    for (uint32_t id = 0; id < *link_count; id++) {
+        if (links[id] != NO_NODE) {
+            links_out.push_back({ built[id], links[id] == GLOBAL_LINK ? nullptr : built[links[id]] });
+        }
+    }
+    root_out = built[0];
+    linked_out = *link_count != 0;
+    return true;
+}
+
+
+bool save_build_entry(
+    const std::string& dir,
+    const std::string& source,
+    uint64_t content_hash,
+    const string& module,
+    AST* root,
+    bool linked
+) {
+    std::string out;
+    append_cache_header(out, BUILD_MAGIC, BUILD_VERSION, 1, content_hash);
+    append_module(out, module, root);
+
+    vector<AST*> order;
+    flat_order(root, order);
+    vector<uint32_t> links;
+    if (linked) {
+        std::unordered_map<AST*, NodeId> ids;
+        for (NodeId id = 0; id < order.size(); id++) {
+            ids.emplace(order[id], id);
+        }
+        links.resize(order.size(), NO_NODE);
+        for (NodeId id = 0; id < order.size(); id++) {
+            auto ast = order[id];
+            if (ast->type != AST_IDENTIFIER) {
+                continue;
+            }
+            // Links outside the file can only have been found in the global
+            // scope. An identifier left unlinked either found nothing, which
+            // may change, or found the alias it is in, which can't.
+            if (ast->alt) {
+                auto local = ids.find(ast->alt);
+                links[id] = local != ids.end() ? local->second : GLOBAL_LINK;
+            } else if (!ast->get_member(ast->sym)) {
+                links[id] = GLOBAL_LINK;
+            }
+        }
+    }
+    uint32_t link_count = links.size();
+    append_raw(out, &link_count, 1);
+    append_raw(out, links.data(), links.size());
+
+    // The directory may be there already.
+    auto prefix = build_entry_prefix(source);
+    auto path = build_entry_path(dir, prefix, content_hash);
+    if (keep_resident) {
+        keep_entry_resident(prefix, path);
+    }
+    mkdir(dir.c_str(), 0777);
+    if (!write_cache_file(path, out)) {
+        return false;
+    }
+    remove_superseded_entries(dir, prefix, path);
+    return true;
+}
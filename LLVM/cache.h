@@ -0,0 +1,81 @@
+// Scandi: cache.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "ast.h"
+#include "globals.h"
+
+
+#define HASH_SEED           14695981039346656037ULL
+
+
+// FNV-1a, for telling whether sources have changed. Chain calls through seed
+// to hash several pieces.
+uint64_t hash_bytes(std::string_view, uint64_t seed = HASH_SEED);
+
+
+// A precompiled library holds the parsed tree of each library module, so the
+// library needn't be lexed and parsed on every run. It is only valid for the
+// sources it was written from, identified by content_hash, and the names of
+// the modules in order.
+//
+// Loading gives the private root of each wanted module, as parse_to_ast
+// produced it, and nullptr for the rest. It fails if the cache is missing,
+// from another version, or stale.
+bool load_library_cache(
+    const std::string& path,
+    uint64_t content_hash,
+    const vector<string>& modules,
+    const vector<bool>& wanted,
+    vector<AST*>& roots_out
+);
+
+bool save_library_cache(
+    const std::string& path,
+    uint64_t content_hash,
+    const vector<string>& modules,
+    const vector<AST*>& roots
+);
+
+
+// The build cache holds an entry for each program file, named after the hash
+// of its path and of its contents, with its parsed tree and the links semantic analysis made
+// within it. Identifiers that were linked to, or looked for, outside the file
+// are linked again from the global scope, so an entry stays valid when the
+// files around it change.
+//
+// Loading gives the file's private root, whether the entry has links, and the
+// links themselves, to make once the root is merged under global. A link
+// without a declaration is to be looked up from the global scope.
+typedef std::pair<AST*, AST*> BuildLink;
+bool load_build_entry(
+    const std::string& dir,
+    const std::string& source,
+    uint64_t content_hash,
+    const string& module,
+    AST*& root_out,
+    bool& linked_out,
+    vector<BuildLink>& links_out
+);
+
+// Written once root is merged under global and, if linked, analysed. The
+// entry replaces any the source file had before.
+bool save_build_entry(
+    const std::string& dir,
+    const std::string& source,
+    uint64_t content_hash,
+    const string& module,
+    AST* root,
+    bool linked
+);
+
+
+// Keeps every cache file read or written in memory, for the compile server.
+void keep_caches_resident();
@@ -4,165 +4,977 @@
 // Copyright: Neil Bradley
 // License: GPL 3.0
 
+#include <algorithm>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <unordered_map>
 #include "codegen.h"
 #include "globals.h"
+#include "lines.h"
+#include "loops.h"
+#include "runtime.h"
+#include "types.h"
 
 
 /*
- *  Initially, all I will be doing here is printing out the actions the program
- *  should take, as it encounters each AST object.
+ *  Each line's operands are kept on a stack while it is generated, so that
+ *  what reaches runtime is a value per operation, rather than a stack.
+ *  Arithmetic and fields go through runtime.h, as any value may be of any
+ *  type. Declared variables are kept in the slots semantics gave them: locals
+ *  in allocas, and globals in globals of the module, which LLVM can keep in
+ *  registers. Only names found at runtime go to the global table.
+ *
+ *  Where inference has proven what operands are, longs and doubles are
+ *  operated on natively instead. Such variables are then only ever stored
+ *  with a constant tag, so once they are in registers, they are unboxed.
  */
 
 #define OFFSET( level ) string(level < 0 ? 0 : level, ' ')
 
-void gen_scope(SHARED(AST) ast) {
-    DEBUG( OFFSET(ast->depth) << "NEW SCOPE " << ast->name; )
+
+// What codegen keeps of an operand, as lines.h follows its line.
+struct Generated {
+    llvm::Value* value = nullptr;     // A value, or a field's key.
+    llvm::Value* base = nullptr;      // A field's container, as it was read.
+    uint8_t types = TYPE_ANY;         // What a value can be.
+};
+typedef Operand<Generated> Item;
+
+
+// The function being generated, or main.
+struct FunctionState {
+    AST* owner;                       // Null for main.
+    llvm::Function* function;
+    llvm::Value* frame;               // The local context. Main's is the global table.
+    vector<llvm::AllocaInst*> slots;
+    llvm::Value* unnamed;             // How many arguments weren't named.
+    llvm::AllocaInst* result;
+    llvm::BasicBlock* exit;
+    std::unordered_map<AST*, llvm::BasicBlock*> labels;
+    std::unordered_map<Loop*, llvm::BasicBlock*> latches;
+};
+
+
+struct Generator {
+    std::unique_ptr<llvm::LLVMContext> context;
+    std::unique_ptr<llvm::Module> module;
+    std::unique_ptr<llvm::IRBuilder<>> builder;
+    llvm::StructType* value_type;
+    llvm::IntegerType* i64;
+    std::unordered_map<AST*, llvm::Function*> functions;
+    std::unordered_map<string, llvm::Constant*> strings;
+    vector<llvm::GlobalVariable*> globals;  // By slot.
+    FunctionState* current = nullptr;
+};
+
+Generator* gen = nullptr;
+
+
+llvm::TargetMachine* host_machine() {
+    static std::unique_ptr<llvm::TargetMachine> machine;
+    if (!machine) {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        llvm::InitializeNativeTargetAsmParser();
+        auto triple = llvm::sys::getDefaultTargetTriple();
+        string error;
+        auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+        if (!target) {
+            DERR("No code generator for " + triple + ": " + error);
+        }
+        machine.reset(target->createTargetMachine(
+            triple, llvm::sys::getHostCPUName(), "", llvm::TargetOptions(), llvm::Reloc::PIC_
+        ));
+    }
+    return machine.get();
+}
+
+
+/*
+ *  Declarations.
+ */
+
+bool has_raw(AST* ast) {
+    return std::any_of(ast->children.begin(), ast->children.end(), [](AST* c) { return c->type == AST_RAW; });
+}
+
+
+AST* owning_function(AST* ast) {
+    for (auto p = ast->parent; p; p = p->parent) {
+        if (p->type == AST_FUNCTION) {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+
+bool is_global(AST* decl) {
+    return decl->get_property(AST::OPT_STATIC) || !owning_function(decl);
+}
+
+
+bool is_local(AST* decl, AST* owner) {
+    if (!decl || is_global(decl)) {
+        return false;
+    }
+    if (owning_function(decl) != owner) {
+        DERR("Not yet implemented: " + decl->name + " belongs to another function");
+    }
+    return true;
+}
+
+
+// Such as math.min, from the file down.
+string qualified_name(AST* ast) {
+    string name = ast->name;
+    for (auto p = ast->parent; p && p->parent; p = p->parent) {
+        name = p->name + "." + name;
+    }
+    return name;
+}
+
+
+// Embedded code is provided by runtime.h, as scandi_<module>_<name>.
+string runtime_name(AST* ast) {
+    auto module = ast;
+    while (module->parent && module->parent->parent) {
+        module = module->parent;
+    }
+    return "scandi_" + module->name + "_" + ast->name;
+}
+
+
+vector<AST*> parameters(AST* function) {
+    vector<AST*> named;
+    for (auto p = function->next; p; p = p->next) {
+        named.insert(named.begin(), p);
+    }
+    return named;
+}
+
+
+void find_declarations(AST* ast, ASTType type, vector<AST*>& found) {
+    if (ast->type == type) {
+        found.push_back(ast);
+    }
+    for (auto c: ast->children) {
+        find_declarations(c, type, found);
+    }
+    if (ast->type == AST_CONDITIONAL && ast->alt) {
+        find_declarations(ast->alt, type, found);
+    }
+}
+
+
+vector<AST*> declarations_of(AST* ast, ASTType type) {
+    vector<AST*> found;
+    find_declarations(ast, type, found);
+    return found;
+}
+
+
+/*
+ *  Values.
+ */
+
+llvm::Constant* i64_constant(int64_t i) {
+    return llvm::ConstantInt::get(gen->i64, i);
+}
+
+
+llvm::Constant* constant_value(Tag tag, int64_t bits) {
+    return llvm::ConstantStruct::get(gen->value_type, { i64_constant(tag), i64_constant(bits) });
+}
+
+
+llvm::Value* make_value(Tag tag, llvm::Value* bits) {
+    llvm::Value* value = llvm::UndefValue::get(gen->value_type);
+    value = gen->builder->CreateInsertValue(value, i64_constant(tag), 0);
+    return gen->builder->CreateInsertValue(value, bits, 1);
+}
+
+
+// Laid out as runtime.h's String.
+llvm::Constant* string_constant(const string& text) {
+    auto& found = gen->strings[text];
+    if (!found) {
+        auto bytes = llvm::ConstantDataArray::getString(*gen->context, text, true);
+        auto init = llvm::ConstantStruct::getAnon({ i64_constant(text.size()), bytes });
+        auto global = new llvm::GlobalVariable(*gen->module, init->getType(), true, llvm::GlobalValue::PrivateLinkage, init, "str");
+        global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+        global->setAlignment(llvm::Align(8));
+        found = llvm::ConstantStruct::get(
+            gen->value_type, { i64_constant(TAG_STRING), llvm::ConstantExpr::getPtrToInt(global, gen->i64) }
+        );
+    }
+    return found;
+}
+
+
+// Calls a runtime.h function. Values are passed as two 64-bit integers each,
+// which is how the C calling convention passes them.
+llvm::Value* call_runtime(const string& name, llvm::Type* result, std::initializer_list<llvm::Value*> args) {
+    vector<llvm::Type*> types;
+    vector<llvm::Value*> flat;
+    for (auto a: args) {
+        if (a->getType() == gen->value_type) {
+            for (unsigned i = 0; i < 2; i++) {
+                flat.push_back(gen->builder->CreateExtractValue(a, i));
+                types.push_back(gen->i64);
+            }
+        } else {
+            flat.push_back(a);
+            types.push_back(a->getType());
+        }
+    }
+    auto callee = gen->module->getOrInsertFunction(name, llvm::FunctionType::get(result, types, false));
+    if (auto function = llvm::dyn_cast<llvm::Function>(callee.getCallee())) {
+        function->addFnAttr(llvm::Attribute::NoUnwind);
+    }
+    return gen->builder->CreateCall(callee, flat);
+}
+
+
+llvm::Value* operate(int64_t operation, llvm::Value* a, llvm::Value* b) {
+    return call_runtime("scandi_operate", gen->value_type, { i64_constant(operation), a, b });
+}
+
+
+llvm::Value* truth(llvm::Value* value) {
+    return gen->builder->CreateICmpNE(call_runtime("scandi_truth", gen->i64, { value }), i64_constant(0));
+}
+
+
+/*
+ *  Control flow. The block being generated into never has a terminator, so
+ *  code after a jump goes into a block of its own, which nothing reaches.
+ */
+
+llvm::BasicBlock* new_block(const string& name) {
+    return llvm::BasicBlock::Create(*gen->context, name, gen->current->function);
+}
+
+
+void continue_in(llvm::BasicBlock* block) {
+    gen->builder->CreateBr(block);
+    gen->builder->SetInsertPoint(block);
+}
+
+
+void jump_to(llvm::BasicBlock* block) {
+    gen->builder->CreateBr(block);
+    gen->builder->SetInsertPoint(new_block("unreached"));
+}
+
+
+llvm::BasicBlock* label_block(AST* label) {
+    auto& block = gen->current->labels[label];
+    if (!block) {
+        block = new_block(label->name);
+    }
+    return block;
+}
+
+
+// Whether the loop is sure to end: it leaves, each time round, once an
+// induction variable of odd step equals what it is tested against, and both
+// are longs, so as it wraps the variable meets every value.
+bool is_finite(Loop* loop) {
+    for (auto& exit: loop->exits) {
+        if (!exit.test || !exit.when_holds || !exit.each_time || !exit.bound) {
+            continue;
+        }
+        if (operation_of(exit.test->name.substr(0, exit.test->name.find('_'))) != OP_EQ) {
+            continue;
+        }
+        bool longs = true;
+        for (auto c = exit.test->next; c; c = c->next) {
+            longs &= c->type == AST_LONG || c->types == TYPE_LONG;
+        }
+        for (auto& induction: loop->inductions) {
+            if (induction.variable == exit.induction && induction.step % 2 != 0 && longs) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+// Loops that find_loops found are given the form LLVM's loop passes look for:
+// entered from a block of their own, and with every jump back going through
+// one latch, whose branch identifies the loop, and says whether it must end.
+llvm::BasicBlock* latch_block(Loop* loop) {
+    auto& block = gen->current->latches[loop];
+    if (!block) {
+        block = new_block(loop->header->name + ".latch");
+        llvm::IRBuilder<> at_latch(block);
+        auto back = at_latch.CreateBr(label_block(loop->header));
+        vector<llvm::Metadata*> operands = { nullptr };
+        auto finite = is_finite(loop);
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(loop->header->depth) << " LATCH " << loop->header->name << (finite ? " MUST PROGRESS" : ""); )
+        if (finite) {
+            operands.push_back(llvm::MDNode::get(*gen->context, { llvm::MDString::get(*gen->context, "llvm.loop.mustprogress") }));
+        }
+        auto id = llvm::MDNode::getDistinct(*gen->context, operands);
+        id->replaceOperandWith(0, id);
+        back->setMetadata(llvm::LLVMContext::MD_loop, id);
+    }
+    return block;
+}
+
+
+/*
+ *  Operands.
+ */
+
+llvm::Value* global_table() {
+    return call_runtime("scandi_globals", gen->value_type, {});
+}
+
+
+// Where a declared variable is kept.
+llvm::Value* slot(AST* decl) {
+    if (is_local(decl, gen->current->owner)) {
+        return gen->current->slots.at(decl->slot);
+    }
+    auto& global = gen->globals.at(decl->slot);
+    if (!global) {
+        global = new llvm::GlobalVariable(
+            *gen->module, gen->value_type, false, llvm::GlobalValue::InternalLinkage,
+            constant_value(TAG_NULL, 0), qualified_name(decl)
+        );
+    }
+    return global;
+}
+
+
+llvm::Value* load(const Item& operand) {
+    switch (operand.kind) {
+        case Item::VALUE:
+            return operand.value;
+        case Item::VARIABLE:
+            if (!operand.decl) {
+                return call_runtime("scandi_get", gen->value_type, { global_table(), string_constant(operand.name) });
+            }
+            return gen->builder->CreateLoad(gen->value_type, slot(operand.decl));
+        case Item::FIELD:
+            return call_runtime("scandi_get", gen->value_type, { operand.base, operand.value });
+        case Item::RESULT:
+            return gen->builder->CreateLoad(gen->value_type, gen->current->result);
+        case Item::DECLARATION:
+            break;
+    }
+    DERR("Not a value: " + operand.decl->name);
+}
+
+
+// Setting a field of null makes a table, so fields store their container back.
+void store(const Item& target, llvm::Value* value) {
+    switch (target.kind) {
+        case Item::VALUE:
+            if (!target.decl && target.name.empty()) {
+                DERR("Can't assign to a value");
+            }
+            [[fallthrough]];
+        case Item::VARIABLE:
+            if (!target.decl) {
+                call_runtime("scandi_set", gen->value_type, { global_table(), string_constant(target.name), value });
+            } else {
+                gen->builder->CreateStore(value, slot(target.decl));
+            }
+            return;
+        case Item::FIELD: {
+            auto container = call_runtime("scandi_set", gen->value_type, { target.base, target.value, value });
+            if (target.container) {
+                store(*target.container, container);
+            }
+            return;
+        }
+        case Item::RESULT:
+            gen->builder->CreateStore(value, gen->current->result);
+            jump_to(gen->current->exit);
+            return;
+        default:
+            DERR("Can't assign to a value");
+    }
+}
+
+
+Item value_operand(llvm::Value* value, uint8_t types = TYPE_ANY) {
+    Item operand;
+    operand.value = value;
+    operand.types = types ? types : TYPE_ANY;
+    return operand;
+}
+
+
+/*
+ *  Native operations, on operands that inference has proven are longs, or
+ *  numbers, which give what scandi_operate would. Anything else goes to
+ *  runtime.h.
+ */
+
+bool is_number(uint8_t types) {
+    return types == TYPE_LONG || types == TYPE_DOUBLE;
+}
+
+
+llvm::Value* bits_of(llvm::Value* value) {
+    return gen->builder->CreateExtractValue(value, 1);
+}
+
+
+llvm::Value* double_of(llvm::Value* value, uint8_t types) {
+    auto double_type = gen->builder->getDoubleTy();
+    if (types == TYPE_LONG) {
+        return gen->builder->CreateSIToFP(bits_of(value), double_type);
+    }
+    return gen->builder->CreateBitCast(bits_of(value), double_type);
+}
+
+
+llvm::Value* long_value(llvm::Value* bits) {
+    return make_value(TAG_LONG, bits);
+}
+
+
+llvm::Value* double_value(llvm::Value* d) {
+    return make_value(TAG_DOUBLE, gen->builder->CreateBitCast(d, gen->i64));
+}
+
+
+llvm::Value* comparison_value(llvm::Value* holds) {
+    return long_value(gen->builder->CreateZExt(holds, gen->i64));
+}
+
+
+void fail(const string& message) {
+    auto text = gen->builder->CreateGlobalStringPtr(message, "message");
+    auto call = call_runtime("scandi_fail", gen->builder->getVoidTy(), { text });
+    llvm::cast<llvm::CallInst>(call)->setDoesNotReturn();
+    gen->builder->CreateUnreachable();
+}
+
+
+// Dividing by -1 negates, as the smallest long divided by it overflows.
+llvm::Value* divide_longs(int64_t operation, llvm::Value* x, llvm::Value* y) {
+    auto fails = new_block("divide.zero");
+    auto divides = new_block("divide");
+    gen->builder->CreateCondBr(gen->builder->CreateICmpEQ(y, i64_constant(0)), fails, divides);
+    gen->builder->SetInsertPoint(fails);
+    fail("Division by zero");
+    gen->builder->SetInsertPoint(divides);
+    auto negates = gen->builder->CreateICmpEQ(y, i64_constant(-1));
+    auto divisor = gen->builder->CreateSelect(negates, i64_constant(1), y);
+    if (operation == OP_DIVIDE) {
+        return gen->builder->CreateSelect(negates, gen->builder->CreateNeg(x), gen->builder->CreateSDiv(x, divisor));
+    }
+    return gen->builder->CreateSelect(negates, i64_constant(0), gen->builder->CreateSRem(x, divisor));
+}
+
+
+llvm::Value* operate_longs(int64_t operation, llvm::Value* x, llvm::Value* y) {
+    auto b = gen->builder.get();
+    switch (operation) {
+        case OP_ADD:        return long_value(b->CreateAdd(x, y));
+        case OP_SUB:        return long_value(b->CreateSub(x, y));
+        case OP_MULTIPLY:   return long_value(b->CreateMul(x, y));
+        case OP_DIVIDE:
+        case OP_MODULUS:    return long_value(divide_longs(operation, x, y));
+        case OP_AND:        return long_value(b->CreateAnd(x, y));
+        case OP_OR:         return long_value(b->CreateOr(x, y));
+        case OP_XOR:        return long_value(b->CreateXor(x, y));
+        case OP_SHL:        return long_value(b->CreateShl(x, b->CreateAnd(y, i64_constant(63))));
+        case OP_SHR:        return long_value(b->CreateLShr(x, b->CreateAnd(y, i64_constant(63))));
+        case OP_SSHR:       return long_value(b->CreateAShr(x, b->CreateAnd(y, i64_constant(63))));
+        case OP_EQ:         return comparison_value(b->CreateICmpEQ(x, y));
+        case OP_LT:         return comparison_value(b->CreateICmpSLT(x, y));
+        case OP_LTE:        return comparison_value(b->CreateICmpSLE(x, y));
+        case OP_GT:         return comparison_value(b->CreateICmpSGT(x, y));
+        case OP_GTE:        return comparison_value(b->CreateICmpSGE(x, y));
+    }
+    return nullptr;
+}
+
+
+// Numbers that aren't both longs compare as doubles, where NaN compares as
+// equal to anything.
+llvm::Value* operate_doubles(int64_t operation, llvm::Value* x, llvm::Value* y) {
+    auto b = gen->builder.get();
+    switch (operation) {
+        case OP_ADD:        return double_value(b->CreateFAdd(x, y));
+        case OP_SUB:        return double_value(b->CreateFSub(x, y));
+        case OP_MULTIPLY:   return double_value(b->CreateFMul(x, y));
+        case OP_DIVIDE:     return double_value(b->CreateFDiv(x, y));
+        case OP_MODULUS:    return double_value(b->CreateFRem(x, y));
+        case OP_EQ:         return comparison_value(b->CreateFCmpUEQ(x, y));
+        case OP_LT:         return comparison_value(b->CreateFCmpOLT(x, y));
+        case OP_LTE:        return comparison_value(b->CreateFCmpULE(x, y));
+        case OP_GT:         return comparison_value(b->CreateFCmpOGT(x, y));
+        case OP_GTE:        return comparison_value(b->CreateFCmpUGE(x, y));
+    }
+    return nullptr;
+}
+
+
+Item operate(int64_t operation, const Item& a, const Item& b) {
+    auto x = load(a);
+    auto y = load(b);
+    auto types = operation_types(operation, a.types, b.types);
+    llvm::Value* result = nullptr;
+    if (a.types == TYPE_LONG && b.types == TYPE_LONG) {
+        result = operate_longs(operation, bits_of(x), bits_of(y));
+    } else if (is_number(a.types) && is_number(b.types)) {
+        result = operate_doubles(operation, double_of(x, a.types), double_of(y, b.types));
+    }
+    return value_operand(result ? result : operate(operation, x, y), types);
+}
+
+
+llvm::Value* truth(const Item& operand) {
+    auto value = load(operand);
+    switch (operand.types) {
+        case TYPE_NULL:     return gen->builder->getFalse();
+        case TYPE_LONG:     return gen->builder->CreateICmpNE(bits_of(value), i64_constant(0));
+        case TYPE_DOUBLE:   return gen->builder->CreateFCmpUNE(double_of(value, TYPE_DOUBLE), llvm::ConstantFP::get(gen->builder->getDoubleTy(), 0));
+    }
+    if (!(operand.types & (TYPE_NULL | TYPE_LONG | TYPE_DOUBLE))) {
+        return gen->builder->getTrue();
+    }
+    return truth(value);
+}
+
+
+// A string's length is before its text.
+Item count(const Item& operand) {
+    auto value = load(operand);
+    if (operand.types == TYPE_STRING) {
+        auto length = gen->builder->CreateIntToPtr(bits_of(value), gen->i64->getPointerTo());
+        return value_operand(long_value(gen->builder->CreateLoad(gen->i64, length)), TYPE_LONG);
+    }
+    return value_operand(call_runtime("scandi_count", gen->value_type, { value }), TYPE_LONG);
+}
+
+
+/*
+ *  Lines.
+ */
+
+// An alias of a declaration, such as {stream.writeline writeline}, is that
+// declaration. Anything else is generated where it is used.
+AST* resolve_alias(AST* alias) {
+    auto item = alias->next;
+    if (!item || item->type != AST_IDENTIFIER || !item->alt) {
+        return nullptr;
+    }
+    auto decl = item->alt;
+    if (decl->type == AST_ALIAS) {
+        decl = resolve_alias(decl);
+    }
+    for (item = item->next; decl && item; item = item->next->next) {
+        if (item->type != AST_OPERATOR || item->name != CHAR_STR(LEX_DOT) || !item->next || !decl->has_member(item->next->sym)) {
+            return nullptr;
+        }
+        decl = decl->get_member(item->next->sym);
+    }
+    return decl;
+}
+
+
+int64_t operation_of(const string& op) {
+    static const std::unordered_map<string, int64_t> operations = {
+        { CHAR_STR(LEX_ADD),        OP_ADD },
+        { CHAR_STR(LEX_SUB),        OP_SUB },
+        { CHAR_STR(LEX_MULTIPLY),   OP_MULTIPLY },
+        { CHAR_STR(LEX_DIVIDE),     OP_DIVIDE },
+        { CHAR_STR(LEX_MODULUS),    OP_MODULUS },
+        { CHAR_STR(LEX_AND),        OP_AND },
+        { CHAR_STR(LEX_OR),         OP_OR },
+        { CHAR_STR(LEX_XOR),        OP_XOR },
+        { LEX_SHL,                  OP_SHL },
+        { LEX_SHR,                  OP_SHR },
+        { LEX_SSHR,                 OP_SSHR },
+        { CHAR_STR(LEX_EQ),         OP_EQ },
+        { CHAR_STR(LEX_LT),         OP_LT },
+        { LEX_LTE,                  OP_LTE },
+        { CHAR_STR(LEX_GT),         OP_GT },
+        { LEX_GTE,                  OP_GTE }
+    };
+    auto found = operations.find(op);
+    return found == operations.end() ? -1 : found->second;
+}
+
+
+// What each operation does, for tracing.
+const char* operation_action(int64_t operation) {
+    switch (operation) {
+        case OP_ADD:        return "  POP POP ADD PUSH";
+        case OP_SUB:        return "  POP1 POP2 POP2-POP1 PUSH";
+        case OP_MULTIPLY:   return "  POP POP MULTIPLY PUSH";
+        case OP_DIVIDE:     return "  POP1 POP2 POP2/POP1 PUSH";
+        case OP_MODULUS:    return "  POP1 POP2 POP2%POP1 PUSH";
+        case OP_AND:        return "  POP POP AND PUSH";
+        case OP_OR:         return "  POP POP OR PUSH";
+        case OP_XOR:        return "  POP POP XOR PUSH";
+        case OP_SHL:        return "  POP1 POP2 POP2<-POP1 PUSH";
+        case OP_SHR:        return "  POP1 POP2 POP2->POP1 PUSH";
+        case OP_SSHR:       return "  POP1 POP2 POP2>>POP1 PUSH";
+        case OP_EQ:         return "  POP POP COMPARE_EQUAL PUSH";
+        case OP_LT:         return "  POP POP COMPARE_LESS_THAN PUSH";
+        case OP_LTE:        return "  POP POP COMPARE_LESS_THAN_EQUAL PUSH";
+        case OP_GT:         return "  POP POP COMPARE_GREATER_THAN PUSH";
+        case OP_GTE:        return "  POP POP COMPARE_GREATER_THAN_EQUAL PUSH";
+        case OP_COMPLEMENT: return "  POP COMPLEMENT PUSH";
+    }
+    return "";
+}
+
+
+bool ends_in_assignment(AST* first) {
+    auto last = first;
+    while (last->next) {
+        last = last->next;
+    }
+    return last->type == AST_OPERATOR && last->name == CHAR_STR(LEX_ASSIGNMENT);
+}
+
+
+// Calls take as many operands as they have named parameters, or all of them
+// for varargs, except the kept operands at the bottom of the stack.
+size_t arguments_taken(AST* function, size_t operands, size_t kept) {
+    auto available = operands > kept ? operands - kept : 0;
+    if (function->get_property(AST::OPT_HAS_VARARGS)) {
+        return available;
+    }
+    size_t named = 0;
+    for (auto p = function->next; p; p = p->next) {
+        named++;
+    }
+    return std::min(named, available);
+}
+
+
+// Generates each item as lines.h follows the line, and traces it.
+struct LineGenerator : LinePass {
+    typedef ::Item Item;
+
+    LineGenerator() {
+        owner = gen->current->owner;
+    }
+
+    void begin_chain(AST* first) {
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(first->depth) << " INIT EXPRESSION STACK"; )
+    }
+
+    void end_chain(AST* first) {
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(first->depth) << " PUSH EXPRESSION STACK IF PARENT STACK"; )
+    }
+
+    void identifier(AST* identifier) {
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(identifier->depth) << "  PUSH " << identifier->name << " ONTO EXPRESSION STACK"; );
+    }
+
+    void dot(AST* dot) {
+        auto member = dot->next;
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(dot->depth) << "  <<DOT SEEN>>"; )
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(member->depth) << "  PUSH " << member->name << " ONTO EXPRESSION STACK"; );
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(member->depth) << "  POP POP APPLY_DOT_OPERATOR PUSH"; )
+    }
+
+    // What a variable can hold is on the identifier that read it.
+    void read(Item& operand) {
+        auto types = operand.kind == Item::VARIABLE && operand.read ? operand.read->types : TYPE_ANY;
+        operand.value = load(operand);
+        operand.base = nullptr;
+        operand.types = types ? types : TYPE_ANY;
+    }
+
+    void constant(AST* ast, Item& constant) {
+        switch (ast->type) {
+            case AST_BINARY:
+            case AST_STRING:
+                TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(ast->depth) << "  PUSH \"" << ast->name << "\" ONTO EXPRESSION STACK"; )
+                constant = value_operand(string_constant(ast->name), TYPE_STRING);
+                return;
+            case AST_LONG:
+                TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(ast->depth) << "  PUSH " << ast->numeric_value.l << " ONTO EXPRESSION STACK"; )
+                constant = value_operand(constant_value(TAG_LONG, ast->numeric_value.l), TYPE_LONG);
+                return;
+            case AST_DOUBLE: {
+                TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(ast->depth) << "  PUSH " << ast->numeric_value.d << " ONTO EXPRESSION STACK"; )
+                int64_t bits;
+                std::memcpy(&bits, &ast->numeric_value.d, sizeof(bits));
+                constant = value_operand(constant_value(TAG_DOUBLE, bits), TYPE_DOUBLE);
+                return;
+            }
+            default:
+                TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(ast->depth) << "  PUSH NULL ONTO EXPRESSION STACK"; )
+                constant = value_operand(constant_value(TAG_NULL, 0), TYPE_NULL);
+                return;
+        }
+    }
+
+    void field(Item& container, bool is_target, Item& field) {
+        field.base = load(container);
+    }
+
+    void context_field(Item& field) {
+        field.base = gen->current->frame;
+    }
+
+    void name_key(AST* member, Item& field) {
+        field.value = string_constant(member->name);
+    }
+
+    void key(AST* reference, vector<Item>& key, Item& field) {
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(reference->depth) << "  POP POP APPLY_REFERENCE PUSH"; )
+        field.value = key.empty() ? constant_value(TAG_NULL, 0) : key.back().value;
+    }
+
+    void call(AST* function, vector<Item>& args, Item& result) {
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(function->depth) << "  CALL " << function->name << " WITH " << args.size() << " ARGUMENTS"; )
+        llvm::Value* array = llvm::ConstantPointerNull::get(gen->value_type->getPointerTo());
+        if (!args.empty()) {
+            auto& entry = gen->current->function->getEntryBlock();
+            llvm::IRBuilder<> at_entry(&entry, entry.begin());
+            auto type = llvm::ArrayType::get(gen->value_type, args.size());
+            auto slots = at_entry.CreateAlloca(type);
+            for (size_t i = 0; i < args.size(); i++) {
+                gen->builder->CreateStore(args[i].value, gen->builder->CreateConstInBoundsGEP2_64(type, slots, 0, i));
+            }
+            array = gen->builder->CreateConstInBoundsGEP2_64(type, slots, 0, 0);
+        }
+        auto called = gen->builder->CreateCall(gen->functions.at(function), { array, i64_constant(args.size()) });
+        result = value_operand(called, function->types);
+    }
+
+    void jump(AST* label, AST* read) {
+        if (read && read->loop) {
+            TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(read->depth) << "  JUMP BACK TO " << read->loop->header->name; )
+            jump_to(latch_block(read->loop));
+        } else {
+            TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(label->depth) << "  JUMP TO " << label->name; )
+            jump_to(label_block(label));
+        }
+    }
+
+    void assign(AST* op, Item& target, Item& value) {
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(op->depth) << "  POP VALUE INTO NEXT POP"; )
+        store(target, value.value);
+    }
+
+    void operate(AST* op, int64_t operation, Item& a, Item& b, Item& result) {
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(op->depth) << operation_action(operation); )
+        result = ::operate(operation, a, b);
+    }
+
+    void complement(AST* op, Item& a, Item& result) {
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(op->depth) << operation_action(OP_COMPLEMENT); )
+        if (a.types == TYPE_LONG) {
+            result = value_operand(long_value(gen->builder->CreateNot(bits_of(a.value))), TYPE_LONG);
+        } else {
+            result = value_operand(::operate(OP_COMPLEMENT, a.value, constant_value(TAG_NULL, 0)), TYPE_LONG);
+        }
+    }
+
+    void count(AST* op, Item* a, Item& result) {
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, OFFSET(op->depth) << "  POP COUNT PUSH"; )
+        result = a ? ::count(*a) : value_operand(make_value(TAG_LONG, gen->current->unnamed));
+    }
+};
+
+
+/*
+ *  Structure.
+ */
+
+void gen_scope(AST* ast) {
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "NEW SCOPE " << ast->name; )
     // Add all the members recursively.
     for (auto c: ast->children) {
         generate_code(c);
     }
-    DEBUG( OFFSET(ast->depth) << "EXIT SCOPE " << ast->name << endl; )
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "EXIT SCOPE " << ast->name << endl; )
 }
 
 
-void gen_raw(SHARED(AST) ast) {
-    DEBUG( OFFSET(ast->depth) << "<<< INJECT RAW LLVM IR >>>"; )
+// Embedded code comes from the runtime, when the program starts for a
+// variable, or in place of a whole function.
+void gen_raw(AST* ast) {
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "<<< INJECT RAW LLVM IR >>>"; )
 }
 
 
-void gen_label(SHARED(AST) ast) {
-    DEBUG( OFFSET(ast->depth) << "ADD LABEL " << ast->name; )
+void gen_label(AST* ast) {
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "ADD LABEL " << ast->name; )
+    if (ast->loop) {
+        TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "LOOP " << ast->name; )
+        continue_in(new_block(ast->name + ".preheader"));
+    }
+    continue_in(label_block(ast));
     for (auto c: ast->children) {
         generate_code(c);
     }
 }
 
 
-void gen_variable(SHARED(AST) ast) {
+void gen_variable(AST* ast) {
     bool is_class = !ast->children.empty();
-    DEBUG( OFFSET(ast->depth) << "ADD " << (ast->get_property(AST::OPT_STATIC) ? "STATIC " : "") << (is_class ? "CLASS " : "VARIABLE ") << ast->name; )
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "ADD " << (ast->get_property(AST::OPT_STATIC) ? "STATIC " : "") << (is_class ? "CLASS " : "VARIABLE ") << ast->name; )
     if (is_class) {
         for (auto c: ast->children) {
             generate_code(c);
         }
-        DEBUG( OFFSET(ast->depth) << "END CLASS " << ast->name << endl; )
-    }
-}
-
-
-void gen_operator(SHARED(AST) op) {
-    string action = "TODO: OP " + op->name;
-    if        (op->name == CHAR_STR(LEX_ASSIGNMENT)){ action = "  POP VALUE INTO NEXT POP (TODO: differentiate between var and function)";
-    } else if (op->name == CHAR_STR(LEX_ADD))       { action = "  POP POP ADD PUSH";
-    } else if (op->name == CHAR_STR(LEX_SUB))       { action = "  POP1 POP2 POP2-POP1 PUSH";
-    } else if (op->name == CHAR_STR(LEX_MULTIPLY))  { action = "  POP POP MULTIPLY PUSH";
-    } else if (op->name == CHAR_STR(LEX_DIVIDE))    { action = "  POP1 POP2 POP2/POP1 PUSH";
-    } else if (op->name == CHAR_STR(LEX_MODULUS))   { action = "  POP1 POP2 POP2%POP1 PUSH";
-    } else if (op->name == CHAR_STR(LEX_AND))       { action = "  POP POP AND PUSH";
-    } else if (op->name == CHAR_STR(LEX_OR))        { action = "  POP POP OR PUSH";
-    } else if (op->name == CHAR_STR(LEX_XOR))       { action = "  POP POP XOR PUSH";
-    } else if (op->name == CHAR_STR(LEX_COUNT))     { action = "  POP COUNT PUSH";
-    } else if (op->name == CHAR_STR(LEX_EQ))        { action = "  POP POP COMPARE_EQUAL PUSH";
-    } else if (op->name == CHAR_STR(LEX_LT))        { action = "  POP POP COMPARE_LESS_THAN PUSH";
-    } else if (op->name == LEX_LTE)                 { action = "  POP POP COMPARE_LESS_THAN_EQUAL PUSH";
-    } else if (op->name == CHAR_STR(LEX_GT))        { action = "  POP POP COMPARE_GREATER_THAN PUSH";
-    } else if (op->name == LEX_GTE)                 { action = "  POP POP COMPARE_GREATER_THAN_EQUAL PUSH";
-    } else if (op->name == CHAR_STR(LEX_DOT))       { action = "  <<DOT SEEN>>";
-    } else {
-        DERR("Not yet implemented: " + action);
+        TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "END CLASS " << ast->name << endl; )
     }
-    DEBUG( OFFSET(op->depth) << action; )
 }
 
 
-void gen_expression(SHARED(AST) ast) {
-    auto current = ast;
-    // Skip place-holder.
-    if (current->type == AST_EXPRESSION) {
-        current = current->next;
-    }
-    DEBUG( OFFSET(current->depth) << " INIT EXPRESSION STACK"; )
-    bool hasDotPrior = false;
-    while (current) {
-        // Check for consecutive DOT operators.
-        bool hasNewDotPrior = (current->type == AST_OPERATOR && current->name == ".");
-        if (hasDotPrior && hasNewDotPrior) {
-            DERR("Consecutive DOT operators detected. DOT operators must be followed by an identifier.");
-        }
-
-        switch (current->type) {
-            case AST_EXPRESSION:    gen_expression(current->alt);                                       break;
-            case AST_IDENTIFIER:    DEBUG( OFFSET(current->depth) << "  PUSH " << current->name << " ONTO EXPRESSION STACK"; );
-                                    if (hasDotPrior) {
-                                        DEBUG( OFFSET(current->depth) << "  POP POP APPLY_DOT_OPERATOR PUSH"; )
-                                        hasDotPrior = false;
-                                    }
-                                    break;
-            case AST_BINARY:
-            case AST_STRING:        DEBUG( OFFSET(current->depth) << "  PUSH \"" << current->name << "\" ONTO EXPRESSION STACK"; )     break;
-            case AST_LONG:          DEBUG( OFFSET(current->depth) << "  PUSH " << current->numeric_value.l << " ONTO EXPRESSION STACK"; )     break;
-            case AST_DOUBLE:        DEBUG( OFFSET(current->depth) << "  PUSH " << current->numeric_value.d << " ONTO EXPRESSION STACK"; )     break;
-            case AST_NULL:          DEBUG( OFFSET(current->depth) << "  PUSH NULL ONTO EXPRESSION STACK"; )     break;
-            case AST_REFERENCE:     gen_expression(current->alt);
-                                    DEBUG( OFFSET(current->depth) << "  POP POP APPLY_REFERENCE PUSH"; )
-                                    break;
-            case AST_OPERATOR:      gen_operator(current); break;
-            default:
-                DERR("Unknown EXPRESSION. This is probably a bug.");
-        }
-        hasDotPrior = hasNewDotPrior;
-        current = current->next;
+void gen_expression(AST* ast) {
+    LineGenerator pass;
+    follow_line(ast, pass);
+    // The stack is cleared at the end of each line.
+    for (auto c: ast->children) {
+        generate_code(c);
     }
-    DEBUG( OFFSET(ast->depth) << " PUSH EXPRESSION STACK IF PARENT STACK"; )
 }
 
 
-void gen_function(SHARED(AST) ast) {
-    DEBUG( OFFSET(ast->depth) << "ADD " << (ast->get_property(AST::OPT_STATIC) ? "STATIC " : "") << "FUNCTION " << ast->name; )
+// Arguments come as an array, with those not named first, so that any call
+// can be made the same way.
+void gen_function(AST* ast) {
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "ADD " << (ast->get_property(AST::OPT_STATIC) ? "STATIC " : "") << "FUNCTION " << ast->name; )
     // Parameters
     auto next = ast->next;
     while (next) {
-        DEBUG( OFFSET(ast->depth) << "ADD PARAMETER " << next->name; )
+        TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "ADD PARAMETER " << next->name; )
         next = next->next;
     }
     if (ast->get_property(AST::OPT_HAS_VARARGS)) {
-        DEBUG( OFFSET(ast->depth) << "ADD VARARGS"; )
+        TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "ADD VARARGS"; )
     }
+    if (has_raw(ast)) {
+        TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "PROVIDED BY THE RUNTIME AS " << runtime_name(ast); )
+        TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "END FUNCTION " << ast->name << endl; )
+        return;
+    }
+
+    auto saved = gen->builder->saveIP();
+    auto caller = gen->current;
+    FunctionState state { ast, gen->functions.at(ast) };
+    gen->current = &state;
+    gen->builder->SetInsertPoint(new_block("entry"));
+
+    auto args = state.function->getArg(0);
+    auto count = state.function->getArg(1);
+    auto named = parameters(ast);
+    auto named_count = i64_constant(named.size());
+    state.frame = call_runtime("scandi_arguments", gen->value_type, { args, count, named_count });
+    state.unnamed = gen->builder->CreateSelect(
+        gen->builder->CreateICmpSGT(count, named_count), gen->builder->CreateSub(count, named_count), i64_constant(0)
+    );
+    state.result = gen->builder->CreateAlloca(gen->value_type);
+    gen->builder->CreateStore(constant_value(TAG_NULL, 0), state.result);
+    state.exit = llvm::BasicBlock::Create(*gen->context, "exit", state.function);
+    for (int i = 0; i < ast->slot; i++) {
+        state.slots.push_back(gen->builder->CreateAlloca(gen->value_type));
+        gen->builder->CreateStore(constant_value(TAG_NULL, 0), state.slots.back());
+    }
+    // As scandi_argument gives them, so that they are known where the
+    // function is inlined.
+    for (size_t i = 0; i < named.size(); i++) {
+        auto index = gen->builder->CreateAdd(gen->builder->CreateSub(count, named_count), i64_constant(i));
+        auto before = gen->builder->GetInsertBlock();
+        auto passed = new_block("passed");
+        auto after = new_block("parameter");
+        gen->builder->CreateCondBr(gen->builder->CreateICmpSGE(index, i64_constant(0)), passed, after);
+        gen->builder->SetInsertPoint(passed);
+        auto arg = gen->builder->CreateLoad(gen->value_type, gen->builder->CreateGEP(gen->value_type, args, index));
+        continue_in(after);
+        auto parameter = gen->builder->CreatePHI(gen->value_type, 2);
+        parameter->addIncoming(constant_value(TAG_NULL, 0), before);
+        parameter->addIncoming(arg, passed);
+        gen->builder->CreateStore(parameter, state.slots.at(named[i]->slot));
+    }
+
     for (auto c: ast->children) {
         generate_code(c);
     }
-    DEBUG( OFFSET(ast->depth) << "END FUNCTION " << ast->name << endl; )
+    continue_in(state.exit);
+    gen->builder->CreateRet(gen->builder->CreateLoad(gen->value_type, state.result));
+
+    // The local context is only made for functions that use it.
+    auto frame = llvm::cast<llvm::Instruction>(state.frame);
+    if (frame->use_empty()) {
+        frame->eraseFromParent();
+    }
+
+    gen->current = caller;
+    gen->builder->restoreIP(saved);
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "END FUNCTION " << ast->name << endl; )
 }
 
 
-void gen_alias(SHARED(AST) ast) {
-    DEBUG( OFFSET(ast->depth) << "ADD INLINE FUNCTION " << ast->name; )
-    generate_code(ast->next);
-    DEBUG( OFFSET(ast->depth) << "END INLINE FUNCTION " << ast->name; )
+// Aliases are resolved where they are used.
+void gen_alias(AST* ast) {
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "ADD INLINE FUNCTION " << ast->name; )
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "END INLINE FUNCTION " << ast->name; )
 }
 
 
-void gen_conditional(SHARED(AST) ast) {
-    DEBUG( OFFSET(ast->depth) << "ADD CONDITIONAL " << ast->name; )
-    DEBUG( OFFSET(ast->depth) << "IF..."; )
-    generate_code(ast->next);
-    DEBUG( OFFSET(ast->depth) << "THEN..."; )
+// A conditional compares the last two operands of its line, or tests the
+// last, if there is only one.
+void gen_conditional(AST* ast) {
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "ADD CONDITIONAL " << ast->name; )
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "IF..."; )
+    LineGenerator pass;
+    vector<Item> stack;
+    follow_chain(ast->next, stack, 0, pass);
+    llvm::Value* condition;
+    if (stack.size() >= 2) {
+        auto taken = take(stack, 2, pass);
+        condition = truth(operate(operation_of(ast->name.substr(0, ast->name.find('_'))), taken[0], taken[1]));
+    } else if (stack.size() == 1) {
+        condition = truth(take(stack, 1, pass)[0]);
+    } else {
+        condition = gen->builder->getFalse();
+    }
+    auto when_true = new_block("then");
+    auto when_false = ast->alt ? new_block("else") : nullptr;
+    auto after = new_block("endif");
+    gen->builder->CreateCondBr(condition, when_true, when_false ? when_false : after);
+
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "THEN..."; )
+    gen->builder->SetInsertPoint(when_true);
     for (auto c: ast->children) {
-        generate_code(ast->next);
+        generate_code(c);
     }
+    continue_in(after);
     if (ast->alt) {
-        DEBUG( OFFSET(ast->depth) << "ELSE..."; )
+        TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "ELSE..."; )
+        gen->builder->SetInsertPoint(when_false);
         // Skip the auto-label
         for (auto e: ast->alt->children) {
             generate_code(e);
         }
-        //generate_code(ast->alt);
+        continue_in(after);
     }
-    DEBUG( OFFSET(ast->depth) << "END CONDITIONAL " << ast->name; )
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, OFFSET(ast->depth) << "END CONDITIONAL " << ast->name; )
 }
 
 
-void generate_code(SHARED(AST) ast) {
+void generate_code(AST* ast) {
     // The action we take here depend on what type of AST we are dealing with.
     switch (ast->type) {
         case AST_SCOPE:         gen_scope(ast);        break;
@@ -190,3 +1002,115 @@ void generate_code(SHARED(AST) ast) {
         default: DERR("Unknown AST. This is probably a bug.");
     }
 }
+
+
+/*
+ *  The program.
+ */
+
+// Declared up front, so calls can come before definitions.
+void declare_functions(AST* global) {
+    auto type = llvm::FunctionType::get(gen->value_type, { gen->value_type->getPointerTo(), gen->i64 }, false);
+    for (auto f: declarations_of(global, AST_FUNCTION)) {
+        if (has_raw(f)) {
+            auto callee = gen->module->getOrInsertFunction(runtime_name(f), type);
+            gen->functions[f] = llvm::cast<llvm::Function>(callee.getCallee());
+        } else {
+            gen->functions[f] = llvm::Function::Create(type, llvm::GlobalValue::InternalLinkage, qualified_name(f), *gen->module);
+        }
+    }
+}
+
+
+void initialise_variables(AST* global) {
+    for (auto v: declarations_of(global, AST_VARIABLE)) {
+        if (has_raw(v) && is_global(v)) {
+            gen->builder->CreateStore(call_runtime(runtime_name(v), gen->value_type, {}), slot(v));
+        }
+    }
+}
+
+
+Program generate_program(AST* global) {
+    Generator generator;
+    gen = &generator;
+    generator.context = std::make_unique<llvm::LLVMContext>();
+    generator.module = std::make_unique<llvm::Module>("scandi", *generator.context);
+    generator.module->setTargetTriple(host_machine()->getTargetTriple().str());
+    generator.module->setDataLayout(host_machine()->createDataLayout());
+    generator.builder = std::make_unique<llvm::IRBuilder<>>(*generator.context);
+    generator.i64 = llvm::Type::getInt64Ty(*generator.context);
+    generator.value_type = llvm::StructType::get(*generator.context, { generator.i64, generator.i64 });
+
+    generator.globals.resize(global->slot);
+
+    try {
+        declare_functions(global);
+
+        auto main_type = llvm::FunctionType::get(llvm::Type::getInt32Ty(*generator.context), false);
+        FunctionState state { nullptr, llvm::Function::Create(main_type, llvm::GlobalValue::ExternalLinkage, "main", *generator.module) };
+        generator.current = &state;
+        generator.builder->SetInsertPoint(new_block("entry"));
+        state.frame = call_runtime("scandi_globals", generator.value_type, {});
+        state.unnamed = i64_constant(0);
+        state.exit = new_block("exit");
+
+        initialise_variables(global);
+        generate_code(global);
+        continue_in(state.exit);
+        generator.builder->CreateRet(generator.builder->getInt32(0));
+    } catch (...) {
+        gen = nullptr;
+        throw;
+    }
+    gen = nullptr;
+
+    if (llvm::verifyModule(*generator.module, &llvm::errs())) {
+        DERR("Generated code is broken. This is probably a bug.");
+    }
+    return { std::move(generator.context), std::move(generator.module) };
+}
+
+
+void optimise_program(Program& program) {
+    optimise_module(*program.module);
+}
+
+
+void optimise_module(llvm::Module& module) {
+    llvm::LoopAnalysisManager loops;
+    llvm::FunctionAnalysisManager functions;
+    llvm::CGSCCAnalysisManager sccs;
+    llvm::ModuleAnalysisManager modules;
+    llvm::PassBuilder passes(host_machine());
+    passes.registerModuleAnalyses(modules);
+    passes.registerCGSCCAnalyses(sccs);
+    passes.registerFunctionAnalyses(functions);
+    passes.registerLoopAnalyses(loops);
+    passes.crossRegisterProxies(loops, functions, sccs, modules);
+    passes.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2).run(module, modules);
+}
+
+
+bool write_program(Program& program, const std::string& path, OutputKind kind) {
+    std::error_code error;
+    llvm::raw_fd_ostream out(path, error, llvm::sys::fs::OF_None);
+    if (error) {
+        return false;
+    }
+    if (kind == OUTPUT_IR) {
+        program.module->print(out, nullptr);
+    } else {
+        llvm::legacy::PassManager passes;
+        if (host_machine()->addPassesToEmitFile(passes, out, nullptr, llvm::CGFT_ObjectFile)) {
+            return false;
+        }
+        passes.run(*program.module);
+    }
+    out.flush();
+    if (out.has_error()) {
+        out.clear_error();
+        return false;
+    }
+    return true;
+}
@@ -5,8 +5,56 @@
 // License: GPL 3.0
 
 #pragma once
+#include <memory>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
 #include "ast.h"
 #include "globals.h"
 
 
-void generate_code(SHARED(AST));
+// A generated program. The module belongs to its context, so they are kept
+// together.
+struct Program {
+    std::unique_ptr<llvm::LLVMContext> context;
+    std::unique_ptr<llvm::Module> module;
+};
+
+
+enum OutputKind {
+    OUTPUT_OBJECT,
+    OUTPUT_IR
+};
+
+
+// Generates LLVM IR for the analysed tree under global. Functions become
+// functions, and each file's top level code runs from main, in file order.
+// Operands are kept on a stack while each line is generated, so the stack
+// itself costs nothing at runtime. Values are those of runtime.h.
+Program generate_program(AST* global);
+
+// Dispatches on node type. Only called within generate_program.
+void generate_code(AST*);
+
+// Runs the standard O2 pipeline over the program, or over part of one.
+void optimise_program(Program&);
+void optimise_module(llvm::Module&);
+
+// Writes the program as an object file for the host, or as IR text.
+bool write_program(Program&, const std::string& path, OutputKind);
+
+
+// How declarations map onto a program, for each backend.
+bool has_raw(AST*);                   // Provided by runtime.h, as embedded code.
+AST* owning_function(AST*);           // Null outside functions.
+bool is_global(AST* decl);            // Static, or outside functions.
+bool is_local(AST* decl, AST* owner); // In owner's frame. Fails for another function's.
+string qualified_name(AST*);          // Such as math.min. Globals are kept by this.
+string runtime_name(AST*);            // What runtime.h calls embedded code.
+vector<AST*> parameters(AST* function);  // Left to right.
+AST* resolve_alias(AST*);             // What the alias names, or null if it is code.
+vector<AST*> declarations_of(AST*, ASTType);  // In program order, with those in conditionals' alternatives.
+
+// And lines.
+int64_t operation_of(const string& op);  // runtime.h's Operation, or -1.
+bool ends_in_assignment(AST* first);  // Whether the first operand is a target.
+size_t arguments_taken(AST* function, size_t operands, size_t kept);  // Of the operands on the stack.
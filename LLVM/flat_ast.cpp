@@ -0,0 +1,201 @@
+// Scandi: flat_ast.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include "flat_ast.h"
+#include "globals.h"
+
+
+#define MEMBER_KEY( scope, name )   ((static_cast<uint64_t>(scope) << 32) | (name))
+
+
+FlatAST::FlatAST(AST* root) {
+    vector<PathEntry> path;
+    add(root, path);
+    first_child.push_back(child_list.size());
+
+    // Children are indexed before parameters, so that they hide them.
+    members.reserve(child_list.size());
+    for (NodeId id = 0; id < size(); id++) {
+        for (auto c = first_child[id]; c < first_child[id + 1]; c++) {
+            add_member(id, name[child_list[c]], child_list[c]);
+        }
+        if (type[id] == AST_FUNCTION) {
+            for (auto n = next[id]; n != NO_NODE; n = next[n]) {
+                if (type[n] == AST_VARIABLE) {
+                    add_member(id, name[n], n);
+                }
+            }
+        }
+    }
+}
+
+
+NodeId FlatAST::add(AST* ast, vector<PathEntry>& path) {
+    NodeId id = size();
+    type.push_back(ast->type);
+    name.push_back(ast->sym);
+    depth.push_back(ast->depth);
+    properties.push_back(ast->properties);
+    numeric_value.push_back(ast->numeric_value);
+    parent.push_back(find_parent(ast, path));
+    next.push_back(NO_NODE);
+    alt.push_back(NO_NODE);
+
+    // Child slots are taken in node order, so a node's children end where the
+    // following node's begin.
+    auto first = child_list.size();
+    first_child.push_back(first);
+    child_list.resize(first + ast->children.size());
+
+    path.push_back({ ast, id });
+    if (ast->next) {
+        auto n = add(ast->next, path);
+        next[id] = n;
+    }
+    if (ast->alt && ast->type != AST_IDENTIFIER) {
+        auto a = add(ast->alt, path);
+        alt[id] = a;
+    }
+    for (size_t c = 0; c < ast->children.size(); c++) {
+        auto child = add(ast->children[c], path);
+        child_list[first + c] = child;
+    }
+    path.pop_back();
+    return id;
+}
+
+
+// A node's parent is always one of the nodes it was reached through. Items in
+// an expression share a parent, so the search almost always stops at the node
+// just before.
+NodeId FlatAST::find_parent(AST* ast, const vector<PathEntry>& path) const {
+    for (auto p = path.rbegin(); p != path.rend(); p++) {
+        if (p->ast == ast->parent) {
+            return p->id;
+        } else if (p->ast->parent == ast->parent) {
+            return parent[p->id];
+        }
+    }
+    return NO_NODE;
+}
+
+
+void FlatAST::add_member(NodeId scope, Symbol member, NodeId decl) {
+    members.emplace(MEMBER_KEY(scope, member), decl);
+}
+
+
+// Only nodes with children, and functions, declare anything, so other nodes
+// needn't be looked up.
+bool FlatAST::declares(NodeId id) const {
+    return first_child[id] != first_child[id + 1] || type[id] == AST_FUNCTION;
+}
+
+
+bool FlatAST::has_member(NodeId id, Symbol member) const {
+    return declares(id) && members.count(MEMBER_KEY(id, member)) != 0;
+}
+
+
+bool FlatAST::can_see(NodeId id, Symbol member) const {
+    for (;;) {
+        if (has_member(id, member)) {
+            return true;
+        } else if (parent[id] == NO_NODE) {
+            // Only really applies at the global scope.
+            return name[id] == member;
+        }
+        id = parent[id];
+    }
+}
+
+
+NodeId FlatAST::get_member(NodeId id, Symbol member) const {
+    for (; id != NO_NODE; id = parent[id]) {
+        if (!declares(id)) {
+            continue;
+        }
+        auto found = members.find(MEMBER_KEY(id, member));
+        if (found != members.end()) {
+            return found->second;
+        }
+    }
+    return NO_NODE;
+}
+
+
+// Lists the tree in node order.
+void node_order(AST* ast, vector<AST*>& nodes) {
+    nodes.push_back(ast);
+    if (ast->next) {
+        node_order(ast->next, nodes);
+    }
+    if (ast->alt && ast->type != AST_IDENTIFIER) {
+        node_order(ast->alt, nodes);
+    }
+    for (auto c: ast->children) {
+        node_order(c, nodes);
+    }
+}
+
+
+void FlatAST::link_tree(AST* root) const {
+    vector<AST*> nodes;
+    node_order(root, nodes);
+    for (NodeId id = 0; id < nodes.size() && id < size(); id++) {
+        if (type[id] == AST_IDENTIFIER && alt[id] != NO_NODE) {
+            nodes[id]->alt = nodes[alt[id]];
+        }
+    }
+}
+
+
+const string FlatAST::shorthand(NodeId id) const {
+    string vis = string(symbol_name(name[id]));
+    if (type[id] == AST_LONG) {
+        vis = std::to_string(numeric_value[id].l);
+    } else if (type[id] == AST_DOUBLE) {
+        vis = std::to_string(numeric_value[id].d);
+    }
+    if (type[id] == AST_IDENTIFIER) {
+        vis += "->";
+        if (alt[id] != NO_NODE) {
+            vis += shorthand(alt[id]);
+        }
+    }
+    return CHAR_STR(type[id]) + std::to_string(properties[id]) + "." + vis;
+}
+
+
+ostream& line_stream(ostream& os,  const FlatAST& ast,  NodeId id, bool new_line) {
+    if (ast.type[id] < 'a') {
+        if (ast.depth[id] >= 0 && new_line) {
+            os << endl << string(ast.depth[id], ' ') << ast.shorthand(id);
+        }
+    } else {
+        os << " " << ast.shorthand(id);
+    }
+    if (ast.type[id] == AST_REFERENCE && ast.alt[id] != NO_NODE) {
+        os << "[( ";
+        line_stream(os, ast, ast.alt[id], false);
+        os << " )]";
+    }
+    if (ast.next[id] != NO_NODE) {
+        line_stream(os, ast, ast.next[id], true);
+    }
+    for (auto c = ast.first_child[id]; c < ast.first_child[id + 1]; c++) {
+        line_stream(os, ast, ast.child_list[c], true);
+    }
+    if (ast.type[id] == AST_CONDITIONAL && ast.alt[id] != NO_NODE) {
+        line_stream(os, ast, ast.alt[id], true);
+    }
+    return os;
+}
+
+
+ostream& operator<<(ostream& os,  const FlatAST& ast) {
+    return line_stream(os, ast, 0, true);
+}
@@ -0,0 +1,69 @@
+// Scandi: flat_ast.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include "ast.h"
+#include "globals.h"
+
+
+typedef uint32_t NodeId;
+const NodeId NO_NODE = UINT32_MAX;
+
+
+// A structure-of-arrays copy of an AST, for passes that visit every node.
+// Each field is its own array, indexed by node. Nodes are stored in the order
+// the semantic passes visit the tree (node, next, alt, children), so those
+// passes can walk the arrays front to back.
+class FlatAST {
+
+    public:
+        vector<ASTType> type;
+        vector<Symbol> name;
+        vector<int> depth;
+        vector<char> properties;
+        vector<decltype(AST::numeric_value)> numeric_value;
+        vector<NodeId> parent;
+        vector<NodeId> next;
+        vector<NodeId> alt;           // As with AST, a link to the declaration for identifiers.
+        vector<uint32_t> first_child; // Children are child_list[first_child[id]] up to
+        vector<NodeId> child_list;    // first_child[id + 1].
+
+        // Copies the tree under root. Identifiers are left unlinked, for
+        // analyse_semantics to link.
+        explicit FlatAST(AST* root);
+
+        size_t size() const { return type.size(); }
+
+        bool has_member(NodeId, Symbol) const;
+        bool can_see(NodeId, Symbol) const;
+        NodeId get_member(NodeId, Symbol) const;
+
+        bool get_property(NodeId id, const char prop) const { return properties[id] & prop; }
+
+        // Gives the tree it was copied from the links analyse_semantics made,
+        // for the passes that walk the tree.
+        void link_tree(AST* root) const;
+
+        // Matches AST::shorthand, so the two layouts dump identically.
+        const string shorthand(NodeId) const;
+
+    private:
+        // Declarations by scope and name, with the same precedence as AST.
+        std::unordered_map<uint64_t, NodeId> members;
+
+        struct PathEntry {
+            AST* ast;
+            NodeId id;
+        };
+
+        NodeId add(AST*, vector<PathEntry>&);
+        NodeId find_parent(AST*, const vector<PathEntry>&) const;
+        void add_member(NodeId, Symbol, NodeId);
+        bool declares(NodeId) const;
+};
+ostream& operator<<(ostream&, const FlatAST&);
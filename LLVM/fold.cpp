@@ -0,0 +1,430 @@
+// Scandi: fold.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include "codegen.h"
+#include "fold.h"
+#include "globals.h"
+#include "lines.h"
+#include "runtime.h"
+
+
+/*
+ *  Values are worked out by the runtime, so they are what the program would
+ *  have got. Only longs and doubles are made, and anything that would fail,
+ *  such as dividing by zero, is left to fail when the program runs.
+ */
+
+bool is_number(AST* ast) {
+    return ast && (ast->type == AST_LONG || ast->type == AST_DOUBLE);
+}
+
+
+bool is_constant(AST* ast) {
+    switch (ast->type) {
+        case AST_LONG:
+        case AST_DOUBLE:
+        case AST_STRING:
+        case AST_BINARY:
+        case AST_NULL:      return true;
+        default:            return false;
+    }
+}
+
+
+Value value_of(AST* constant) {
+    switch (constant->type) {
+        case AST_LONG:      return { TAG_LONG, constant->numeric_value.l };
+        case AST_DOUBLE: {
+            Value value { TAG_DOUBLE, 0 };
+            std::memcpy(&value.bits, &constant->numeric_value.d, sizeof(value.bits));
+            return value;
+        }
+        case AST_STRING:
+        case AST_BINARY:    return scandi_string(constant->name.data(), constant->name.size());
+        default:            return { TAG_NULL, 0 };
+    }
+}
+
+
+// Makes ast the value, which is a long or a double, where it is.
+void become(AST* ast, Value value) {
+    ast->type = value.tag == TAG_LONG ? AST_LONG : AST_DOUBLE;
+    ast->name.clear();
+    ast->sym = intern("");
+    ast->alt = nullptr;
+    ast->properties &= ~AST::OPT_TARGETS_SELF;
+    if (value.tag == TAG_LONG) {
+        ast->numeric_value.l = value.bits;
+    } else {
+        std::memcpy(&ast->numeric_value.d, &value.bits, sizeof(value.bits));
+    }
+}
+
+
+/*
+ *  Folding. Two numbers followed by an operator are only that operator's
+ *  operands, so the three can be its result. The same goes for a number
+ *  and ~. Negation, ( ... ), is 0 ... -, so folds too.
+ */
+
+bool fold_at(AST* a) {
+    auto b = a->next;
+    if (!is_number(a) || !b || b->get_property(AST::OPT_TARGETS_SELF)) {
+        return false;
+    }
+    if (b->type == AST_OPERATOR && b->name == CHAR_STR(LEX_COMPLEMENT)) {
+        become(a, scandi_operate(OP_COMPLEMENT, value_of(a), { TAG_NULL, 0 }));
+        a->next = b->next;
+        TRACE( TRACE_SEMANTICS, TRACE_DETAIL, "FOLDED " << b->name << " TO " << a->shorthand(); )
+        return true;
+    }
+    auto op = b->next;
+    if (!is_number(b) || !op || op->type != AST_OPERATOR || op->get_property(AST::OPT_TARGETS_SELF)) {
+        return false;
+    }
+    auto operation = operation_of(op->name);
+    auto x = value_of(a);
+    auto y = value_of(b);
+    if (operation < 0 || ((operation == OP_DIVIDE || operation == OP_MODULUS) && x.tag == TAG_LONG && y.tag == TAG_LONG && y.bits == 0)) {
+        return false;
+    }
+    become(a, scandi_operate(operation, x, y));
+    a->next = op->next;
+    TRACE( TRACE_SEMANTICS, TRACE_DETAIL, "FOLDED " << op->name << " TO " << a->shorthand(); )
+    return true;
+}
+
+
+// Folds the line from first, and its references' keys. Each fold may give
+// an operand of an operator further on, so it starts again after each.
+bool fold_chain(AST* first) {
+    bool changed = false;
+    for (auto c = first; c; c = c->next) {
+        if (c->type == AST_REFERENCE && c->alt) {
+            changed |= fold_chain(c->alt->next);
+        }
+    }
+    for (auto c = first; c; ) {
+        if (fold_at(c)) {
+            changed = true;
+            c = first;
+        } else {
+            c = c->next;
+        }
+    }
+    return changed;
+}
+
+
+bool fold_lines(AST* ast) {
+    bool changed = false;
+    if (ast->type == AST_EXPRESSION || ast->type == AST_CONDITIONAL || ast->type == AST_ALIAS) {
+        changed |= fold_chain(ast->next);
+    }
+    for (auto c: ast->children) {
+        changed |= fold_lines(c);
+    }
+    if (ast->type == AST_CONDITIONAL && ast->alt) {
+        changed |= fold_lines(ast->alt);
+    }
+    return changed;
+}
+
+
+/*
+ *  Propagation. Each line is followed as codegen follows it, to find which
+ *  variables are assigned to, which are read, and where. A variable can be
+ *  replaced by its value where it is read if:
+ *
+ *  - it is declared with a number, $x 5 =, in its function's (or the
+ *    program's) own lines, not in a label or conditional, and nothing else
+ *    assigns to it, or to its fields,
+ *  - it is only read by lines of the same function, after its declaration,
+ *    and not through an alias,
+ *  - no jump or label comes before its declaration in that function, so
+ *    nothing can get past it, and
+ *  - nothing there uses the local context, [key] or .name, and nothing
+ *    anywhere looks up its name at runtime, either of which could change it.
+ */
+
+struct Variable {
+    AST* declaration = nullptr;       // $x c =
+    size_t order = 0;                 // Of the declaration.
+    int assignments = 0;
+    vector<std::pair<AST*, size_t>> reads;
+    bool is_shared = false;           // Read from another function, or an alias.
+};
+
+
+// Lines are followed by lines.h, for the function in owner.
+struct Propagation : LinePass {
+    typedef Operand<NoPayload> Item;
+
+    std::unordered_map<AST*, Variable> variables;
+    vector<AST*> found;               // The variables, in the order they were found.
+    std::unordered_map<AST*, size_t> first_jump;            // By function, or null for the program.
+    std::unordered_set<AST*> uses_context;
+    std::unordered_set<Symbol> runtime_names;
+    size_t order = 0;                 // Of the line being followed, in program order.
+
+    Variable& variable_of(AST* decl) {
+        auto known = variables.find(decl);
+        if (known == variables.end()) {
+            found.push_back(decl);
+            known = variables.emplace(decl, Variable()).first;
+        }
+        return known->second;
+    }
+
+    void jump_seen() {
+        first_jump.emplace(owner, order);
+    }
+
+    void identifier(AST* identifier) {
+        if (!identifier->alt) {
+            runtime_names.insert(identifier->sym);
+        } else if (identifier->alt->type == AST_VARIABLE) {
+            auto& variable = variable_of(identifier->alt);
+            variable.reads.push_back({ identifier, order });
+            if (in_alias || owning_function(identifier->alt) != owner) {
+                variable.is_shared = true;
+            }
+        }
+    }
+
+    void context_field(Item&) {
+        uses_context.insert(owner);
+    }
+
+    void jump(AST*, AST*) {
+        jump_seen();
+    }
+
+    void assign(AST*, Item& target, Item&) {
+        if (auto decl = stored_variable(target)) {
+            variable_of(decl).assignments++;
+        }
+    }
+};
+
+
+// $x c =, where c is a number.
+bool is_declaration(AST* line) {
+    auto x = line->next;
+    if (!x || x->type != AST_IDENTIFIER || !x->alt || x->alt->type != AST_VARIABLE || !is_number(x->next)) {
+        return false;
+    }
+    auto assign = x->next->next;
+    return assign && assign->type == AST_OPERATOR && assign->name == CHAR_STR(LEX_ASSIGNMENT) && !assign->next;
+}
+
+
+void follow_lines(AST* ast, Propagation& p) {
+    auto owner = p.owner;
+    if (ast->type == AST_FUNCTION) {
+        p.owner = ast;
+    }
+    p.order++;
+    switch (ast->type) {
+        case AST_EXPRESSION:
+            follow_line(ast, p);
+            if (is_declaration(ast)) {
+                auto& variable = p.variable_of(ast->next->alt);
+                variable.declaration = ast;
+                variable.order = p.order;
+            }
+            break;
+        case AST_CONDITIONAL: {
+            vector<Propagation::Item> stack;
+            follow_chain(ast->next, stack, 0, p);
+            break;
+        }
+        case AST_LABEL:
+            p.jump_seen();
+            break;
+        default:
+            break;
+    }
+    for (auto c: ast->children) {
+        follow_lines(c, p);
+    }
+    if (ast->type == AST_CONDITIONAL && ast->alt) {
+        for (auto c: ast->alt->children) {
+            follow_lines(c, p);
+        }
+    }
+    p.owner = owner;
+}
+
+
+// Whether x's declaration, $x c =, is the line after x among its function's
+// own lines, or its file's.
+bool is_declared_in_place(AST* x, AST* declaration, AST* global) {
+    auto parent = x->parent;
+    auto is_own_line = owning_function(x) ? parent->type == AST_FUNCTION : parent->parent == global;
+    if (!is_own_line || declaration->parent != parent) {
+        return false;
+    }
+    auto& lines = parent->children;
+    for (size_t i = 0; i + 1 < lines.size(); i++) {
+        if (lines[i] == x) {
+            return lines[i + 1] == declaration;
+        }
+    }
+    return false;
+}
+
+
+bool propagate(AST* global) {
+    Propagation p;
+    follow_lines(global, p);
+
+    bool changed = false;
+    for (auto x: p.found) {
+        auto& variable = p.variables.at(x);
+        auto owner = owning_function(x);
+        auto jump = p.first_jump.find(owner);
+        if (
+            !variable.declaration || variable.assignments != 1 || variable.is_shared
+         || x->get_property(AST::OPT_STATIC) || !x->children.empty()
+         || !is_declared_in_place(x, variable.declaration, global)
+         || (jump != p.first_jump.end() && jump->second <= variable.order)
+         || p.uses_context.count(owner) || p.runtime_names.count(x->sym)
+        ) {
+            continue;
+        }
+        auto target = variable.declaration->next;
+        auto is_read_before = std::any_of(variable.reads.begin(), variable.reads.end(), [&](auto& read) {
+            return read.first != target && read.second <= variable.order;
+        });
+        if (is_read_before || variable.reads.size() < 2) {
+            continue;
+        }
+        TRACE( TRACE_SEMANTICS, TRACE_DETAIL, "PROPAGATED " << x->name << " AS " << target->next->shorthand() << " TO " << variable.reads.size() - 1 << " READS"; )
+        auto value = value_of(target->next);
+        for (auto& read: variable.reads) {
+            if (read.first != target) {
+                become(read.first, value);
+            }
+        }
+        changed = true;
+    }
+    return changed;
+}
+
+
+/*
+ *  Conditionals that only test constants always go the same way, so are
+ *  replaced by the lines of that branch. Those that declare anything, which
+ *  could be found by name or jumped to, are left.
+ */
+
+bool declares_anything(AST* ast) {
+    for (auto c: ast->children) {
+        switch (c->type) {
+            case AST_EXPRESSION:
+            case AST_CONDITIONAL:
+                if (declares_anything(c) || (c->type == AST_CONDITIONAL && c->alt && declares_anything(c->alt))) {
+                    return true;
+                }
+                break;
+            default:
+                return true;
+        }
+    }
+    return false;
+}
+
+
+// Strings made to decide are the compiler's own, so are freed after.
+void release(const vector<Value>& values) {
+    for (auto& value: values) {
+        if (value.tag == TAG_STRING) {
+            std::free(reinterpret_cast<void*>(value.bits));
+        }
+    }
+}
+
+
+// Gives 1 if the conditional always holds, 0 if it never does, and -1 if it
+// isn't known.
+int decision(AST* conditional) {
+    for (auto c = conditional->next; c; c = c->next) {
+        if (!is_constant(c)) {
+            return -1;
+        }
+    }
+    vector<Value> values;
+    for (auto c = conditional->next; c; c = c->next) {
+        values.push_back(value_of(c));
+    }
+    auto holds = -1;
+    if (values.size() >= 2) {
+        auto operation = operation_of(conditional->name.substr(0, conditional->name.find('_')));
+        if (operation >= OP_EQ && operation <= OP_GTE) {
+            holds = scandi_truth(scandi_operate(operation, values[values.size() - 2], values.back())) != 0;
+        }
+    } else {
+        holds = !values.empty() && scandi_truth(values.back()) != 0;
+    }
+    release(values);
+    return holds;
+}
+
+
+bool decide_conditionals(AST* ast) {
+    bool changed = false;
+    for (size_t i = 0; i < ast->children.size(); ) {
+        auto c = ast->children[i];
+        auto holds = -1;
+        if (c->type == AST_CONDITIONAL && !declares_anything(c) && !(c->alt && declares_anything(c->alt))) {
+            holds = decision(c);
+        }
+        if (holds < 0) {
+            i++;
+            continue;
+        }
+        TRACE( TRACE_SEMANTICS, TRACE_DETAIL, "DECIDED " << c->name << (holds ? " TRUE" : " FALSE"); )
+        vector<AST*> lines;
+        if (holds) {
+            lines = c->children;
+        } else if (c->alt) {
+            lines = c->alt->children;
+        }
+        for (auto line: lines) {
+            line->parent = ast;
+        }
+        ast->children.erase(ast->children.begin() + i);
+        ast->children.insert(ast->children.begin() + i, lines.begin(), lines.end());
+        i += lines.size();
+        changed = true;
+    }
+    for (auto c: ast->children) {
+        changed |= decide_conditionals(c);
+    }
+    for (auto c: ast->children) {
+        if (c->type == AST_CONDITIONAL && c->alt) {
+            changed |= decide_conditionals(c->alt);
+        }
+    }
+    return changed;
+}
+
+
+void fold_constants(AST* global) {
+    TRACE( TRACE_SEMANTICS, TRACE_SUMMARY, endl << "FOLDING CONSTANTS";)
+    bool changed = true;
+    while (changed) {
+        changed = fold_lines(global);
+        changed |= propagate(global);
+        changed |= decide_conditionals(global);
+    }
+}
@@ -0,0 +1,15 @@
+// Scandi: fold.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include "ast.h"
+#include "globals.h"
+
+
+// Works out at compile time what the linked tree would at runtime: operators
+// on constants, variables that only ever hold one, and conditionals that then
+// test constants. Runs over the whole program, once identifiers are linked.
+void fold_constants(AST* global);
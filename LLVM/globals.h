@@ -11,6 +11,7 @@
 #include <stdexcept>
 #include <string>
 #include <vector>
+#include "trace.h"
 
 
 using std::cerr;
@@ -23,13 +24,6 @@ using std::string;
 using std::vector;
 
 
-extern bool debug_set;
-
-
 #define CHAR_STR( ch )      string(1, ch )
 
-#define DEBUG( ... )        if (debug_set) { cout << endl << __VA_ARGS__ }
 #define DERR( ... )         throw domain_error( __VA_ARGS__ )
-
-#define SHARE( type, ... )  std::make_shared< type >( type ( __VA_ARGS__ ))
-#define SHARED( type )      std::shared_ptr< type >
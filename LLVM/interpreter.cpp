@@ -0,0 +1,326 @@
+// Scandi: interpreter.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <cstdio>
+#include <cstring>
+#include "bytecode.h"
+#include "globals.h"
+
+
+/*
+ *  Each instruction's handler jumps straight to the next one's, through a
+ *  table of label addresses (computed goto, which gcc and clang both have),
+ *  rather than back to a switch. The top of the stack is kept in tos, so it
+ *  stays in registers; sp points at the operand under it. Each call has its
+ *  slots, then a spare entry, then its operands on the VM stack.
+ */
+
+#define STACK_SIZE      (1 << 20)
+
+#define DISPATCH        goto *dispatch[pc->op]
+#define NEXT            pc++; DISPATCH
+#define JUMP( TARGET )  pc = code + (TARGET); DISPATCH
+#define PUSH( VALUE )   { auto pushed = (VALUE); *++sp = tos; tos = pushed; }
+#define POP             tos = *sp--
+
+
+typedef Value (*NativeFunction)(const Value*, int64_t);
+typedef Value (*NativeVariable)();
+
+
+struct Machine {
+    const Bytecode& program;
+    vector<Value> stack;
+    vector<Value> globals;
+    vector<void*> natives;
+};
+
+
+inline bool is_true(Value v) {
+    return v.tag == TAG_LONG ? v.bits != 0 : scandi_truth(v) != 0;
+}
+
+
+// The comparisons, for longs.
+inline bool holds(int64_t operation, int64_t a, int64_t b) {
+    switch (operation) {
+        case OP_EQ:     return a == b;
+        case OP_LT:     return a < b;
+        case OP_LTE:    return a <= b;
+        case OP_GT:     return a > b;
+        default:        return a >= b;
+    }
+}
+
+
+// Whether a operation b holds.
+inline bool compares(int64_t operation, Value a, Value b) {
+    return (a.tag == TAG_LONG && b.tag == TAG_LONG) ? holds(operation, a.bits, b.bits) : is_true(scandi_operate(operation, a, b));
+}
+
+
+// v operation by, for the increments, which are adds and subtracts.
+inline Value increment(int64_t operation, Value v, Value by) {
+    if (v.tag == TAG_LONG && by.tag == TAG_LONG) {
+        v.bits = operation == OP_ADD ? static_cast<uint64_t>(v.bits) + by.bits : static_cast<uint64_t>(v.bits) - by.bits;
+        return v;
+    }
+    return scandi_operate(operation, v, by);
+}
+
+
+// Whether s[i] operation c holds, c being a constant. A character of a string
+// is compared with a one character string without making one, when it can be.
+inline bool compares_element(int64_t operation, Value s, Value i, Value c) {
+    if (operation == OP_EQ && s.tag == TAG_STRING && i.tag == TAG_LONG && c.tag == TAG_STRING) {
+        auto text = reinterpret_cast<const String*>(s.bits);
+        auto character = reinterpret_cast<const String*>(c.bits);
+        return i.bits >= 0 && i.bits < text->length && character->length == 1 && text->text[i.bits] == character->text[0];
+    }
+    return compares(operation, scandi_get(s, i), c);
+}
+
+
+Value execute(Machine& vm, uint32_t index, const Value* args, int64_t count, Value* base) {
+    static const void* dispatch[] = {
+        &&push, &&load_local, &&store_local, &&load_global, &&store_global, &&load_name, &&store_name, &&load_frame,
+        &&add, &&sub, &&multiply, &&operate, &&operate, &&operate, &&operate, &&operate, &&operate, &&operate, &&operate,
+        &&compare, &&compare, &&compare, &&compare, &&compare, &&complement,
+        &&count_, &&count_arguments, &&get, &&set, &&dup2, &&drop, &&nip,
+        &&jump, &&branch_false, &&branch_unless,
+        &&call, &&call_native, &&native_value, &&return_, &&return_null,
+        &&increment_local, &&increment_global, &&branch_unless_count, &&get_branch_unless, &&get_branch_unless_constant
+    };
+
+    auto& function = vm.program.functions[index];
+    if (base + function.slots + function.max_stack + 2 > vm.stack.data() + vm.stack.size()) {
+        scandi_fail("Stack overflow");
+    }
+    const Value null = { TAG_NULL, 0 };
+    auto slots = base;
+    int64_t named = function.named;
+    for (int64_t i = 0; i < function.slots; i++) {
+        auto a = count - named + i;
+        slots[i] = i < named && a >= 0 ? args[a] : null;
+    }
+    auto unnamed = count > named ? count - named : 0;
+    auto frame = null;
+    if (function.uses_frame) {
+        frame = index == 0 ? scandi_globals() : scandi_arguments(args, count, named);
+    }
+
+    auto constants = vm.program.constants.data();
+    auto globals = vm.globals.data();
+    auto code = function.code.data();
+    auto pc = code;
+    auto sp = base + function.slots;
+    auto tos = null;
+    DISPATCH;
+
+push:
+    PUSH( constants[pc->arg] );
+    NEXT;
+load_local:
+    PUSH( slots[pc->arg] );
+    NEXT;
+store_local:
+    slots[pc->arg] = tos;
+    POP;
+    NEXT;
+load_global:
+    PUSH( globals[pc->arg] );
+    NEXT;
+store_global:
+    globals[pc->arg] = tos;
+    POP;
+    NEXT;
+load_name:
+    PUSH( scandi_get(scandi_globals(), constants[pc->arg]) );
+    NEXT;
+store_name:
+    scandi_set(scandi_globals(), constants[pc->arg], tos);
+    POP;
+    NEXT;
+load_frame:
+    PUSH( frame );
+    NEXT;
+
+// Longs are worked out here. Anything else is left to the runtime.
+add: {
+    auto a = *sp--;
+    if (a.tag == TAG_LONG && tos.tag == TAG_LONG) {
+        tos.bits = static_cast<uint64_t>(a.bits) + tos.bits;
+    } else {
+        tos = scandi_operate(OP_ADD, a, tos);
+    }
+    NEXT;
+}
+sub: {
+    auto a = *sp--;
+    if (a.tag == TAG_LONG && tos.tag == TAG_LONG) {
+        tos.bits = static_cast<uint64_t>(a.bits) - tos.bits;
+    } else {
+        tos = scandi_operate(OP_SUB, a, tos);
+    }
+    NEXT;
+}
+multiply: {
+    auto a = *sp--;
+    if (a.tag == TAG_LONG && tos.tag == TAG_LONG) {
+        tos.bits = static_cast<uint64_t>(a.bits) * tos.bits;
+    } else {
+        tos = scandi_operate(OP_MULTIPLY, a, tos);
+    }
+    NEXT;
+}
+operate: {
+    auto a = *sp--;
+    tos = scandi_operate(pc->op - BC_ADD, a, tos);
+    NEXT;
+}
+compare: {
+    auto a = *sp--;
+    if (a.tag == TAG_LONG && tos.tag == TAG_LONG) {
+        tos.bits = holds(pc->op - BC_ADD, a.bits, tos.bits);
+    } else {
+        tos = scandi_operate(pc->op - BC_ADD, a, tos);
+    }
+    NEXT;
+}
+complement:
+    tos = scandi_operate(OP_COMPLEMENT, tos, null);
+    NEXT;
+
+count_:
+    tos = scandi_count(tos);
+    NEXT;
+count_arguments:
+    PUSH( (Value { TAG_LONG, unnamed }) );
+    NEXT;
+get: {
+    auto container = *sp--;
+    tos = scandi_get(container, tos);
+    NEXT;
+}
+set: {
+    auto key = *sp--;
+    auto container = *sp--;
+    tos = scandi_set(container, key, tos);
+    NEXT;
+}
+dup2: {
+    auto under = *sp;
+    *++sp = tos;
+    *++sp = under;
+    NEXT;
+}
+drop:
+    sp -= pc->count;
+    tos = sp[1];
+    NEXT;
+nip:
+    sp -= pc->count;
+    NEXT;
+
+jump:
+    JUMP( pc->arg );
+branch_false: {
+    auto v = tos;
+    POP;
+    if (!is_true(v)) {
+        JUMP( pc->arg );
+    }
+    NEXT;
+}
+branch_unless: {
+    auto b = tos;
+    auto a = *sp--;
+    POP;
+    if (!compares(pc->operation, a, b)) {
+        JUMP( pc->arg );
+    }
+    NEXT;
+}
+
+// Arguments are passed where they are on the stack, and the callee's frame
+// goes above them.
+call: {
+    *++sp = tos;
+    tos = execute(vm, pc->arg, sp - pc->count + 1, pc->count, sp + 1);
+    sp -= pc->count;
+    NEXT;
+}
+call_native: {
+    *++sp = tos;
+    tos = reinterpret_cast<NativeFunction>(vm.natives[pc->arg])(sp - pc->count + 1, pc->count);
+    sp -= pc->count;
+    NEXT;
+}
+native_value:
+    PUSH( reinterpret_cast<NativeVariable>(vm.natives[pc->arg])() );
+    NEXT;
+return_:
+    return tos;
+return_null:
+    return null;
+
+// Superinstructions.
+increment_local:
+    slots[pc->arg] = increment(pc->operation, slots[pc->arg], constants[pc->count]);
+    NEXT;
+increment_global:
+    globals[pc->arg] = increment(pc->operation, globals[pc->arg], constants[pc->count]);
+    NEXT;
+branch_unless_count: {
+    auto container = tos;
+    auto a = *sp--;
+    POP;
+    auto count = container.tag == TAG_STRING
+        ? Value { TAG_LONG, reinterpret_cast<const String*>(container.bits)->length }
+        : scandi_count(container);
+    if (!compares(pc->operation, a, count)) {
+        JUMP( pc->arg );
+    }
+    NEXT;
+}
+get_branch_unless: {
+    auto key = tos;
+    auto container = *sp--;
+    auto a = *sp--;
+    POP;
+    if (!compares(pc->operation, a, scandi_get(container, key))) {
+        JUMP( pc->arg );
+    }
+    NEXT;
+}
+get_branch_unless_constant: {
+    auto key = tos;
+    auto container = *sp--;
+    POP;
+    if (!compares_element(pc->operation, container, key, constants[pc->count])) {
+        JUMP( pc->arg );
+    }
+    NEXT;
+}
+}
+
+
+int interpret(const Bytecode& program) {
+    Machine vm { program, vector<Value>(STACK_SIZE), vector<Value>(program.globals, { TAG_NULL, 0 }) };
+    for (auto& name: program.natives) {
+        auto symbol = runtime_symbols;
+        while (symbol->name && name != symbol->name) {
+            symbol++;
+        }
+        if (!symbol->name) {
+            DERR("No embedded code for " + name + " in the runtime");
+        }
+        vm.natives.push_back(symbol->address);
+    }
+    execute(vm, 0, nullptr, 0, vm.stack.data());
+    std::fflush(stdout);
+    return 0;
+}
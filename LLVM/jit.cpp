@@ -0,0 +1,70 @@
+// Scandi: jit.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <cstdio>
+#include <llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/TargetSelect.h>
+#include "globals.h"
+#include "jit.h"
+#include "runtime.h"
+
+
+template< typename T >
+T checked(llvm::Expected<T> value) {
+    if (!value) {
+        DERR("JIT: " + llvm::toString(value.takeError()));
+    }
+    return std::move(*value);
+}
+
+
+void check(llvm::Error error) {
+    if (error) {
+        DERR("JIT: " + llvm::toString(std::move(error)));
+    }
+}
+
+
+// Everything generated code may call in runtime.h.
+void define_runtime(llvm::orc::LLLazyJIT& jit) {
+    llvm::orc::SymbolMap symbols;
+    for (auto symbol = runtime_symbols; symbol->name; symbol++) {
+        symbols[jit.mangleAndIntern(symbol->name)] = llvm::JITEvaluatedSymbol::fromPointer(symbol->address);
+    }
+    auto& library = jit.getMainJITDylib();
+    check(library.define(llvm::orc::absoluteSymbols(std::move(symbols))));
+
+    // Optimised code may call the C library, for memset and the like.
+    library.addGenerator(checked(llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        jit.getDataLayout().getGlobalPrefix()
+    )));
+}
+
+
+int run_program(Program&& program) {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    auto jit = checked(llvm::orc::LLLazyJITBuilder().create());
+    define_runtime(*jit);
+
+    // Compiled a function at a time, and optimised as each is compiled.
+    jit->setPartitionFunction(llvm::orc::CompileOnDemandLayer::compileRequested);
+    jit->getIRTransformLayer().setTransform(
+        [](llvm::orc::ThreadSafeModule module, const llvm::orc::MaterializationResponsibility&) {
+            module.withModuleDo([](llvm::Module& m) { optimise_module(m); });
+            return llvm::Expected<llvm::orc::ThreadSafeModule>(std::move(module));
+        }
+    );
+    check(jit->addLazyIRModule(llvm::orc::ThreadSafeModule(std::move(program.module), std::move(program.context))));
+
+    auto main = checked(jit->lookup("main")).getAddress();
+    auto status = reinterpret_cast<int (*)()>(main)();
+    std::fflush(stdout);
+    return status;
+}
@@ -0,0 +1,18 @@
+// Scandi: jit.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include "codegen.h"
+
+
+// Runs a generated program in this process, for --run. Each function is
+// optimised and compiled the first time it is called, so a program starts
+// running before the rest of it is compiled. The runtime, and with it the
+// library's embedded code, is the copy linked into scandi.
+//
+// Gives the program's exit status. The runtime exits the process itself if
+// the program fails.
+int run_program(Program&&);
@@ -4,82 +4,68 @@
 // Copyright: Neil Bradley
 // License: GPL 3.0
 
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 #include "globals.h"
 #include "lexer.h"
+#include "scanner.h"
+#include "source.h"
 
 
 using std::domain_error;
 
 
-// Context-agnostic symbols
-std::vector<int> operators {
-    LEX_REFERENCE_END,
-    LEX_ASSIGNMENT,
-    LEX_NEGATE_BEGIN,
-    LEX_NEGATE_END,
-    LEX_ADDRESS,
-    LEX_ADD,
-    LEX_SUB,
-    LEX_MULTIPLY,
-    LEX_DIVIDE,
-    LEX_MODULUS,
-    LEX_COMPLEMENT,
-    LEX_AND,
-    LEX_OR,
-    LEX_XOR,
-    LEX_EQ,
-    LEX_LT,
-    LEX_GT,
-    LEX_ELSE
-};
-
-
- bool Token::is_assignment()  {
-    return this->type == TOK_OPERATOR && this->s_val == std::string(1, LEX_ASSIGNMENT);
+ bool Token::is_assignment() const {
+    return this->type == TOK_OPERATOR && this->sym == LEX_ASSIGNMENT;
 }
 
 
- bool Token::is_conditional()  {
+ bool Token::is_conditional() const {
     return this->type == TOK_OPERATOR && (
-        this->s_val == std::string(1, LEX_EQ)
-     || this->s_val == std::string(1, LEX_GT)
-     || this->s_val == LEX_GTE
-     || this->s_val == std::string(1, LEX_LT)
-     || this->s_val == LEX_LTE
+        this->sym == LEX_EQ
+     || this->sym == LEX_GT
+     || this->sym == SYM_GTE
+     || this->sym == LEX_LT
+     || this->sym == SYM_LTE
     );
 }
 
-#define FN( NAME )      size_t NAME (std::vector<Token>& tokens_out,  std::string line_in,  std::string filename,  int line_no, size_t pos)
+
+const std::string& Token::filename() const {
+    return source_file(file_id).name;
+}
+
+#define FN( NAME )      size_t NAME (LexContext& context,  std::string_view line_in,  int line_no, size_t pos)
 #define INIT_POS        auto init_pos = pos
-#define ARGS_POS       filename, line_no, pos
-#define DEBUG_POS       filename, line_no, (pos + 1)
-#define DEBUG_INIT_POS  filename, line_no, (init_pos + 1)
-#define TOK_ADD( ... )  tokens_out.push_back(Token( __VA_ARGS__ ))
+#define ARGS_POS        line_no, pos
+#define DEBUG_POS       context.file_id, line_no, (pos + 1)
+#define DEBUG_INIT_POS  context.file_id, line_no, (init_pos + 1)
+#define TOK_ADD( ... )  context.tokens_out.push_back(Token( __VA_ARGS__ ))
 
 
 // Identifiers are contiguous blocks of alphanumeric characters starting with a
 // letter.
 FN( get_identifier ) {
     INIT_POS;
-    std::string identifier;
-
-    while (pos < line_in.size() && isalnum(line_in[pos])) {
-        identifier += line_in[pos];
-        pos++;
-    }
+    pos = scan::alnums(line_in.data(), pos, line_in.size());
+    auto identifier = line_in.substr(init_pos, pos - init_pos);
 
-    if (!tokens_out.empty() && tokens_out.back().s_val.empty() && (
-        tokens_out.back().type == TOK_FUNCTION
-     || tokens_out.back().type == TOK_VARIABLE
-     || tokens_out.back().type == TOK_LABEL
+    if (!context.tokens_out.empty() && context.tokens_out.back().sym == SYM_EMPTY && (
+        context.tokens_out.back().type == TOK_FUNCTION
+     || context.tokens_out.back().type == TOK_VARIABLE
+     || context.tokens_out.back().type == TOK_LABEL
     )) {
-        tokens_out.back().s_val = identifier;
+        context.tokens_out.back().sym = intern_stable(identifier);
     } else {
-        TOK_ADD(TOK_IDENTIFIER, identifier, 0L, 0.0, false, false, DEBUG_INIT_POS);
+        TOK_ADD(TOK_IDENTIFIER, intern_stable(identifier), 0L, false, false, DEBUG_INIT_POS);
     }
     return pos;
 }
@@ -88,58 +74,61 @@ FN( get_identifier ) {
 // Numbers are digits that may contain a single decimal point.
 FN( get_number ) {
     INIT_POS;
-    std::string number;
-    bool decimal_seen = false;
-
-    // Build the number up.
-    while (pos < line_in.size() && (isdigit(line_in[pos]) || line_in[pos] == LEX_DECIMAL_POINT)) {
-        if (line_in[pos] == LEX_DECIMAL_POINT) {
-            // Oops. malformed number!
-            if (decimal_seen) {
-                throw domain_error("Extraneous decimal point");
-            } else {
-                decimal_seen = true;
-            }
-            number += ".";
-        } else {
-            number += line_in[pos];
-        }
-        pos++;
+    pos = scan::digits(line_in.data(), pos, line_in.size(), LEX_DECIMAL_POINT);
+    auto number = line_in.substr(init_pos, pos - init_pos);
+
+    auto decimal_point = number.find(LEX_DECIMAL_POINT);
+    bool decimal_seen = decimal_point != std::string_view::npos;
+    if (decimal_seen && number.find(LEX_DECIMAL_POINT, decimal_point + 1) != std::string_view::npos) {
+        // Oops. malformed number!
+        throw domain_error("Extraneous decimal point");
     }
 
     // Create the correct type of token.
     if (decimal_seen) {
-        TOK_ADD(TOK_VALUE, LEX_DECIMAL_POINT, 0L, std::stod(number), false, false, DEBUG_INIT_POS);
+        // Doubles are the only numbers that need a copy, to swap in a '.'.
+        std::string decimal(number);
+        decimal[decimal_point] = '.';
+        TOK_ADD(TOK_VALUE, LEX_DECIMAL_POINT, 0L, false, false, DEBUG_INIT_POS);
+        context.tokens_out.back().d_val = std::strtod(decimal.c_str(), nullptr);
     } else {
-        TOK_ADD(TOK_VALUE, "", std::stol(number), 0.0, false, false, DEBUG_INIT_POS);
+        long value = 0;
+        if (std::from_chars(number.data(), number.data() + number.size(), value).ec != std::errc()) {
+            throw domain_error("Number out of range");
+        }
+        TOK_ADD(TOK_VALUE, SYM_EMPTY, value, false, false, DEBUG_INIT_POS);
     }
     return pos;
 }
 
 
+// Strings are a slice of the line unless they are continued, in which case the
+// pieces have to be joined into a materialized copy.
 FN( get_string ) {
     INIT_POS;
-    std::string str;
     char delimiter = line_in[pos];
-    bool in_string = true;
-    pos++;
-    
-    while (pos < line_in.size() && in_string) {
-        if (line_in[pos] == delimiter) {
-            // Need to check next char is not a continuation.
-            pos++;
-            if (pos < line_in.size() && (line_in[pos] == LEX_QUOTE || line_in[pos] == LEX_APOSTROPHE)) {
-                delimiter = line_in[pos];
+    auto str_start = pos + 1;
+    pos = scan::until(line_in.data(), str_start, line_in.size(), delimiter);
+    auto str = line_in.substr(str_start, pos - str_start);
+    if (pos < line_in.size()) {
+        pos++;
+    }
+
+    // Need to check next char is not a continuation.
+    if (pos < line_in.size() && (line_in[pos] == LEX_QUOTE || line_in[pos] == LEX_APOSTROPHE)) {
+        std::string joined(str);
+        while (pos < line_in.size() && (line_in[pos] == LEX_QUOTE || line_in[pos] == LEX_APOSTROPHE)) {
+            delimiter = line_in[pos];
+            str_start = pos + 1;
+            pos = scan::until(line_in.data(), str_start, line_in.size(), delimiter);
+            joined.append(line_in.data() + str_start, pos - str_start);
+            if (pos < line_in.size()) {
                 pos++;
-            } else {
-                in_string = false;
             }
-        } else {
-            str += line_in[pos];
-            pos++;
         }
+        str = source_file(context.file_id).keep(std::move(joined));
     }
-    TOK_ADD(TOK_STRING, str, 0L, 0.0, false, false, DEBUG_INIT_POS);
+    TOK_ADD(TOK_STRING, intern_stable(str), 0L, false, false, DEBUG_INIT_POS);
     return pos;
 }
 
@@ -153,91 +142,195 @@ FN( get_hex ) {
     }
     if (line_in[pos] == LEX_QUOTE || line_in[pos] == LEX_APOSTROPHE) {
         // Binary blob.
-        pos = get_string(tokens_out, line_in, ARGS_POS);
-        tokens_out.back().type = TOK_BINARY;
+        pos = get_string(context, line_in, ARGS_POS);
+        context.tokens_out.back().type = TOK_BINARY;
     } else {
         // Hex number.
-        std::string num = "";
-        while (pos < line_in.size() && std::isxdigit(line_in[pos])) {
-            num += line_in[pos];
-            pos++;
+        auto num_start = pos;
+        pos = scan::hex_digits(line_in.data(), pos, line_in.size());
+        long value = 0;
+        if (std::from_chars(line_in.data() + num_start, line_in.data() + pos, value, 16).ec != std::errc()) {
+            throw domain_error("Malformed hexadecimal");
         }
-        TOK_ADD(TOK_VALUE, "", std::stol(num, nullptr, 16), 0.0, false, false, DEBUG_INIT_POS);
-        
+        TOK_ADD(TOK_VALUE, SYM_EMPTY, value, false, false, DEBUG_INIT_POS);
+
     }
     return pos;
 }
 
 
-#define CONSIDERING_STRING(TEST)        if (local.rfind(TEST, 0) == 0) {
-#define ALSO_CONSIDERING_STRING(TEST)   } else if (local.rfind(TEST, 0) == 0) {
-#define CONSIDERING_CHAR(TEST)          if (local[0] == TEST) {
-#define ALSO_CONSIDERING_CHAR(TEST)     } else if (local[0] == TEST) {
-#define STOP_CONSIDERING                }
-#define RETURN_POS_INC                  return ++pos
-#define RETURN_POS_INC2                 return pos + 2
+// Symbols are classified by a lookup on their first character, and at most two
+// candidate digraphs on their second.
+enum SymbolFlags : uint8_t {
+    SL_UNKNOWN =        1,      // Not a scandi symbol.
+    SL_CONTEXTUAL =     2,      // Targets self unless it follows something.
+    SL_STATIC =         4,
+    SL_UNNAMED =        8,      // Declarations get their name from the next identifier.
+    SL_RAW =            16      // Starts a raw code block rather than a token.
+};
+
 
-// Raw code variables
-int raw_level = -1;
-std::string raw_code;
+struct SymbolLex {
+    TokenType type;
+    uint8_t flags;
+    uint8_t digraph;            // 1 + index of the first digraph starting with this char.
+};
 
-FN( get_symbol ) {
-    std::string local = line_in.substr(pos);
-    bool in_context = (pos > 0 && line_in[pos - 1] != LEX_SPACE && line_in[pos - 1] != LEX_ALIAS_BEGIN);
 
-    // Context-dependent lexes first. Note that the context-dependent lexes will also trigger at the start of an alias.
-    CONSIDERING_CHAR(LEX_COUNT)                     TOK_ADD(TOK_OPERATOR, LEX_COUNT, 0L, 0.0, false, !in_context, DEBUG_POS);               RETURN_POS_INC;
-    ALSO_CONSIDERING_CHAR(LEX_DOT)                  TOK_ADD(TOK_OPERATOR, LEX_DOT, 0L, 0.0, false, !in_context, DEBUG_POS);                 RETURN_POS_INC;
+struct Digraph {
+    char first;
+    char second;
+    Symbol sym;
+    TokenType type;
+    uint8_t flags;
+};
+
+
+// Digraphs sharing a first character must be adjacent.
+constexpr Digraph digraphs[] = {
     // Note that self-contents will be corrected to vararg during semantic analysis if appropriate.
-    ALSO_CONSIDERING_STRING(LEX_VARARGS_CONTENTS)   TOK_ADD(TOK_OPERATOR, LEX_VARARGS_CONTENTS, 0L, 0.0, false, !in_context, DEBUG_POS);    RETURN_POS_INC2;
-    ALSO_CONSIDERING_CHAR(LEX_REFERENCE_BEGIN)      TOK_ADD(TOK_OPERATOR, LEX_REFERENCE_BEGIN, 0L, 0.0, false, !in_context, DEBUG_POS);     RETURN_POS_INC;
-
-    // Context-less lexes: digraphs.
-    ALSO_CONSIDERING_STRING(LEX_RAW_BEGIN)          raw_level = pos;                                                                        RETURN_POS_INC2;
-    ALSO_CONSIDERING_STRING(LEX_VARIABLE_STATIC)    TOK_ADD(TOK_VARIABLE, "", 0L, 0.0, true, false, DEBUG_POS);                             RETURN_POS_INC2;
-    ALSO_CONSIDERING_STRING(LEX_FUNCTION_STATIC)    TOK_ADD(TOK_FUNCTION, "", 0L, 0.0, true, false, DEBUG_POS);                             RETURN_POS_INC2;
-    ALSO_CONSIDERING_STRING(LEX_NULL)               TOK_ADD(TOK_VALUE, LEX_NULL, 0L, 0.0, true, false, DEBUG_POS);                          RETURN_POS_INC2;
-    ALSO_CONSIDERING_STRING(LEX_SHL)                TOK_ADD(TOK_OPERATOR, LEX_SHL, 0L, 0.0, true, false, DEBUG_POS);                        RETURN_POS_INC2;
-    ALSO_CONSIDERING_STRING(LEX_SHR)                TOK_ADD(TOK_OPERATOR, LEX_SHR, 0L, 0.0, true, false, DEBUG_POS);                        RETURN_POS_INC2;
-    ALSO_CONSIDERING_STRING(LEX_SSHR)               TOK_ADD(TOK_OPERATOR, LEX_SSHR, 0L, 0.0, true, false, DEBUG_POS);                       RETURN_POS_INC2;
-    ALSO_CONSIDERING_STRING(LEX_GTE)                TOK_ADD(TOK_OPERATOR, LEX_GTE, 0L, 0.0, true, false, DEBUG_POS);                        RETURN_POS_INC2;
-    ALSO_CONSIDERING_STRING(LEX_LTE)                TOK_ADD(TOK_OPERATOR, LEX_LTE, 0L, 0.0, true, false, DEBUG_POS);                        RETURN_POS_INC2;
+    { LEX_VARARGS_CONTENTS[0],  LEX_VARARGS_CONTENTS[1],  SYM_VARARGS_CONTENTS,   TOK_OPERATOR,   SL_CONTEXTUAL },
+    { LEX_RAW_BEGIN[0],         LEX_RAW_BEGIN[1],         SYM_RAW_BEGIN,          TOK_RAW,        SL_RAW },
+    { LEX_VARIABLE_STATIC[0],   LEX_VARIABLE_STATIC[1],   SYM_EMPTY,              TOK_VARIABLE,   SL_STATIC | SL_UNNAMED },
+    { LEX_FUNCTION_STATIC[0],   LEX_FUNCTION_STATIC[1],   SYM_EMPTY,              TOK_FUNCTION,   SL_STATIC | SL_UNNAMED },
+    { LEX_NULL[0],              LEX_NULL[1],              SYM_NULL,               TOK_VALUE,      SL_STATIC },
+    { LEX_SHL[0],               LEX_SHL[1],               SYM_SHL,                TOK_OPERATOR,   SL_STATIC },
+    { LEX_SHR[0],               LEX_SHR[1],               SYM_SHR,                TOK_OPERATOR,   SL_STATIC },
+    { LEX_SSHR[0],              LEX_SSHR[1],              SYM_SSHR,               TOK_OPERATOR,   SL_STATIC },
+    { LEX_GTE[0],               LEX_GTE[1],               SYM_GTE,                TOK_OPERATOR,   SL_STATIC },
+    { LEX_LTE[0],               LEX_LTE[1],               SYM_LTE,                TOK_OPERATOR,   SL_STATIC }
+};
+constexpr size_t digraph_count = sizeof(digraphs) / sizeof(digraphs[0]);
+
+
+constexpr std::array<SymbolLex, 256> build_symbol_table() {
+    std::array<SymbolLex, 256> table {};
+    for (auto& entry: table) {
+        entry = { TOK_OPERATOR, SL_UNKNOWN, 0 };
+    }
+
+    // Context-dependent lexes. Note that these will also trigger at the start of an alias.
+    for (unsigned char c: { LEX_COUNT, LEX_DOT, LEX_REFERENCE_BEGIN }) {
+        table[c] = { TOK_OPERATOR, SL_CONTEXTUAL, 0 };
+    }
 
     // Structural single lexes
-    ALSO_CONSIDERING_CHAR(LEX_LABEL_DECL)           TOK_ADD(TOK_LABEL, "", 0L, 0.0, false, false, DEBUG_POS);                               RETURN_POS_INC;
-    ALSO_CONSIDERING_CHAR(LEX_VARIABLE_DECL)        TOK_ADD(TOK_VARIABLE, "", 0L, 0.0, false, false, DEBUG_POS);                            RETURN_POS_INC;
-    ALSO_CONSIDERING_CHAR(LEX_FUNCTION_DECL)        TOK_ADD(TOK_FUNCTION, "", 0L, 0.0, false, false, DEBUG_POS);                            RETURN_POS_INC;
-    ALSO_CONSIDERING_CHAR(LEX_ALIAS_BEGIN)          TOK_ADD(TOK_ALIAS_BEGIN, "", 0L, 0.0, false, false, DEBUG_POS);                         RETURN_POS_INC;
-    ALSO_CONSIDERING_CHAR(LEX_ALIAS_END)            TOK_ADD(TOK_ALIAS_END, "", 0L, 0.0, false, false, DEBUG_POS);                           RETURN_POS_INC;
-    STOP_CONSIDERING
-
-    // Single lexe operators
-    for (auto op: operators) {
-        CONSIDERING_CHAR(op)                        TOK_ADD(TOK_OPERATOR, op, 0L, 0.0, false, false, DEBUG_POS);                            RETURN_POS_INC;
-        STOP_CONSIDERING
+    table[static_cast<unsigned char>(LEX_LABEL_DECL)] =    { TOK_LABEL,       SL_UNNAMED, 0 };
+    table[static_cast<unsigned char>(LEX_VARIABLE_DECL)] = { TOK_VARIABLE,    SL_UNNAMED, 0 };
+    table[static_cast<unsigned char>(LEX_FUNCTION_DECL)] = { TOK_FUNCTION,    SL_UNNAMED, 0 };
+    table[static_cast<unsigned char>(LEX_ALIAS_BEGIN)] =   { TOK_ALIAS_BEGIN, SL_UNNAMED, 0 };
+    table[static_cast<unsigned char>(LEX_ALIAS_END)] =     { TOK_ALIAS_END,   SL_UNNAMED, 0 };
+
+    // Context-agnostic single lexe operators
+    for (unsigned char c: {
+        LEX_REFERENCE_END,
+        LEX_ASSIGNMENT,
+        LEX_NEGATE_BEGIN,
+        LEX_NEGATE_END,
+        LEX_ADDRESS,
+        LEX_ADD,
+        LEX_SUB,
+        LEX_MULTIPLY,
+        LEX_DIVIDE,
+        LEX_MODULUS,
+        LEX_COMPLEMENT,
+        LEX_AND,
+        LEX_OR,
+        LEX_XOR,
+        LEX_EQ,
+        LEX_LT,
+        LEX_GT,
+        LEX_ELSE
+    }) {
+        table[c] = { TOK_OPERATOR, 0, 0 };
     }
 
-    // If we get here, there was a problem!
-    throw domain_error("Unknown symbol");
+    for (size_t d = digraph_count; d > 0; d--) {
+        table[static_cast<unsigned char>(digraphs[d - 1].first)].digraph = d;
+    }
+    return table;
+}
+constexpr auto symbol_table = build_symbol_table();
+
+
+// Brackets are matched as they are lexed, so the parser can jump straight from
+// one to the other. They don't span lines.
+void match_bracket(LexContext& context, char c) {
+    auto& tokens = context.tokens_out;
+    if (c == LEX_REFERENCE_BEGIN || c == LEX_ALIAS_BEGIN) {
+        context.open_brackets.push_back(tokens.size() - 1);
+
+    } else if ((c == LEX_REFERENCE_END || c == LEX_ALIAS_END) && !context.open_brackets.empty()) {
+        auto& open = tokens[context.open_brackets.back()];
+        bool matches = (c == LEX_REFERENCE_END)
+            ? (open.type == TOK_OPERATOR && open.sym == LEX_REFERENCE_BEGIN)
+            : (open.type == TOK_ALIAS_BEGIN);
+        if (matches) {
+            long distance = tokens.size() - 1 - context.open_brackets.back();
+            open.l_val = distance;
+            tokens.back().l_val = -distance;
+            context.open_brackets.pop_back();
+        }
+    }
+}
+
+
+FN( get_symbol ) {
+    auto c = static_cast<unsigned char>(line_in[pos]);
+    auto& lex = symbol_table[c];
+    Symbol sym = c;
+    TokenType type = lex.type;
+    uint8_t flags = lex.flags;
+    size_t width = 1;
+
+    // Digraphs take precedence over the single character.
+    if (lex.digraph && pos + 1 < line_in.size()) {
+        for (size_t d = lex.digraph - 1; d < digraph_count && digraphs[d].first == line_in[pos]; d++) {
+            if (digraphs[d].second == line_in[pos + 1]) {
+                sym = digraphs[d].sym;
+                type = digraphs[d].type;
+                flags = digraphs[d].flags;
+                width = 2;
+                break;
+            }
+        }
+    }
+
+    if (flags & SL_UNKNOWN) {
+        throw domain_error("Unknown symbol");
+    }
+    if (flags & SL_RAW) {
+        context.raw_level = pos;
+        return pos + width;
+    }
+    if (flags & SL_UNNAMED) {
+        sym = SYM_EMPTY;
+    }
+    bool targets_self = (flags & SL_CONTEXTUAL) && !(
+        pos > 0 && line_in[pos - 1] != LEX_SPACE && line_in[pos - 1] != LEX_ALIAS_BEGIN
+    );
+    TOK_ADD(type, sym, 0L, flags & SL_STATIC, targets_self, DEBUG_POS);
+    if (width == 1) {
+        match_bracket(context, c);
+    }
+    return pos + width;
 }
 
 
 void tokenize_line(
-    std::vector<Token>& tokens_out,
-     std::string line_in,
-     std::string filename,
-     int line_no
+    LexContext& context,
+    std::string_view line_in,
+    int line_no
 ) {
     size_t pos = 0;
+    context.open_brackets.clear();
 
     // Check scope. File scope is 0, global is -1.
-    while (pos < line_in.size() && line_in[pos] == LEX_SPACE) {
-        pos++;
-    }
+    pos = scan::spaces(line_in.data(), pos, line_in.size());
 
     // Don't duplicate scopes (caused by comment-only lines).
-    if (tokens_out.back().type != TOK_SCOPE || tokens_out.back().l_val != pos + 1) {
-        TOK_ADD(TOK_SCOPE, std::string(), pos + 1, 0.0, false, false, DEBUG_POS);
+    if (context.tokens_out.back().type != TOK_SCOPE || context.tokens_out.back().l_val != static_cast<int>(pos + 1)) {
+        TOK_ADD(TOK_SCOPE, SYM_EMPTY, pos + 1, false, false, DEBUG_POS);
     }
     
     try {
@@ -249,27 +342,27 @@ void tokenize_line(
 
             // Check for hexadecimal
             if (line_in[pos] == LEX_HEXADECIMAL) {
-                pos = get_hex(tokens_out, line_in, ARGS_POS);
+                pos = get_hex(context, line_in, ARGS_POS);
                 
             // Check for identifiers
-            } else if (isalpha(line_in[pos])) {
-                pos = get_identifier(tokens_out, line_in, ARGS_POS);
+            } else if (scan::is_alpha(line_in[pos])) {
+                pos = get_identifier(context, line_in, ARGS_POS);
 
             // Check for numbers
-            } else if (isdigit(line_in[pos]) || line_in[pos] == LEX_DECIMAL_POINT) {
-                pos = get_number(tokens_out, line_in, ARGS_POS);
+            } else if (scan::is_digit(line_in[pos]) || line_in[pos] == LEX_DECIMAL_POINT) {
+                pos = get_number(context, line_in, ARGS_POS);
 
             // Check for strings
             } else if (line_in[pos] == LEX_QUOTE || line_in[pos] == LEX_APOSTROPHE) {
-                pos = get_string(tokens_out, line_in, ARGS_POS);
+                pos = get_string(context, line_in, ARGS_POS);
 
             // Skips spaces
             } else if (line_in[pos] == LEX_SPACE) {
-                pos++;
+                pos = scan::spaces(line_in.data(), pos, line_in.size());
 
             // Check for implemented symbols.                    
             } else {
-                pos = get_symbol(tokens_out, line_in, ARGS_POS);
+                pos = get_symbol(context, line_in, ARGS_POS);
                 
             }
         }
@@ -279,53 +372,146 @@ void tokenize_line(
 }
 
 
-bool tokenize_stream(
-    std::vector<Token>& tokens_out,
-    std::istream& stream_in,
-     std::string filename
-) {
-    DEBUG ( "LEXING " << filename; )
-    bool success = true;
-    int line_no = 1;
+// Lines are split out of the file text without copying them.
+TokenStream::TokenStream(uint32_t file_id)
+  : text(source_file(file_id).text),
+    context { tokens, file_id } {
+    auto& filename = source_file(file_id).name;
+    TRACE( TRACE_LEXER, TRACE_SUMMARY, "LEXING " << filename; )
 
     // Enter file scope
-    TOK_ADD(TOK_SCOPE, filename, 0L, 0.0, true, false, filename, 0, 0);
-    for (std::string line; std::getline(stream_in, line); ) {
-        try {
-            if (!line.empty()) {
-                // Check for start of RAW LLVM IR code
-                if (raw_level >= 0) {
-                    // Check for end of RAW LLVM IR code
-                    if (line == LEX_RAW_END) {
-                        TOK_ADD(TOK_RAW, raw_code, 1, 0.0, false, false, filename, line_no, raw_level);
-                        raw_code = "";
-                        raw_level = -1;
-                    } else {
-                        raw_code += line + "\n";
-                    }
-
-                // Otherwise, process as scandi code
-                } else {
-                    tokenize_line(tokens_out, line, filename, line_no);
+    TOK_ADD(TOK_SCOPE, intern(filename), 0L, true, false, file_id, 0, 0);
+}
+
+
+bool TokenStream::lex_line() {
+    if (line_start >= text.size()) {
+        return false;
+    }
+    auto line_end = text.find('\n', line_start);
+    if (line_end == std::string_view::npos) {
+        line_end = text.size();
+    }
+    auto line = text.substr(line_start, line_end - line_start);
+    try {
+        if (!line.empty()) {
+            // Check for start of RAW LLVM IR code
+            if (context.raw_level >= 0) {
+                // Check for end of RAW LLVM IR code. The raw code is
+                // everything between the delimiting lines.
+                if (line == LEX_RAW_END) {
+                    auto raw_code = text.substr(raw_start, line_start - raw_start);
+                    TOK_ADD(TOK_RAW, intern_stable(raw_code), 1, false, false, context.file_id, line_no, context.raw_level);
+                    context.raw_level = -1;
+                }
+
+            // Otherwise, process as scandi code
+            } else {
+                tokenize_line(context, line, line_no);
+                if (context.raw_level >= 0) {
+                    raw_start = line_end + 1;
                 }
             }
-        } catch (domain_error& de) {
-            std::cerr << "LEXER: " << filename << "@" << line_no << ": " << de.what() << std::endl;
-            success = false;
         }
-        line_no++;
+    } catch (domain_error& de) {
+        if (!errors) {
+            trace_flush();
+        }
+        (errors ? *errors : std::cerr) << "LEXER: " << source_file(context.file_id).name << "@" << line_no << ": " << de.what() << std::endl;
+        success = false;
     }
-    
-    return success;
+    line_start = line_end + 1;
+    line_no++;
+    return true;
+}
+
+
+bool TokenStream::next_scope(Iterator& begin, Iterator& end) {
+    Stopwatch::Running running(lexing);
+
+    // Only the unfinished line after the last scope is kept.
+    tokens.erase(tokens.begin(), tokens.begin() + returned);
+    returned = 0;
+
+    // Named scopes (such as files!) don't end a scope, as they are scopes in
+    // their own right.
+    size_t scope_end = 1;
+    while (success) {
+        while (
+            scope_end < tokens.size()
+         && (tokens[scope_end].type != TOK_SCOPE || tokens[scope_end].sym != SYM_EMPTY)
+        ) {
+            scope_end++;
+        }
+        if (scope_end < tokens.size() || !lex_line()) {
+            break;
+        }
+    }
+    if (!success) {
+        finish();
+        return false;
+    }
+    if (tokens.empty()) {
+        return false;
+    }
+
+    returned = std::min(scope_end, tokens.size());
+    begin = tokens.cbegin();
+    end = begin + returned;
+    return true;
+}
+
+
+void TokenStream::finish() {
+    Stopwatch::Running running(lexing);
+    while (lex_line()) {
+    }
+}
+
+
+bool tokenize_source(
+    std::vector<Token>& tokens_out,
+    uint32_t file_id
+) {
+    TokenStream stream(file_id);
+    stream.finish();
+    tokens_out.insert(tokens_out.end(), stream.tokens.begin(), stream.tokens.end());
+    return !stream.failed();
+}
+
+
+bool tokenize_file(
+    std::vector<Token>& tokens_out,
+    const std::string& path,
+    const std::string& filename
+) {
+    uint32_t file_id;
+    try {
+        file_id = open_source_file(path, filename);
+    } catch (domain_error& de) {
+        trace_flush();
+        std::cerr << "LEXER: " << de.what() << std::endl;
+        return false;
+    }
+    return tokenize_source(tokens_out, file_id);
+}
+
+
+bool tokenize_stream(
+    std::vector<Token>& tokens_out,
+    std::istream& stream_in,
+    const std::string& filename
+) {
+    return tokenize_source(tokens_out, open_source_stream(stream_in, filename));
 }
 
 
-std::ostream& operator<<(std::ostream& o,  Token& t) {
+std::ostream& operator<<(std::ostream& o,  const Token& t) {
     if (t.type == TOK_RAW) {
         o << std::endl << std::string(t.pos, ' ') << "RAW_BLOCK" << std::endl;
     } else if (t.type == TOK_SCOPE) {
-        if (!t.s_val.empty()) {
-            o << std::endl << t.s_val;
+        if (t.sym != SYM_EMPTY) {
+            o << std::endl << t.text();
         } else {
             o << std::endl << std::string(t.pos, ' ');
         }
@@ -339,16 +525,16 @@ std::ostream& operator<<(std::ostream& o,  Token& t) {
             case TOK_BINARY:
             case TOK_STRING:
             case TOK_OPERATOR:
-                o << t.s_val;
+                o << t.text();
                 break;
 
             default:
-                if (t.s_val == std::string(1, LEX_DECIMAL_POINT)) {
+                if (t.sym == LEX_DECIMAL_POINT) {
                     o << t.d_val;
-                } else if (t.s_val.empty()) {
+                } else if (t.sym == SYM_EMPTY) {
                     o << t.l_val;
                 } else {
-                    o << t.s_val;
+                    o << t.text();
                 }
                 break;
         }
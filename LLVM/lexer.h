@@ -5,9 +5,13 @@
 // License: GPL 3.0
 
 #pragma once
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
+#include "symbols.h"
+#include "timing.h"
 
 
 #define LEX_SPACE             ' '
@@ -63,7 +67,7 @@
 #define LEX_ELSE              ':'
 
 
-enum TokenType {
+enum TokenType : uint8_t {
     TOK_SCOPE             = 'S',  // Spaces at the start of a line.
     TOK_LABEL             = 'L',  // \.
     TOK_VARIABLE          = 'V',  // $
@@ -79,76 +83,134 @@ enum TokenType {
 };
 
 
+// Tokens are kept small enough that a whole file's worth stays in cache: all
+// text is interned, and only the location is kept for debugging.
 class Token {
     public:
         // Lexer information
         TokenType type;
-        std::string s_val;
-        int l_val;
-        double d_val;
-        bool is_static;
-        bool targets_self;
-        
+        uint8_t is_static : 1;
+        uint8_t targets_self : 1;
+        uint16_t file_id;
+        Symbol sym;
+        union {
+            long l_val;               // For brackets, the distance to the matching
+            double d_val;             // bracket, or 0 if there is none.
+        };
+
         // Debug information
-        std::string filename;
-        int line_no;
-        size_t pos;
-    
+        uint32_t line_no;
+        uint32_t pos;
+
         Token(
             TokenType type,
-            std::string s_val,
+            Symbol sym,
             long l_val,
-            double d_val,
             bool is_static,
             bool targets_self,
-            std::string filename,
+            uint16_t file_id,
             int line_no,
             size_t pos
         ) :
             type(type),
-            s_val(s_val),
-            l_val(l_val),
-            d_val(d_val),
             is_static(is_static),
             targets_self(targets_self),
-            filename(filename),
+            file_id(file_id),
+            sym(sym),
+            l_val(l_val),
             line_no(line_no),
             pos(pos)
         {}
 
+         bool is_assignment() const;
+         bool is_conditional() const;
 
-        Token(
-            TokenType type,
-            char s_val,
-            long l_val,
-            double d_val,
-            bool is_static,
-            bool targets_self,
-            std::string filename,
-            int line_no,
-            size_t pos
-        ) :
-            type(type),
-            s_val(std::string(1, s_val)),
-            l_val(l_val),
-            d_val(d_val),
-            is_static(is_static),
-            targets_self(targets_self),
-            filename(filename),
-            line_no(line_no),
-            pos(pos)
-        {}
+         std::string_view text() const { return symbol_name(sym); }
+
+         // The name of the file this token was lexed from.
+         const std::string& filename() const;
+
+};
+static_assert(sizeof(Token) == 24, "Token should stay compact");
 
 
-         bool is_assignment() ;
-         bool is_conditional() ;
+std::ostream& operator<<(std::ostream&,  const Token& token);
 
+
+// Lexer state for a single source, so that sources can be lexed concurrently.
+struct LexContext {
+    std::vector<Token>& tokens_out;
+    uint32_t file_id;
+    int raw_level = -1;         // Column of an open raw code block, or -1.
+    std::vector<size_t> open_brackets;  // Unmatched [ and { on this line.
 };
-std::ostream& operator<<(std::ostream&,  Token& token);
+
+
+// Lexes a source, already opened with open_source_file, a line at a time as
+// the parser asks for it, so a file's tokens are never all held at once.
+class TokenStream {
+    public:
+        typedef std::vector<Token>::const_iterator Iterator;
+
+        TokenStream(uint32_t file_id);
+
+        TokenStream(const TokenStream&) = delete;
+        TokenStream& operator=(const TokenStream&) = delete;
+
+        // Lexes just far enough to find the next scope line: a scope token and
+        // everything up to the next unnamed one. The range stays valid until
+        // the following call. Returns false at the end of the source, or once
+        // a lexing error has been reported.
+        bool next_scope(Iterator& begin, Iterator& end);
+
+        // Lexes whatever is left, so that every error in the source is
+        // reported. Tokens lexed this way are kept in tokens.
+        void finish();
+
+        bool failed() const { return !success; }
+
+        std::vector<Token> tokens;
+
+        // If set, times the lexing, apart from whatever is done with the
+        // tokens between scopes.
+        Stopwatch* lexing = nullptr;
+
+        // If set, errors are written here rather than to cerr, so that files
+        // lexed at once can have theirs printed in order.
+        std::ostream* errors = nullptr;
+
+    private:
+        std::string_view text;
+        LexContext context;
+        size_t line_start = 0;
+        size_t raw_start = 0;
+        size_t returned = 0;
+        int line_no = 1;
+        bool success = true;
+
+        // Lexes the next line onto tokens. Returns false at the end of the
+        // source.
+        bool lex_line();
+};
+
+
+// Lexes a whole source file, already opened with open_source_file, in place.
+bool tokenize_source(
+    std::vector<Token>& tokens_out,
+    uint32_t file_id
+);
+
+
+// Memory-maps the file at path and lexes it in place.
+bool tokenize_file(
+    std::vector<Token>& tokens_out,
+    const std::string& path,
+    const std::string& filename
+);
 
 
 bool tokenize_stream(
     std::vector<Token>& tokens_out,
     std::istream& stream_in,
-     std::string filename
+    const std::string& filename
 );
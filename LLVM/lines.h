@@ -0,0 +1,431 @@
+// Scandi: lines.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <memory>
+#include "ast.h"
+#include "codegen.h"
+#include "globals.h"
+
+
+/*
+ *  Following a line, as codegen, the bytecode backend, folding, finding loops
+ *  and type inference all do. What each item of a line does to the operands
+ *  is decided here, once, so that they all agree:
+ *
+ *  - Each operand is read when the next is pushed, or a call is made, so
+ *    only the top one is ever left to read. That is what lets = store to it.
+ *  - A line's target, the first operand of one that ends in =, is only read
+ *    if it is taken, and calls don't take it.
+ *  - = copies a value back to the variable it was read from.
+ *  - A field's container is read when the field is made, before its key.
+ *
+ *  Each pass keeps what it needs of an operand in Payload, and is told what
+ *  happens to them through a LinePass.
+ */
+
+template <typename Payload>
+struct Operand : Payload {
+    enum Kind {
+        VALUE,                        // decl, or name, if it was read from that variable.
+        VARIABLE,                     // decl, or name if it is only known at runtime.
+        FIELD,                        // container, if it is a target's, to store back to.
+        RESULT,                       // What decl, the function being followed, returns.
+        DECLARATION                   // A scope, for . to find members in.
+    };
+    Kind kind;
+    AST* decl = nullptr;
+    AST* read = nullptr;              // The identifier that named it.
+    string name;
+    std::shared_ptr<Operand> container;
+
+    Operand(Kind kind = VALUE) : kind(kind) {}
+};
+
+
+struct NoPayload {};
+
+
+// What a pass does as lines are followed. Each does nothing here, so a pass
+// only gives those it needs, along with Item, its Operand. Operands given to
+// call, operate, complement and count, and the value given to assign, have
+// been read.
+struct LinePass {
+    AST* owner = nullptr;             // The function being followed, or null for main.
+    bool in_alias = false;            // In an alias's code, which its uses share.
+
+    bool reached() { return true; }   // Whether to go on with the line.
+    void begin_chain(AST*) {}
+    void end_chain(AST*) {}
+    void identifier(AST*) {}          // As it is reached, before it is resolved.
+    void dot(AST* dot) {}
+    template <typename Item> void read(Item&) {}  // A variable, field or result.
+    template <typename Item> void constant(AST*, Item&) {}
+    template <typename Item> void field(Item& container, bool is_target, Item& field) {}
+    template <typename Item> void context_field(Item& field) {}  // Of the local context.
+    template <typename Item> void name_key(AST* member, Item& field) {}
+    template <typename Item> void key(AST* reference, vector<Item>& key, Item& field) {}
+    template <typename Item> void call(AST* function, vector<Item>& args, Item& result) {}
+    void jump(AST* label, AST* read) {}
+    template <typename Item> void assign(AST* op, Item& target, Item& value) {}
+    template <typename Item> void operate(AST* op, int64_t operation, Item& a, Item& b, Item& result) {}
+    template <typename Item> void complement(AST* op, Item& a, Item& result) {}
+    template <typename Item> void count(AST* op, Item* a, Item& result) {}  // Of the arguments, without a.
+};
+
+
+// The variable that assigning to target stores to, if any, through any
+// fields of it.
+template <typename Item>
+AST* stored_variable(const Item& target) {
+    auto at = &target;
+    while (at->kind == Item::FIELD && at->container) {
+        at = at->container.get();
+    }
+    return at->kind == Item::VALUE || at->kind == Item::VARIABLE ? at->decl : nullptr;
+}
+
+
+/*
+ *  Operands.
+ */
+
+template <typename Pass>
+void read_operand(typename Pass::Item& operand, Pass& pass) {
+    typedef typename Pass::Item Item;
+    if (operand.kind == Item::VALUE) {
+        return;
+    }
+    if (operand.kind == Item::DECLARATION) {
+        DERR("Not a value: " + operand.decl->name);
+    }
+    pass.read(operand);
+    if (operand.kind != Item::VARIABLE) {
+        operand.decl = nullptr;
+        operand.name.clear();
+    }
+    operand.kind = Item::VALUE;
+    operand.container.reset();
+}
+
+
+// Before another operand is pushed, the top one is read. A line's target is
+// left, at the bottom, as are scopes.
+template <typename Pass>
+void settle(vector<typename Pass::Item>& stack, size_t kept, Pass& pass) {
+    if (!stack.empty() && !(kept > 0 && stack.size() == 1) && stack.back().kind != Pass::Item::DECLARATION) {
+        read_operand(stack.back(), pass);
+    }
+}
+
+
+// The top count operands, for an operator or call to take.
+template <typename Pass>
+vector<typename Pass::Item> take(vector<typename Pass::Item>& stack, size_t count, Pass& pass) {
+    typedef typename Pass::Item Item;
+    if (count == 0) {
+        return {};
+    }
+    read_operand(stack.back(), pass);
+    for (auto i = stack.size() - count; i < stack.size(); i++) {
+        if (stack[i].kind == Item::DECLARATION) {
+            DERR("Not a value: " + stack[i].decl->name);
+        } else if (stack[i].kind != Item::VALUE) {
+            DERR("Not yet implemented: using the target of an assignment as a value");
+        }
+    }
+    vector<Item> taken(stack.end() - count, stack.end());
+    stack.resize(stack.size() - count);
+    return taken;
+}
+
+
+template <typename Item>
+Item pop(vector<Item>& stack) {
+    auto top = stack.back();
+    stack.pop_back();
+    return top;
+}
+
+
+// A field of container, which is read now. A target's container is kept, to
+// store the field back to.
+template <typename Pass>
+typename Pass::Item field_of(typename Pass::Item& container, bool is_target, Pass& pass) {
+    typedef typename Pass::Item Item;
+    if (container.kind == Item::DECLARATION) {
+        DERR("Not a value: " + container.decl->name);
+    }
+    Item field { Item::FIELD };
+    pass.field(container, is_target, field);
+    if (is_target && (container.kind == Item::VARIABLE || container.kind == Item::FIELD)) {
+        field.container = std::make_shared<Item>(container);
+    }
+    return field;
+}
+
+
+/*
+ *  Items.
+ */
+
+template <typename Pass>
+void follow_chain(AST* first, vector<typename Pass::Item>& stack, size_t kept, Pass& pass);
+
+
+template <typename Pass>
+void follow_call(AST* function, vector<typename Pass::Item>& stack, size_t kept, Pass& pass) {
+    auto taken = arguments_taken(function, stack.size(), kept);
+    if (taken == 0) {
+        settle(stack, kept, pass);
+    }
+    auto args = take(stack, taken, pass);
+    typename Pass::Item result;
+    pass.call(function, args, result);
+    stack.push_back(result);
+}
+
+
+// is_target is whether it is pushed as a line's target, which for its own
+// function, is its result. read is the identifier that named it.
+template <typename Pass>
+void follow_declaration(AST* decl, vector<typename Pass::Item>& stack, size_t kept, bool is_target, AST* read, Pass& pass) {
+    typedef typename Pass::Item Item;
+    switch (decl->type) {
+        case AST_VARIABLE: {
+            settle(stack, kept, pass);
+            Item variable { Item::VARIABLE };
+            variable.decl = decl;
+            variable.read = read;
+            stack.push_back(variable);
+            return;
+        }
+        case AST_FUNCTION:
+            if (is_target && decl == pass.owner) {
+                settle(stack, kept, pass);
+                Item result { Item::RESULT };
+                result.decl = decl;
+                stack.push_back(result);
+            } else {
+                follow_call(decl, stack, kept, pass);
+            }
+            return;
+        case AST_LABEL:
+            if (owning_function(decl) != pass.owner) {
+                DERR("Can't jump to " + decl->name + " from another function");
+            }
+            pass.jump(decl, read);
+            return;
+        case AST_SCOPE: {
+            settle(stack, kept, pass);
+            Item scope { Item::DECLARATION };
+            scope.decl = decl;
+            stack.push_back(scope);
+            return;
+        }
+        case AST_ALIAS:
+            if (auto target = resolve_alias(decl)) {
+                follow_declaration(target, stack, kept, is_target, read, pass);
+            } else {
+                auto in_alias = pass.in_alias;
+                pass.in_alias = true;
+                follow_chain(decl->next, stack, kept, pass);
+                pass.in_alias = in_alias;
+            }
+            return;
+        default:
+            DERR("Unknown declaration. This is probably a bug.");
+    }
+}
+
+
+// Members of scopes and classes are found now. Anything else is a field. The
+// local context's members are its variables, which have slots.
+template <typename Pass>
+void follow_dot(AST* dot, vector<typename Pass::Item>& stack, size_t kept, Pass& pass) {
+    typedef typename Pass::Item Item;
+    auto member = dot->next;
+    if (!member || member->type != AST_IDENTIFIER) {
+        DERR("Consecutive DOT operators detected. DOT operators must be followed by an identifier.");
+    }
+    pass.dot(dot);
+
+    if (dot->get_property(AST::OPT_TARGETS_SELF) || stack.empty()) {
+        auto scope = pass.owner;
+        if (!scope) {
+            for (scope = member; scope->parent; scope = scope->parent);
+        }
+        if (scope->has_member(member->sym) && scope->get_member(member->sym)->type == AST_VARIABLE) {
+            follow_declaration(scope->get_member(member->sym), stack, kept, false, member, pass);
+        } else {
+            settle(stack, kept, pass);
+            Item field { Item::FIELD };
+            pass.context_field(field);
+            pass.name_key(member, field);
+            stack.push_back(field);
+        }
+        return;
+    }
+
+    auto container = pop(stack);
+    auto is_target = kept > 0 && stack.empty();
+    AST* scope = nullptr;
+    if (container.kind == Item::DECLARATION || (container.kind == Item::VARIABLE && container.decl && !container.decl->children.empty())) {
+        scope = container.decl;
+    }
+    if (scope && scope->has_member(member->sym)) {
+        follow_declaration(scope->get_member(member->sym), stack, kept, is_target, member, pass);
+    } else if (container.kind == Item::DECLARATION) {
+        Item variable { Item::VARIABLE };
+        variable.name = qualified_name(scope) + "." + member->name;
+        stack.push_back(variable);
+    } else {
+        auto field = field_of(container, is_target, pass);
+        pass.name_key(member, field);
+        stack.push_back(field);
+    }
+}
+
+
+// The key is the last operand of its expression.
+template <typename Pass>
+void follow_reference(AST* reference, vector<typename Pass::Item>& stack, size_t kept, Pass& pass) {
+    typedef typename Pass::Item Item;
+    Item field { Item::FIELD };
+    if (reference->get_property(AST::OPT_TARGETS_SELF) || stack.empty()) {
+        settle(stack, kept, pass);
+        pass.context_field(field);
+    } else {
+        auto container = pop(stack);
+        field = field_of(container, kept > 0 && stack.empty(), pass);
+    }
+    vector<Item> key;
+    if (reference->alt) {
+        follow_chain(reference->alt->next, key, 0, pass);
+    }
+    if (!key.empty()) {
+        read_operand(key.back(), pass);
+    }
+    pass.key(reference, key, field);
+    stack.push_back(field);
+}
+
+
+template <typename Pass>
+void follow_operator(AST* op, vector<typename Pass::Item>& stack, size_t kept, Pass& pass) {
+    typedef typename Pass::Item Item;
+    Item result;
+    if (op->name == CHAR_STR(LEX_ASSIGNMENT)) {
+        if (stack.size() < 2) {
+            DERR("Nothing to assign to");
+        }
+        auto value = take(stack, 1, pass);
+        auto target = pop(stack);
+        if (target.kind == Item::DECLARATION || (target.kind == Item::VALUE && !target.decl && target.name.empty())) {
+            DERR("Can't assign to a value");
+        }
+        pass.assign(op, target, value[0]);
+        return;
+
+    } else if (op->name == CHAR_STR(LEX_COUNT)) {
+        // Without an operand, counts the arguments in the local context.
+        if (op->get_property(AST::OPT_TARGETS_SELF) || stack.empty()) {
+            settle(stack, kept, pass);
+            pass.count(op, static_cast<Item*>(nullptr), result);
+        } else {
+            auto a = take(stack, 1, pass);
+            pass.count(op, &a[0], result);
+        }
+
+    } else if (op->name == CHAR_STR(LEX_COMPLEMENT)) {
+        if (stack.empty()) {
+            DERR("Operator " + op->name + " needs an operand");
+        }
+        auto a = take(stack, 1, pass);
+        pass.complement(op, a[0], result);
+
+    } else {
+        auto operation = operation_of(op->name);
+        if (operation < 0) {
+            DERR("Not yet implemented: OP " + op->name);
+        }
+        if (stack.size() < 2) {
+            DERR("Operator " + op->name + " needs two operands");
+        }
+        auto taken = take(stack, 2, pass);
+        pass.operate(op, operation, taken[0], taken[1], result);
+    }
+    stack.push_back(result);
+}
+
+
+template <typename Pass>
+void follow_chain(AST* first, vector<typename Pass::Item>& stack, size_t kept, Pass& pass) {
+    typedef typename Pass::Item Item;
+    if (!first) {
+        return;
+    }
+    pass.begin_chain(first);
+    for (auto current = first; current && pass.reached(); current = current->next) {
+        switch (current->type) {
+            case AST_EXPRESSION:
+                if (current->alt) {
+                    follow_chain(current->alt->type == AST_EXPRESSION ? current->alt->next : current->alt, stack, kept, pass);
+                }
+                break;
+            case AST_IDENTIFIER:
+                pass.identifier(current);
+                if (current->alt) {
+                    follow_declaration(current->alt, stack, kept, kept > 0 && stack.empty(), current, pass);
+                } else {
+                    // Not found, so it is looked for at runtime.
+                    settle(stack, kept, pass);
+                    Item variable { Item::VARIABLE };
+                    variable.name = current->name;
+                    variable.read = current;
+                    stack.push_back(variable);
+                }
+                break;
+            case AST_BINARY:
+            case AST_STRING:
+            case AST_LONG:
+            case AST_DOUBLE:
+            case AST_NULL: {
+                settle(stack, kept, pass);
+                Item constant;
+                pass.constant(current, constant);
+                stack.push_back(constant);
+                break;
+            }
+            case AST_REFERENCE:
+                follow_reference(current, stack, kept, pass);
+                break;
+            case AST_OPERATOR:
+                if (current->name == CHAR_STR(LEX_DOT)) {
+                    follow_dot(current, stack, kept, pass);
+                    current = current->next;
+                } else {
+                    follow_operator(current, stack, kept, pass);
+                }
+                break;
+            default:
+                DERR("Unknown EXPRESSION. This is probably a bug.");
+        }
+    }
+    pass.end_chain(first);
+}
+
+
+// A line, whose first operand is its target if it ends in =. Conditionals'
+// are followed with follow_chain, as they are tested instead.
+template <typename Pass>
+void follow_line(AST* line, Pass& pass) {
+    auto first = line->type == AST_EXPRESSION ? line->next : line;
+    vector<typename Pass::Item> stack;
+    if (first) {
+        follow_chain(first, stack, ends_in_assignment(first) ? 1 : 0, pass);
+    }
+}
@@ -0,0 +1,486 @@
+// Scandi: loops.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include "codegen.h"
+#include "globals.h"
+#include "lines.h"
+#include "loops.h"
+
+
+/*
+ *  Each function's graph is built as codegen generates its blocks: a label
+ *  starts a block, a jump ends one, and each branch of a conditional is one,
+ *  meeting in a block after it. Code after a jump is in a block that nothing
+ *  reaches. Main is a function like any other, of the lines outside them.
+ */
+
+#define ENTRY       0
+#define EXIT        1
+#define NONE        SIZE_MAX
+
+
+struct Block {
+    AST* label = nullptr;             // If it starts at one.
+    vector<AST*> lines;
+    vector<size_t> successors;
+    vector<size_t> predecessors;
+    AST* test = nullptr;              // The conditional it ends in, if any.
+    size_t when_holds = NONE;
+    vector<AST*> stored;              // The variables its lines store to, once a store.
+    bool stores_by_name = false;      // To a variable only named at runtime.
+    bool calls_out = false;           // Whether it calls a function of the program.
+};
+
+
+struct Edge {
+    size_t from;
+    size_t to;
+    AST* jump;                        // The identifier, if it is a jump.
+};
+
+
+// Lines are followed by lines.h, for the function in owner.
+struct Graph : LinePass {
+    typedef Operand<NoPayload> Item;
+
+    vector<Block> blocks;
+    vector<Edge> edges;
+    std::unordered_map<AST*, size_t> labels;
+    vector<AST*> functions;           // Within it, which have graphs of their own.
+    size_t current = ENTRY;
+
+    void call(AST* function, vector<Item>& args, Item& result);
+    void jump(AST* label, AST* read);
+    void assign(AST* op, Item& target, Item& value);
+};
+
+
+size_t add_block(Graph& g) {
+    g.blocks.emplace_back();
+    return g.blocks.size() - 1;
+}
+
+
+void add_edge(Graph& g, size_t from, size_t to, AST* jump = nullptr) {
+    g.blocks[from].successors.push_back(to);
+    g.blocks[to].predecessors.push_back(from);
+    g.edges.push_back({ from, to, jump });
+}
+
+
+size_t block_of_label(Graph& g, AST* label) {
+    auto found = g.labels.find(label);
+    if (found != g.labels.end()) {
+        return found->second;
+    }
+    auto block = add_block(g);
+    g.blocks[block].label = label;
+    g.labels.emplace(label, block);
+    return block;
+}
+
+
+void add_jump(Graph& g, size_t to, AST* jump) {
+    add_edge(g, g.current, to, jump);
+    g.current = add_block(g);
+}
+
+
+void continue_into(Graph& g, size_t block) {
+    add_edge(g, g.current, block);
+    g.current = block;
+}
+
+
+// A line jumps wherever it names a label, and to the function's exit when it
+// assigns the function's result. Jumps in an alias's code are in every line
+// that uses it, so aren't given as the line's own.
+void Graph::jump(AST* label, AST* read) {
+    add_jump(*this, block_of_label(*this, label), in_alias ? nullptr : read);
+}
+
+
+// A function of the program could assign to any global.
+void Graph::call(AST* function, vector<Item>& args, Item& result) {
+    if (!has_raw(function)) {
+        blocks[current].calls_out = true;
+    }
+}
+
+
+void Graph::assign(AST* op, Item& target, Item& value) {
+    auto decl = stored_variable(target);
+    if (decl) {
+        blocks[current].stored.push_back(decl);
+    } else if (target.kind == Item::VARIABLE && !target.name.empty()) {
+        blocks[current].stores_by_name = true;
+    }
+    if (target.kind == Item::RESULT) {
+        add_jump(*this, EXIT, nullptr);
+    }
+}
+
+
+void build_graph(AST* ast, Graph& g) {
+    switch (ast->type) {
+        case AST_SCOPE:
+        case AST_VARIABLE:
+            break;
+        case AST_RAW:
+        case AST_ALIAS:
+            return;
+        case AST_FUNCTION:
+            g.functions.push_back(ast);
+            return;
+        case AST_LABEL:
+            continue_into(g, block_of_label(g, ast));
+            break;
+        case AST_CONDITIONAL: {
+            vector<Graph::Item> stack;
+            follow_chain(ast->next, stack, 0, g);
+            auto test = g.current;
+            g.blocks[test].lines.push_back(ast);
+            auto when_holds = add_block(g);
+            auto otherwise = ast->alt ? add_block(g) : NONE;
+            auto after = add_block(g);
+            g.blocks[test].test = ast;
+            g.blocks[test].when_holds = when_holds;
+            add_edge(g, test, when_holds);
+            add_edge(g, test, ast->alt ? otherwise : after);
+            g.current = when_holds;
+            for (auto c: ast->children) {
+                build_graph(c, g);
+            }
+            continue_into(g, after);
+            if (ast->alt) {
+                g.current = otherwise;
+                for (auto c: ast->alt->children) {
+                    build_graph(c, g);
+                }
+                continue_into(g, after);
+            }
+            return;
+        }
+        default:
+            g.blocks[g.current].lines.push_back(ast);
+            follow_line(ast, g);
+            break;
+    }
+    for (auto c: ast->children) {
+        build_graph(c, g);
+    }
+}
+
+
+/*
+ *  Dominators, by Cooper, Harvey and Kennedy's iteration in reverse
+ *  postorder. Blocks that nothing reaches have none.
+ */
+
+vector<size_t> find_dominators(const Graph& g) {
+    auto size = g.blocks.size();
+    vector<size_t> postorder;
+    vector<bool> seen(size);
+    vector<std::pair<size_t, size_t>> walk { { ENTRY, 0 } };
+    seen[ENTRY] = true;
+    while (!walk.empty()) {
+        auto block = walk.back().first;
+        auto next = walk.back().second++;
+        if (next < g.blocks[block].successors.size()) {
+            auto s = g.blocks[block].successors[next];
+            if (!seen[s]) {
+                seen[s] = true;
+                walk.push_back({ s, 0 });
+            }
+        } else {
+            postorder.push_back(block);
+            walk.pop_back();
+        }
+    }
+
+    vector<size_t> position(size, NONE);
+    for (size_t i = 0; i < postorder.size(); i++) {
+        position[postorder[i]] = i;
+    }
+    vector<size_t> idom(size, NONE);
+    idom[ENTRY] = ENTRY;
+    auto intersect = [&](size_t a, size_t b) {
+        while (a != b) {
+            while (position[a] < position[b]) {
+                a = idom[a];
+            }
+            while (position[b] < position[a]) {
+                b = idom[b];
+            }
+        }
+        return a;
+    };
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (auto i = postorder.rbegin(); i != postorder.rend(); i++) {
+            if (*i == ENTRY) {
+                continue;
+            }
+            auto best = NONE;
+            for (auto p: g.blocks[*i].predecessors) {
+                if (idom[p] != NONE) {
+                    best = best == NONE ? p : intersect(p, best);
+                }
+            }
+            if (best != idom[*i]) {
+                idom[*i] = best;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+
+bool dominates(size_t a, size_t b, const vector<size_t>& idom) {
+    if (idom[b] == NONE) {
+        return false;
+    }
+    while (b != a && b != ENTRY) {
+        b = idom[b];
+    }
+    return b == a;
+}
+
+
+/*
+ *  Loops. Each jump to a label that dominates it is a jump back, and the
+ *  loop is the label and whatever reaches the jump without passing it.
+ */
+
+struct Found {
+    Loop* loop;
+    size_t header;
+    vector<bool> body;                // By block.
+    vector<size_t> latches;           // The blocks that jump back.
+};
+
+
+// How many times the loop's lines store to the variable, wherever on them,
+// or -1 if a store by name, or a function it calls, could too.
+int stores_in(AST* variable, const Found& found, const Graph& g) {
+    int stores = 0;
+    bool unknown = false;
+    for (size_t b = 0; b < g.blocks.size(); b++) {
+        if (found.body[b]) {
+            auto& block = g.blocks[b];
+            stores += std::count(block.stored.begin(), block.stored.end(), variable);
+            unknown |= block.stores_by_name || (is_global(variable) && block.calls_out);
+        }
+    }
+    return unknown ? -1 : stores;
+}
+
+
+bool is_each_time(size_t block, const Found& found, const vector<size_t>& idom) {
+    return std::all_of(found.latches.begin(), found.latches.end(), [&](size_t l) { return dominates(block, l, idom); });
+}
+
+
+// x x c + =, as auto-assignment makes x c +, or the same with -.
+bool is_step(AST* line, AST*& variable, int64_t& step) {
+    if (line->type != AST_EXPRESSION || !line->next) {
+        return false;
+    }
+    auto x = line->next;
+    auto read = x->next;
+    auto by = read ? read->next : nullptr;
+    auto op = by ? by->next : nullptr;
+    auto assign = op ? op->next : nullptr;
+    if (
+        !assign || assign->next || x->type != AST_IDENTIFIER || !x->alt || x->alt->type != AST_VARIABLE
+     || read->type != AST_IDENTIFIER || read->alt != x->alt || by->type != AST_LONG
+     || op->type != AST_OPERATOR || (op->name != CHAR_STR(LEX_ADD) && op->name != CHAR_STR(LEX_SUB))
+     || assign->type != AST_OPERATOR || assign->name != CHAR_STR(LEX_ASSIGNMENT)
+    ) {
+        return false;
+    }
+    variable = x->alt;
+    step = op->name == CHAR_STR(LEX_ADD) ? by->numeric_value.l : -by->numeric_value.l;
+    return true;
+}
+
+
+// Steps that happen once each time round: those in blocks that every jump
+// back passes through, of variables nothing else in the loop assigns.
+void find_inductions(Found& found, const Graph& g, const vector<size_t>& idom) {
+    auto& loop = *found.loop;
+    for (size_t b = 0; b < g.blocks.size(); b++) {
+        if (!found.body[b] || !is_each_time(b, found, idom)) {
+            continue;
+        }
+        for (auto line: g.blocks[b].lines) {
+            AST* variable;
+            int64_t step;
+            if (is_step(line, variable, step) && stores_in(variable, found, g) == 1) {
+                loop.inductions.push_back({ variable, step, line });
+            }
+        }
+    }
+}
+
+
+// The induction variable a test reads, if any. Where it is tested against
+// one other operand, that is its bound, if it is a long or a variable the
+// loop doesn't store to.
+void find_tested(LoopExit& exit, const Found& found, const Graph& g) {
+    for (auto c = exit.test->next; c && !exit.induction; c = c->next) {
+        for (auto& induction: found.loop->inductions) {
+            if (c->type == AST_IDENTIFIER && c->alt == induction.variable) {
+                exit.induction = induction.variable;
+            }
+        }
+    }
+    auto a = exit.test->next;
+    auto b = a ? a->next : nullptr;
+    if (!exit.induction || !b || b->next) {
+        return;
+    }
+    auto other = a->alt == exit.induction ? b : a;
+    if (
+        other->type == AST_LONG
+     || (other->type == AST_IDENTIFIER && other->alt && other->alt->type == AST_VARIABLE && stores_in(other->alt, found, g) == 0)
+    ) {
+        exit.bound = other;
+    }
+}
+
+
+void find_exits(Found& found, const Graph& g, const vector<size_t>& idom) {
+    auto& loop = *found.loop;
+    for (size_t b = 0; b < g.blocks.size(); b++) {
+        if (!found.body[b]) {
+            continue;
+        }
+        auto& block = g.blocks[b];
+        for (auto s: block.successors) {
+            if (found.body[s]) {
+                continue;
+            }
+            LoopExit exit { block.test, !block.test || s == block.when_holds };
+            if (block.test) {
+                exit.each_time = is_each_time(b, found, idom);
+                find_tested(exit, found, g);
+            }
+            loop.exits.push_back(exit);
+        }
+    }
+}
+
+
+void trace_loop(const Loop& loop) {
+    TRACE( TRACE_SEMANTICS, TRACE_DETAIL,
+        "LOOP " << loop.header->name << " AT DEPTH " << loop.depth << ", " << loop.lines.size() << " LINES, "
+        << loop.latches.size() << " JUMPS BACK";
+    )
+    for (auto& induction: loop.inductions) {
+        TRACE( TRACE_SEMANTICS, TRACE_DETAIL, "  INDUCTION " << induction.variable->name << " STEP " << induction.step; )
+    }
+    for (auto& exit: loop.exits) {
+        TRACE( TRACE_SEMANTICS, TRACE_DETAIL,
+            "  EXIT " << (exit.test ? "WHEN " + exit.test->name + (exit.when_holds ? " HOLDS" : " FAILS") : string("BY JUMP"))
+            << (exit.induction ? " ON " + exit.induction->name : string())
+            << (exit.bound ? " AGAINST " + exit.bound->shorthand() : string())
+            << (exit.each_time ? " EACH TIME" : "");
+        )
+    }
+}
+
+
+void find_graph_loops(Graph& g) {
+    auto idom = find_dominators(g);
+    vector<Found> found;
+    for (auto& edge: g.edges) {
+        if (!g.blocks[edge.to].label || !dominates(edge.to, edge.from, idom)) {
+            continue;
+        }
+        auto same = std::find_if(found.begin(), found.end(), [&](const Found& f) { return f.header == edge.to; });
+        if (same == found.end()) {
+            auto loop = ast_arena().make<Loop>();
+            loop->header = g.blocks[edge.to].label;
+            found.push_back({ loop, edge.to, vector<bool>(g.blocks.size()) });
+            same = found.end() - 1;
+            same->body[edge.to] = true;
+        }
+        if (edge.jump) {
+            same->loop->latches.push_back(edge.jump);
+        }
+        same->latches.push_back(edge.from);
+
+        // Everything that reaches the jump without passing the label.
+        vector<size_t> work { edge.from };
+        while (!work.empty()) {
+            auto b = work.back();
+            work.pop_back();
+            if (same->body[b]) {
+                continue;
+            }
+            same->body[b] = true;
+            for (auto p: g.blocks[b].predecessors) {
+                work.push_back(p);
+            }
+        }
+    }
+
+    for (auto& f: found) {
+        for (size_t b = 0; b < g.blocks.size(); b++) {
+            if (f.body[b]) {
+                f.loop->lines.insert(f.loop->lines.end(), g.blocks[b].lines.begin(), g.blocks[b].lines.end());
+            }
+        }
+        // The innermost loop that holds it is its parent.
+        size_t smallest = SIZE_MAX;
+        for (auto& outer: found) {
+            auto size = std::count(outer.body.begin(), outer.body.end(), true);
+            if (&outer != &f && outer.body[f.header] && static_cast<size_t>(size) < smallest) {
+                smallest = size;
+                f.loop->parent = outer.loop;
+            }
+        }
+    }
+    for (auto& f: found) {
+        for (auto p = f.loop->parent; p; p = p->parent) {
+            f.loop->depth++;
+        }
+        find_inductions(f, g, idom);
+        find_exits(f, g, idom);
+        f.loop->header->loop = f.loop;
+        for (auto jump: f.loop->latches) {
+            jump->loop = f.loop;
+        }
+        trace_loop(*f.loop);
+    }
+}
+
+
+void find_function_loops(AST* owner, AST* body) {
+    Graph g;
+    g.owner = owner;
+    add_block(g);
+    add_block(g);
+    for (auto c: body->children) {
+        build_graph(c, g);
+    }
+    add_edge(g, g.current, EXIT);
+    find_graph_loops(g);
+    for (auto f: g.functions) {
+        find_function_loops(f, f);
+    }
+}
+
+
+void find_loops(AST* global) {
+    TRACE( TRACE_SEMANTICS, TRACE_SUMMARY, endl << "FINDING LOOPS";)
+    find_function_loops(nullptr, global);
+}
@@ -0,0 +1,48 @@
+// Scandi: loops.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <cstdint>
+#include "ast.h"
+#include "globals.h"
+
+
+// A variable that a loop steps by a constant each time round, as x 1 + does.
+struct Induction {
+    AST* variable;
+    int64_t step;
+    AST* update;                      // The line that steps it.
+};
+
+
+// A way out of a loop: a conditional, taken when it holds or when it
+// doesn't, or null for a jump that is always taken.
+struct LoopExit {
+    AST* test;
+    bool when_holds;
+    AST* induction = nullptr;         // The induction variable it tests, if any.
+    AST* bound = nullptr;             // What it is tested against, if the loop doesn't change it.
+    bool each_time = false;           // Whether it is tested each time round.
+};
+
+
+// A natural loop: a label that everything in the loop can only be reached
+// through, and the jumps back to it from within.
+struct Loop {
+    AST* header;
+    vector<AST*> latches;             // The jumps back.
+    vector<AST*> lines;               // Those in the loop.
+    vector<Induction> inductions;
+    vector<LoopExit> exits;
+    Loop* parent = nullptr;           // The loop it is in, if any.
+    int depth = 1;
+};
+
+
+// Builds each function's control flow graph, from labels, jumps and
+// conditionals, and finds its loops. A loop's label and the jumps back to it
+// are given it, as AST::loop, so that codegen can generate it as a loop.
+void find_loops(AST* global);
@@ -0,0 +1,35 @@
+// Scandi: parallel.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+
+// Runs work(i) for every i in [0, count) over up to jobs threads, including
+// the calling thread. Items are handed out in order, so with a single job they
+// also run in order.
+template <typename WORK>
+void parallel_for(unsigned jobs, size_t count, WORK work) {
+    std::atomic<size_t> next { 0 };
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            work(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    auto thread_count = std::min<size_t>(std::max(jobs, 1u), count);
+    for (size_t t = 1; t < thread_count; t++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t: threads) {
+        t.join();
+    }
+}
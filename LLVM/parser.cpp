@@ -13,30 +13,32 @@
 #include "parser.h"
 
 
-#define TOKEN_IT            std::vector<Token>::iterator
-#define FN( NAME )          SHARED(AST) NAME(TOKEN_IT token, TOKEN_IT end,  SHARED(AST) parent)
-#define EX( TOK )           "e_" + TOK->filename + "_" + std::to_string(TOK->line_no) + "_" + std::to_string(TOK->l_val)
-#define CD( COND, TOK )     COND + "_" + TOK->filename + "_" + std::to_string(TOK->line_no) + "_" + std::to_string(TOK->l_val)
+#define TOKEN_IT            TokenStream::Iterator
+#define FN( NAME )          AST* NAME(TOKEN_IT token, TOKEN_IT end,  AST* parent)
+#define EX( TOK )           "e_" + TOK->filename() + "_" + std::to_string(TOK->line_no) + "_" + std::to_string(TOK->l_val)
+#define CD( COND, TOK )     string(COND) + "_" + TOK->filename() + "_" + std::to_string(TOK->line_no) + "_" + std::to_string(TOK->l_val)
 
 // parent passed into this is an already setup AST ready for the expression to
 // be put into NEXT.
 FN( parse_expression ) {
-    if (debug_set) {
-        std::cerr << " ---EXPR> ";
+    if (TRACING( TRACE_PARSER, TRACE_DETAIL )) {
+        trace_out() << " ---EXPR> ";
         for (auto b = token; b != end; b++) {
-            std::cerr << *b;
+            trace_out() << *b;
         }
     }
-    // Check for auto-assignment
+    // Check for auto-assignment, which only lines of their own have.
     bool is_auto_assign = (
-        token->type == TOK_IDENTIFIER
+        parent->type == AST_EXPRESSION
+     && !parent->get_property(AST::OPT_SUBEXPRESSION)
+     && token->type == TOK_IDENTIFIER
      && (end - 1)->type == TOK_OPERATOR
-     && (end - 1)->s_val != CHAR_STR(LEX_ASSIGNMENT)
+     && (end - 1)->sym != LEX_ASSIGNMENT
     );
     
     // This will start off as a nullptr, declaring for typing.
     if (is_auto_assign) {
-        auto first = SHARE(AST, AST_IDENTIFIER, token->s_val, parent->depth, false);
+        auto first = NEW_AST(AST_IDENTIFIER, token->text(), parent->depth, false);
         first->parent = parent;
         parent->next = std::move(first);
     }
@@ -48,37 +50,35 @@ FN( parse_expression ) {
         item = nullptr;
         TOKEN_IT ref_end = token;
         if (token->type == TOK_VARIABLE || token->type == TOK_IDENTIFIER) {
-            item = SHARE(AST, AST_IDENTIFIER, token->s_val, parent->depth, false);
+            item = NEW_AST(AST_IDENTIFIER, token->text(), parent->depth, false);
         } else if (token->type == TOK_STRING) {
-            item = SHARE(AST, AST_STRING, token->s_val, parent->depth, false);
+            item = NEW_AST(AST_STRING, token->text(), parent->depth, false);
         } else if (token->type == TOK_BINARY) {
-            item = SHARE(AST, AST_BINARY, token->s_val, parent->depth, false);
-        } else if (token->type == TOK_VALUE && token->s_val == CHAR_STR(LEX_DECIMAL_POINT)) {
-            item = SHARE(AST, AST_DOUBLE, "", parent->depth, false);
+            item = NEW_AST(AST_BINARY, token->text(), parent->depth, false);
+        } else if (token->type == TOK_VALUE && token->sym == LEX_DECIMAL_POINT) {
+            item = NEW_AST(AST_DOUBLE, "", parent->depth, false);
             item->numeric_value.d = token->d_val;
-        } else if (token->type == TOK_VALUE && token->s_val == LEX_NULL) {
-            item = SHARE(AST, AST_NULL, "", parent->depth, false);
+        } else if (token->type == TOK_VALUE && token->sym == SYM_NULL) {
+            item = NEW_AST(AST_NULL, "", parent->depth, false);
         } else if (token->type == TOK_VALUE) {
-            item = SHARE(AST, AST_LONG, "", parent->depth, false);
+            item = NEW_AST(AST_LONG, "", parent->depth, false);
             item->numeric_value.l = token->l_val;
-        } else if (token->type == TOK_OPERATOR && token->s_val == CHAR_STR(LEX_NEGATE_BEGIN)) {
+        } else if (token->type == TOK_OPERATOR && token->sym == LEX_NEGATE_BEGIN) {
             // Negate begin/end is sugar for 0 ... -
-            item = SHARE(AST, AST_LONG, "", parent->depth, false);
+            item = NEW_AST(AST_LONG, "", parent->depth, false);
             item->numeric_value.l = 0L;
-        } else if (token->type == TOK_OPERATOR && token->s_val == CHAR_STR(LEX_NEGATE_END)) {
-            item = SHARE(AST, AST_OPERATOR, CHAR_STR(LEX_SUB), parent->depth, false);
-        } else if (token->type == TOK_OPERATOR && token->s_val == CHAR_STR(LEX_REFERENCE_BEGIN)) {
-            item = SHARE(AST, AST_REFERENCE, "ref_" + std::to_string(token->pos), parent->depth, false);
-            ref_end = end - 1;
-            while (ref_end > token && (ref_end->type != TOK_OPERATOR || ref_end->s_val != CHAR_STR(LEX_REFERENCE_END))) {
-                ref_end--;
-            }
-            if (ref_end - token < 2) {
+        } else if (token->type == TOK_OPERATOR && token->sym == LEX_NEGATE_END) {
+            item = NEW_AST(AST_OPERATOR, CHAR_STR(LEX_SUB), parent->depth, false);
+        } else if (token->type == TOK_OPERATOR && token->sym == LEX_REFERENCE_BEGIN) {
+            item = NEW_AST(AST_REFERENCE, "ref_" + std::to_string(token->pos), parent->depth, false);
+            // The lexer has already matched the brackets.
+            if (token->l_val < 2 || token->l_val >= end - token) {
                 DERR("Malformed reference");
             }
+            ref_end = token + token->l_val;
             // The reference will be added after we've moved the item into next.
         } else if (token->type == TOK_OPERATOR) {
-            item = SHARE(AST, AST_OPERATOR, token->s_val, parent->depth, false);
+            item = NEW_AST(AST_OPERATOR, token->text(), parent->depth, false);
         } else {
             DERR("Unknown expression token: " + CHAR_STR(token->type));
         }
@@ -98,8 +98,9 @@ FN( parse_expression ) {
 
         // If we need to add a sub-expression. Gets added to ->alt so as to not pollute ->next space.
         if (ref_end != token) {
-            auto exp = SHARE(AST, AST_EXPRESSION, "exp_" + std::to_string(token->pos), parent->depth, false);
+            auto exp = NEW_AST(AST_EXPRESSION, "exp_" + std::to_string(token->pos), parent->depth, false);
             exp->parent = parent;
+            exp->set_property(AST::OPT_SUBEXPRESSION);
             next->alt = std::move(exp);
             parse_expression(token + 1, ref_end, next->alt);
             token = ref_end;
@@ -108,7 +109,7 @@ FN( parse_expression ) {
     }
 
     if (is_auto_assign) {
-        auto last = SHARE(AST, AST_OPERATOR, CHAR_STR(LEX_ASSIGNMENT), parent->depth, false);
+        auto last = NEW_AST(AST_OPERATOR, CHAR_STR(LEX_ASSIGNMENT), parent->depth, false);
         last->parent = parent;
         next->next = std::move(last);
     }
@@ -122,12 +123,12 @@ FN( parse_conditional) {
     if (end - token < 3) {
         throw domain_error("Empty conditional");
     }
-    auto name = CD((end - 1)->s_val, token);
-    auto c = SHARE(AST, AST_CONDITIONAL, name, token->l_val, false);
+    auto name = CD((end - 1)->text(), token);
+    auto c = NEW_AST(AST_CONDITIONAL, name, token->l_val, false);
     parent = AST::get_correct_parent(c, parent);
     c->parent = parent;
-    parent->children.push_back(std::move(c));
-    return parse_expression(token + 1, end - 1, parent->get_member(name));
+    parent->add_child(c);
+    return parse_expression(token + 1, end - 1, parent->get_member(c->sym));
 }
 
 
@@ -136,37 +137,37 @@ FN( parse_alias ) {
     if (end - token < 5) {
         throw domain_error("Malformed alias statement");
     }
-    if ((end - 1)->type != TOK_ALIAS_END) {
+    if ((end - 1)->type != TOK_ALIAS_END || (token + 1)->l_val != end - token - 2) {
         throw domain_error("Unclosed alias");
     }
     if ((end - 2)->type != TOK_IDENTIFIER) {
         throw domain_error("Unnamed alias");
     }
-    auto a = SHARE(AST, AST_ALIAS, (end - 2)->s_val, token->l_val, false);
+    auto a = NEW_AST(AST_ALIAS, (end - 2)->text(), token->l_val, false);
     parent = AST::get_correct_parent(a, parent);
     a->parent = parent;
-    parent->children.push_back(std::move(a));
-    return parse_expression(token + 2, end - 2, parent->get_member((end - 2)->s_val));
+    parent->add_child(a);
+    return parse_expression(token + 2, end - 2, parent->get_member(a->sym));
 }
 
 
 FN (parse_function) {
     // Varargs will have been mis-labelled self-contents as they look the same
     // without the appropriate context.
-    auto takes_varargs = (token + 1)->type == TOK_OPERATOR && (token + 1)->s_val == LEX_VARARGS_CONTENTS;
+    auto takes_varargs = (token + 1)->type == TOK_OPERATOR && (token + 1)->sym == SYM_VARARGS_CONTENTS;
     
-    if ((end - 1)->s_val.empty()) {
+    if ((end - 1)->sym == SYM_EMPTY) {
         throw domain_error("Irrecoverable error: unnamed function");
     }
 
-    auto f = SHARE(AST, AST_FUNCTION, (end - 1)->s_val, token->l_val, (end - 1)->is_static);
+    auto f = NEW_AST(AST_FUNCTION, (end - 1)->text(), token->l_val, (end - 1)->is_static);
     if (takes_varargs) {
         f->set_property(AST::OPT_HAS_VARARGS);
     }
     parent = AST::get_correct_parent(f, parent);
     f->parent = parent;
-    parent->children.push_back(std::move(f));
-    auto function = parent->get_member((end - 1)->s_val);
+    parent->add_child(f);
+    auto function = parent->get_member(f->sym);
 
     // Check for parameters.
     end -= 2;
@@ -174,9 +175,10 @@ FN (parse_function) {
     while (end > token) {
         if (end->type == TOK_VARIABLE) {
             // Build the parameter declaration.
-            auto p_name = end->s_val;
-            auto p = SHARE(AST, AST_VARIABLE, p_name, token->l_val + 1, false);
+            auto p_name = end->text();
+            auto p = NEW_AST(AST_VARIABLE, p_name, token->l_val + 1, false);
             p->parent = function;
+            function->index_parameter(p);
 
             // Allocate into ->next.
             if (!next) {
@@ -195,21 +197,21 @@ FN (parse_function) {
 
 
 FN( parse_variable ) {
-    if ((token + 1)->s_val.empty()) {
+    if ((token + 1)->sym == SYM_EMPTY) {
         throw domain_error("Irrecoverable error: unnamed variable");
     }
-    auto v = SHARE(AST, AST_VARIABLE, (token + 1)->s_val, token->l_val, (token + 1)->is_static);
+    auto v = NEW_AST(AST_VARIABLE, (token + 1)->text(), token->l_val, (token + 1)->is_static);
     parent = AST::get_correct_parent(v, parent);
     v->parent = parent;
-    parent->children.push_back(std::move(v));
+    parent->add_child(v);
 
     // Check for assignment
     if (end - token >= 4 && (end - 1)->is_assignment()) {
         auto e_name = EX( token );
-        auto e = SHARE(AST, AST_EXPRESSION, e_name, token->l_val, false);
+        auto e = NEW_AST(AST_EXPRESSION, e_name, token->l_val, false);
         e->parent = parent;
-        parent->children.push_back(std::move(e));
-        return parse_expression(token + 1, end, parent->get_member(e_name));
+        parent->add_child(e);
+        return parse_expression(token + 1, end, parent->get_member(e->sym));
     }
     return parent->children.back();
 }
@@ -217,7 +219,7 @@ FN( parse_variable ) {
 
 FN( parse_else ) {
     // Elses are generated jump targets. Parents for elses are the previous conditional.
-    auto a = SHARE(AST, AST_LABEL, "auto_else_" + std::to_string(token->line_no), token->l_val, false);
+    auto a = NEW_AST(AST_LABEL, "auto_else_" + std::to_string(token->line_no), token->l_val, false);
     parent = AST::get_correct_parent(a, parent)->children.back();
     if (!parent || parent->type != AST_CONDITIONAL) {
         DERR("Else without condition.");
@@ -239,13 +241,13 @@ FN( parse_label ) {
     if (token == end) {
         throw domain_error("Unexpected EOF while parsing label");
     }
-    if (token->s_val.empty()) {
+    if (token->sym == SYM_EMPTY) {
         throw domain_error("Irrecoverable error: unnamed label");
     }
-    auto a = SHARE(AST, AST_LABEL, token->s_val, depth, true);
+    auto a = NEW_AST(AST_LABEL, token->text(), depth, true);
     parent = AST::get_correct_parent(a, parent);
     a->parent = parent;
-    parent->children.push_back(std::move(a));
+    parent->add_child(a);
     return parent;
 }
 
@@ -253,33 +255,36 @@ FN( parse_label ) {
 FN( parse_raw ) {
     int depth = token->l_val;
     token++;
-    auto r = SHARE(AST, AST_RAW, token->s_val, depth, false);
+    auto r = NEW_AST(AST_RAW, token->text(), depth, false);
     parent = AST::get_correct_parent(r, parent);
     r->parent = parent;
-    parent->children.push_back(std::move(r));
+    parent->add_child(r);
     return parent;
 }
 
 
 FN( parse_scope ) {
-    if (debug_set) {
+    if (TRACING( TRACE_PARSER, TRACE_DETAIL )) {
         for (auto z = token; z < end; z++) {
-            std::cerr << *z;
+            trace_out() << *z;
         }
     }
 
     // Determine what kind of scope we are looking at.
-    if ((token + 1)->type == TOK_RAW) {
+    if (end - token > 1 && (token + 1)->type == TOK_RAW) {
         parent = parse_raw(token, end, parent);
         
-    } else if (!token->s_val.empty()) {
+    } else if (token->sym != SYM_EMPTY) {
         // This is a named scope.
-        auto s = SHARE(AST, AST_SCOPE, token->s_val, token->l_val, true);
+        auto s = NEW_AST(AST_SCOPE, token->text(), token->l_val, true);
         parent = AST::get_correct_parent(s, parent);
         s->parent = parent;
-        parent->children.push_back(std::move(s));
+        parent->add_child(s);
         parent = parent->children.back();
-        
+
+    } else if (end - token < 2) {
+        // Nothing but the scope, such as a comment line.
+
     } else if ((token + 1)->type == TOK_ALIAS_BEGIN) {
         parent = parse_alias(token, end, parent);
 
@@ -294,7 +299,7 @@ FN( parse_scope ) {
     } else if ((token + 1)->type == TOK_LABEL) {
         parent = parse_label(token, end, parent);
 
-    } else if ((token + 1)->type == TOK_OPERATOR && (token + 1)->s_val == std::string(1, LEX_ELSE)) {
+    } else if ((token + 1)->type == TOK_OPERATOR && (token + 1)->sym == LEX_ELSE) {
         parent = parse_else(token, end, parent);
 
     } else if ((end - 1)->is_conditional()) {
@@ -302,43 +307,30 @@ FN( parse_scope ) {
 
     } else if (end - token > 1) {
         auto e_name = EX( token );
-        auto e = SHARE(AST, AST_EXPRESSION, e_name, token->l_val, false);
+        auto e = NEW_AST(AST_EXPRESSION, e_name, token->l_val, false);
         parent = AST::get_correct_parent(e, parent);
         e->parent = parent;
-        parent->children.push_back(std::move(e));
-        parent = parse_expression(token + 1, end, parent->get_member(e_name));
+        parent->add_child(e);
+        parent = parse_expression(token + 1, end, parent->get_member(e->sym));
     }
 
     return parent;
 }
 
 
-SHARED(AST) parse_to_ast(std::vector<Token> tokens,  SHARED(AST) ast) {
-    DEBUG( "PARSING"; )
-    auto token = tokens.begin();
-    auto end = tokens.end();
+AST* parse_to_ast(TokenStream& tokens,  AST* ast) {
+    TRACE( TRACE_PARSER, TRACE_SUMMARY, "PARSING"; )
+    TOKEN_IT token;
+    TOKEN_IT end;
 
-    while (token != end) {
+    // Each scope is parsed as soon as it has been lexed.
+    while (tokens.next_scope(token, end)) {
         if (token->type != TOK_SCOPE) {
             throw domain_error("Not yet processing token " + std::to_string(token->type));
-            token++;
-            
-        } else {
-            
-            // Find the end of the scope. Need to account for named scopes (such
-            // as files!)
-            auto scope_end = token + 1;
-            while (
-                scope_end != end
-             && (scope_end->type != TOK_SCOPE || !scope_end->s_val.empty())
-            ) {
-                scope_end++;
-            }
-            ast = parse_scope(token, scope_end, ast);
-            token = scope_end;
         }
+        ast = parse_scope(token, end, ast);
     }
-    DEBUG( ""; )
+    TRACE( TRACE_PARSER, TRACE_SUMMARY, ""; )
 
     return ast;
 }
@@ -14,4 +14,5 @@
 using std::vector;
 
 
-SHARED(AST) parse_to_ast(vector<Token>, SHARED(AST));
+// Parses scopes as the stream lexes them.
+AST* parse_to_ast(TokenStream&, AST*);
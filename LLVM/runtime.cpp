@@ -0,0 +1,480 @@
+// Scandi: runtime.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "runtime.h"
+
+
+namespace {
+
+// Fields are kept in the order they were first set. The index is by key's
+// tag and bytes, so 1 and "1" are different fields.
+struct Table {
+    std::vector<std::pair<Value, Value>> fields;
+    std::unordered_map<std::string, size_t> index;
+};
+
+}
+
+
+static const Value null_value = { TAG_NULL, 0 };
+
+
+static Value long_value(int64_t l) {
+    return { TAG_LONG, l };
+}
+
+
+static Value double_value(double d) {
+    Value v = { TAG_DOUBLE, 0 };
+    std::memcpy(&v.bits, &d, sizeof(d));
+    return v;
+}
+
+
+static double double_of(Value v) {
+    double d;
+    std::memcpy(&d, &v.bits, sizeof(d));
+    return d;
+}
+
+
+static Value string_value(const char* text, size_t length) {
+    auto s = static_cast<String*>(std::malloc(sizeof(String) + length));
+    if (!s) {
+        scandi_fail("Out of memory");
+    }
+    s->length = length;
+    std::memcpy(s->text, text, length);
+    s->text[length] = '\0';
+    return { TAG_STRING, reinterpret_cast<int64_t>(s) };
+}
+
+
+static Value string_value(const std::string& text) {
+    return string_value(text.data(), text.size());
+}
+
+
+static String* string_of(Value v) {
+    return reinterpret_cast<String*>(v.bits);
+}
+
+
+static Table* table_of(Value v) {
+    return reinterpret_cast<Table*>(v.bits);
+}
+
+
+static FILE* stream_of(Value v) {
+    return reinterpret_cast<FILE*>(v.bits);
+}
+
+
+// Doubles use the language's decimal point.
+static std::string text_of(Value v) {
+    switch (v.tag) {
+        case TAG_NULL:      return "";
+        case TAG_LONG:      return std::to_string(v.bits);
+        case TAG_DOUBLE: {
+            char text[32];
+            std::snprintf(text, sizeof(text), "%.15g", double_of(v));
+            for (auto c = text; *c; c++) {
+                if (*c == '.') {
+                    *c = ',';
+                }
+            }
+            return text;
+        }
+        case TAG_STRING:    return std::string(string_of(v)->text, string_of(v)->length);
+        case TAG_TABLE:     return "<table>";
+        case TAG_STREAM:    return "<stream>";
+    }
+    return "";
+}
+
+
+// Whether a string holds nothing but a number, with either decimal point.
+static bool number_in(Value v, Value& number) {
+    auto s = string_of(v);
+    std::string text(s->text, s->length);
+
+    // As the lexer reads them: digits, and a decimal point between digits.
+    size_t digits = text[0] == '-' ? 1 : 0;
+    size_t point = std::string::npos;
+    for (auto i = digits; i < text.size(); i++) {
+        if ((text[i] == ',' || text[i] == '.') && point == std::string::npos && i > digits && i + 1 < text.size()) {
+            point = i;
+            text[i] = '.';
+        } else if (!std::isdigit(static_cast<unsigned char>(text[i]))) {
+            return false;
+        }
+    }
+    if (text.size() == digits) {
+        return false;
+    }
+    errno = 0;
+    if (point == std::string::npos) {
+        auto l = std::strtoll(text.c_str(), nullptr, 10);
+        if (errno == 0) {
+            number = long_value(l);
+            return true;
+        }
+    }
+    number = double_value(std::strtod(text.c_str(), nullptr));
+    return true;
+}
+
+
+// Null counts as 0.
+static Value number_of(Value v) {
+    Value number;
+    switch (v.tag) {
+        case TAG_NULL:      return long_value(0);
+        case TAG_LONG:
+        case TAG_DOUBLE:    return v;
+        case TAG_STRING:
+            if (number_in(v, number)) {
+                return number;
+            }
+            scandi_fail(("Not a number: " + text_of(v)).c_str());
+    }
+    scandi_fail("Not a number");
+}
+
+
+static int64_t long_of(Value v) {
+    v = number_of(v);
+    return v.tag == TAG_LONG ? v.bits : static_cast<int64_t>(double_of(v));
+}
+
+
+static double as_double(Value v) {
+    return v.tag == TAG_LONG ? static_cast<double>(v.bits) : double_of(v);
+}
+
+
+static bool is_number(Value v) {
+    return v.tag == TAG_LONG || v.tag == TAG_DOUBLE;
+}
+
+
+static int numeric_compare(Value x, Value y) {
+    if (x.tag == TAG_LONG && y.tag == TAG_LONG) {
+        return (x.bits > y.bits) - (x.bits < y.bits);
+    }
+    auto dx = as_double(x);
+    auto dy = as_double(y);
+    return (dx > dy) - (dx < dy);
+}
+
+
+// A string compared with a number is read as a number, if it is one.
+// Otherwise values compare as text.
+static int compare(Value a, Value b) {
+    Value x = a;
+    Value y = b;
+    if (
+        (is_number(a) || (a.tag == TAG_STRING && is_number(b) && number_in(a, x)))
+     && (is_number(b) || (b.tag == TAG_STRING && is_number(a) && number_in(b, y)))
+    ) {
+        return numeric_compare(x, y);
+    }
+    auto order = text_of(a).compare(text_of(b));
+    return (order > 0) - (order < 0);
+}
+
+
+// Null is only equal to null, and tables and streams only to themselves.
+static bool equal(Value a, Value b) {
+    if (a.tag == TAG_NULL || b.tag == TAG_NULL) {
+        return a.tag == b.tag;
+    }
+    if (a.tag == TAG_STRING && b.tag == TAG_STRING) {
+        auto x = string_of(a);
+        auto y = string_of(b);
+        return x->length == y->length && std::memcmp(x->text, y->text, x->length) == 0;
+    }
+    if (is_number(a) || is_number(b)) {
+        Value x = a;
+        Value y = b;
+        if ((a.tag == TAG_STRING && !number_in(a, x)) || (b.tag == TAG_STRING && !number_in(b, y))) {
+            return false;
+        }
+        return is_number(x) && is_number(y) && numeric_compare(x, y) == 0;
+    }
+    return a.tag == b.tag && a.bits == b.bits;
+}
+
+
+static Value concatenate(Value a, Value b) {
+    return string_value(text_of(a) + text_of(b));
+}
+
+
+static Value arithmetic(int64_t op, Value a, Value b) {
+    a = number_of(a);
+    b = number_of(b);
+    if (a.tag == TAG_LONG && b.tag == TAG_LONG) {
+        // Unsigned, so that overflow wraps rather than being undefined.
+        uint64_t x = a.bits;
+        uint64_t y = b.bits;
+        switch (op) {
+            case OP_ADD:        return long_value(x + y);
+            case OP_SUB:        return long_value(x - y);
+            case OP_MULTIPLY:   return long_value(x * y);
+            case OP_DIVIDE:
+            case OP_MODULUS:
+                if (b.bits == 0) {
+                    scandi_fail("Division by zero");
+                }
+                if (b.bits == -1) {
+                    return long_value(op == OP_DIVIDE ? 0 - x : 0);
+                }
+                return long_value(op == OP_DIVIDE ? a.bits / b.bits : a.bits % b.bits);
+        }
+    }
+    auto x = as_double(a);
+    auto y = as_double(b);
+    switch (op) {
+        case OP_ADD:        return double_value(x + y);
+        case OP_SUB:        return double_value(x - y);
+        case OP_MULTIPLY:   return double_value(x * y);
+        case OP_DIVIDE:     return double_value(x / y);
+        case OP_MODULUS:    return double_value(std::fmod(x, y));
+    }
+    return null_value;
+}
+
+
+// Keys that are whole doubles are the same field as the long.
+static std::string key_of(Value key) {
+    if (key.tag == TAG_DOUBLE && double_of(key) == std::floor(double_of(key)) && std::fabs(double_of(key)) < 9e18) {
+        key = long_value(static_cast<int64_t>(double_of(key)));
+    }
+    std::string k(1, static_cast<char>(key.tag));
+    if (key.tag == TAG_STRING) {
+        k.append(string_of(key)->text, string_of(key)->length);
+    } else {
+        k.append(reinterpret_cast<const char*>(&key.bits), sizeof(key.bits));
+    }
+    return k;
+}
+
+
+extern "C" {
+
+void scandi_fail(const char* message) {
+    std::fflush(stdout);
+    std::fprintf(stderr, "scandi: %s\n", message);
+    std::exit(1);
+}
+
+
+Value scandi_operate(int64_t op, Value a, Value b) {
+    switch (op) {
+        case OP_ADD:
+            if (a.tag == TAG_STRING || b.tag == TAG_STRING) {
+                Value number;
+                if (
+                    (a.tag == TAG_STRING && b.tag == TAG_STRING)
+                 || (a.tag == TAG_STRING && !number_in(a, number))
+                 || (b.tag == TAG_STRING && !number_in(b, number))
+                ) {
+                    return concatenate(a, b);
+                }
+            }
+            return arithmetic(op, a, b);
+        case OP_SUB:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULUS:    return arithmetic(op, a, b);
+        case OP_AND:        return long_value(long_of(a) & long_of(b));
+        case OP_OR:         return long_value(long_of(a) | long_of(b));
+        case OP_XOR:        return long_value(long_of(a) ^ long_of(b));
+        case OP_SHL:        return long_value(static_cast<uint64_t>(long_of(a)) << (long_of(b) & 63));
+        case OP_SHR:        return long_value(static_cast<uint64_t>(long_of(a)) >> (long_of(b) & 63));
+        case OP_SSHR:       return long_value(long_of(a) >> (long_of(b) & 63));
+        case OP_EQ:         return long_value(equal(a, b));
+        case OP_LT:         return long_value(compare(a, b) < 0);
+        case OP_LTE:        return long_value(compare(a, b) <= 0);
+        case OP_GT:         return long_value(compare(a, b) > 0);
+        case OP_GTE:        return long_value(compare(a, b) >= 0);
+        case OP_COMPLEMENT: return long_value(~long_of(a));
+    }
+    scandi_fail("Unknown operator");
+}
+
+
+int64_t scandi_truth(Value v) {
+    switch (v.tag) {
+        case TAG_NULL:      return 0;
+        case TAG_LONG:      return v.bits != 0;
+        case TAG_DOUBLE:    return double_of(v) != 0;
+    }
+    return 1;
+}
+
+
+Value scandi_count(Value v) {
+    switch (v.tag) {
+        case TAG_NULL:      return long_value(0);
+        case TAG_STRING:    return long_value(string_of(v)->length);
+        case TAG_TABLE:     return long_value(table_of(v)->fields.size());
+    }
+    scandi_fail(("Can't count " + text_of(v)).c_str());
+}
+
+
+Value scandi_table() {
+    return { TAG_TABLE, reinterpret_cast<int64_t>(new Table) };
+}
+
+
+Value scandi_string(const char* text, int64_t length) {
+    return string_value(text, length);
+}
+
+
+Value scandi_get(Value container, Value key) {
+    if (container.tag == TAG_TABLE) {
+        auto table = table_of(container);
+        auto found = table->index.find(key_of(key));
+        return found == table->index.end() ? null_value : table->fields[found->second].second;
+    }
+    if (container.tag == TAG_STRING) {
+        auto s = string_of(container);
+        auto i = long_of(key);
+        return (i >= 0 && i < s->length) ? string_value(s->text + i, 1) : null_value;
+    }
+    if (container.tag == TAG_NULL) {
+        return null_value;
+    }
+    scandi_fail(("No fields in " + text_of(container)).c_str());
+}
+
+
+Value scandi_set(Value container, Value key, Value value) {
+    if (container.tag == TAG_NULL) {
+        container = scandi_table();
+    } else if (container.tag != TAG_TABLE) {
+        scandi_fail(("Can't set fields of " + text_of(container)).c_str());
+    }
+    auto table = table_of(container);
+    auto inserted = table->index.emplace(key_of(key), table->fields.size());
+    if (inserted.second) {
+        table->fields.push_back({ key, value });
+    } else {
+        table->fields[inserted.first->second].second = value;
+    }
+    return container;
+}
+
+
+Value scandi_globals() {
+    static Value globals = scandi_table();
+    return globals;
+}
+
+
+Value scandi_arguments(const Value* args, int64_t count, int64_t named) {
+    auto frame = scandi_table();
+    for (int64_t i = 0; i < count - named; i++) {
+        scandi_set(frame, long_value(i), args[i]);
+    }
+    return frame;
+}
+
+
+Value scandi_argument(const Value* args, int64_t count, int64_t named, int64_t index) {
+    auto i = count - named + index;
+    return i >= 0 ? args[i] : null_value;
+}
+
+
+Value scandi_system_stdin() {
+    return { TAG_STREAM, reinterpret_cast<int64_t>(stdin) };
+}
+
+
+Value scandi_system_stdout() {
+    return { TAG_STREAM, reinterpret_cast<int64_t>(stdout) };
+}
+
+
+Value scandi_system_stderr() {
+    return { TAG_STREAM, reinterpret_cast<int64_t>(stderr) };
+}
+
+
+// The stream is the last argument, $in. Gives null at the end of the stream.
+Value scandi_stream_readline(const Value* args, int64_t count) {
+    if (count < 1 || args[count - 1].tag != TAG_STREAM) {
+        scandi_fail("readline needs a stream");
+    }
+    auto stream = stream_of(args[count - 1]);
+    std::string line;
+    int c;
+    while ((c = std::fgetc(stream)) != EOF && c != '\n') {
+        line += static_cast<char>(c);
+    }
+    if (c == EOF && line.empty()) {
+        return null_value;
+    }
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    return string_value(line);
+}
+
+
+// Writes each argument before the stream, $out, then a new line.
+Value scandi_stream_writeline(const Value* args, int64_t count) {
+    if (count < 1 || args[count - 1].tag != TAG_STREAM) {
+        scandi_fail("writeline needs a stream");
+    }
+    auto stream = stream_of(args[count - 1]);
+    for (int64_t i = 0; i < count - 1; i++) {
+        auto text = text_of(args[i]);
+        std::fwrite(text.data(), 1, text.size(), stream);
+    }
+    std::fputc('\n', stream);
+    return null_value;
+}
+
+}
+
+
+#define RUNTIME_SYMBOL( NAME )  { #NAME, reinterpret_cast<void*>(&NAME) }
+
+const RuntimeSymbol runtime_symbols[] = {
+    RUNTIME_SYMBOL( scandi_fail ),
+    RUNTIME_SYMBOL( scandi_operate ),
+    RUNTIME_SYMBOL( scandi_truth ),
+    RUNTIME_SYMBOL( scandi_count ),
+    RUNTIME_SYMBOL( scandi_table ),
+    RUNTIME_SYMBOL( scandi_string ),
+    RUNTIME_SYMBOL( scandi_get ),
+    RUNTIME_SYMBOL( scandi_set ),
+    RUNTIME_SYMBOL( scandi_globals ),
+    RUNTIME_SYMBOL( scandi_arguments ),
+    RUNTIME_SYMBOL( scandi_argument ),
+    RUNTIME_SYMBOL( scandi_system_stdin ),
+    RUNTIME_SYMBOL( scandi_system_stdout ),
+    RUNTIME_SYMBOL( scandi_system_stderr ),
+    RUNTIME_SYMBOL( scandi_stream_readline ),
+    RUNTIME_SYMBOL( scandi_stream_writeline ),
+    { nullptr, nullptr }
+};
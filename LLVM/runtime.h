@@ -0,0 +1,108 @@
+// Scandi: runtime.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <cstdint>
+
+
+// What compiled programs call on. Every value is a tag and 64 bits, which are
+// the number itself, or a pointer for strings, tables and streams. Passed by
+// value, a Value goes in two registers, so generated code passes each as two
+// 64-bit integers.
+//
+// Tables hold the object store: the globals, each call's local context, and
+// whatever a program builds with [ ] and . at runtime. Nothing is freed, as
+// programs are short lived.
+enum Tag : int64_t {
+    TAG_NULL,
+    TAG_LONG,
+    TAG_DOUBLE,
+    TAG_STRING,
+    TAG_TABLE,
+    TAG_STREAM
+};
+
+
+// Operators on two values, for scandi_operate. Comparators give 1 or 0.
+enum Operation : int64_t {
+    OP_ADD,
+    OP_SUB,
+    OP_MULTIPLY,
+    OP_DIVIDE,
+    OP_MODULUS,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_SHL,
+    OP_SHR,
+    OP_SSHR,
+    OP_EQ,
+    OP_LT,
+    OP_LTE,
+    OP_GT,
+    OP_GTE,
+    OP_COMPLEMENT                     // Of the first only.
+};
+
+
+struct Value {
+    int64_t tag;
+    int64_t bits;
+};
+
+
+// Strings are a length and the bytes, which are also null terminated. Generated
+// code lays out its string constants the same way.
+struct String {
+    int64_t length;
+    char text[1];
+};
+
+
+// Embedded code ({{ }}) in the library is provided here, as
+// scandi_<module>_<name>: a function for a function, and a function giving its
+// first value for a variable.
+extern "C" {
+    [[noreturn]] void scandi_fail(const char* message);
+
+    // Strings and numbers mix as a script would expect: + joins if either is
+    // a string that isn't a number, and otherwise adds; other arithmetic
+    // reads numbers out of strings; and strings compare as text unless
+    // compared with a number.
+    Value scandi_operate(int64_t op, Value a, Value b);
+    int64_t scandi_truth(Value);
+    Value scandi_count(Value);
+
+    // Reading a missing field gives null. Setting a field of null makes a
+    // table, which is returned, for the caller to store in its place.
+    Value scandi_table();
+    Value scandi_string(const char* text, int64_t length);
+    Value scandi_get(Value container, Value key);
+    Value scandi_set(Value container, Value key, Value value);
+
+    Value scandi_globals();
+
+    // A call's local context: a table of the arguments that weren't named,
+    // numbered from 0. Named arguments come last, and are read with
+    // scandi_argument, which gives null for any not passed.
+    Value scandi_arguments(const Value* args, int64_t count, int64_t named);
+    Value scandi_argument(const Value* args, int64_t count, int64_t named, int64_t index);
+
+    Value scandi_system_stdin();
+    Value scandi_system_stdout();
+    Value scandi_system_stderr();
+    Value scandi_stream_readline(const Value* args, int64_t count);
+    Value scandi_stream_writeline(const Value* args, int64_t count);
+}
+
+
+// Everything above by name, for running programs within scandi. Ends with a
+// null name.
+struct RuntimeSymbol {
+    const char* name;
+    void* address;
+};
+extern const RuntimeSymbol runtime_symbols[];
@@ -4,23 +4,41 @@
 // Copyright: Neil Bradley
 // License: GPL 3.0
 
-#include <cstring>
+#include <atomic>
+#include <cstdlib>
 #include <dirent.h>
-#include <fstream>
+#include <exception>
 #include <iostream>
+#include <spawn.h>
+#include <sstream>
 #include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
 #include "ast.h"
+#include "bytecode.h"
+#include "cache.h"
 #include "codegen.h"
+#include "flat_ast.h"
+#include "fold.h"
+#include "jit.h"
+#include "loops.h"
 #include "globals.h"
 #include "lexer.h"
+#include "parallel.h"
 #include "parser.h"
 #include "semantics.h"
+#include "server.h"
+#include "source.h"
+#include "timing.h"
+#include "trace.h"
+#include "types.h"
 
 
 #define SCANDI_VERSION 0.1
-
-
-bool debug_set = false;
+#define LIBRARY_CACHE  "stdlib.cache"
+#define BUILD_CACHE    "./.scandi-cache/"
 
 
 void get_version() {
@@ -33,16 +51,83 @@ void get_help() {
     std::cout << "options:" << std::endl;
     std::cout << "    --version             Get the current version" << std::endl;
     std::cout << "    --help                Display this help" << std::endl;
-    std::cout << "    --debug               Set debug flag for verbose output" << std::endl;
-    std::cout << "    --libdir <libdir>     Get the current version" << std::endl;
-    std::cout << "    -o <outfile>          Specify the executable name" << std::endl;
+    std::cout << "    --debug               Trace everything the compiler does" << std::endl;
+    std::cout << "    --debug=<categories>  Trace some of it, such as parser,semantics:1. Categories" << std::endl;
+    std::cout << "                          are driver, lexer, parser, semantics and codegen, each" << std::endl;
+    std::cout << "                          at level 1 (summary) or 2 (detail, the default)" << std::endl;
+    std::cout << "    --libdir <libdir>     Read the standard library from libdir" << std::endl;
+    std::cout << "    --jobs <n>            Lex and parse up to n files at once" << std::endl;
+    std::cout << "    --flat-ast            Run semantic analysis over the flat AST layout" << std::endl;
+    std::cout << "    --no-cache            Don't read or write the precompiled library or build cache" << std::endl;
+    std::cout << "    --cache-dir <dir>     Keep the build cache in dir" << std::endl;
+    std::cout << "    --server <socket>     Serve compiles on a Unix socket, see server.h" << std::endl;
+    std::cout << "    --time-passes         Report the time and memory taken by each pass" << std::endl;
+    std::cout << "    --trace <file>        Write pass timings as a Chrome trace" << std::endl;
+    std::cout << "    --run                 Compile and run the program now, giving its exit status" << std::endl;
+    std::cout << "    --interp              Run the program now as bytecode, without LLVM" << std::endl;
+    std::cout << "    --no-fuse             Don't fuse --interp's bytecode into superinstructions" << std::endl;
+    std::cout << "    --no-fold             Don't fold constants or decide constant conditionals" << std::endl;
+    std::cout << "    --emit-llvm           Write LLVM IR text instead of an executable" << std::endl;
+    std::cout << "    --runtime <file>      Link executables against this build of runtime.cpp" << std::endl;
+    std::cout << "    -o <outfile>          Specify the executable name, or an object file (.o)" << std::endl;
 }
 
 
-std::string lib_dir = "./stdlib/";
-std::string output = "a.out";
+std::string lib_dir;
+std::string cache_dir;
+std::string output;
+std::string server_socket;
 std::vector<std::string> in_files;
 std::vector<std::string> lib_files;
+unsigned jobs;
+std::string runtime;
+bool flat_ast;
+bool emit_llvm;
+bool run_program_now;
+bool interpret_now;
+bool fuse_bytecode;
+bool fold_program;
+bool use_cache;
+bool show_pass_times;
+std::string trace_file;
+
+
+// Where scandi was built or installed, with the library and runtime beside
+// it, whatever directory it is run from.
+std::string install_dir() {
+    static std::string dir;
+    if (dir.empty()) {
+        char path[4096];
+        auto length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        dir = length > 0 ? std::string(path, length) : "./";
+        dir.erase(dir.rfind('/') + 1);
+    }
+    return dir;
+}
+
+
+// The server compiles many times over, so options are set afresh for each.
+void reset_options() {
+    trace_reset();
+    lib_dir = install_dir() + "stdlib/";
+    cache_dir = BUILD_CACHE;
+    output = "a.out";
+    runtime = install_dir() + "runtime.o";
+    server_socket.clear();
+    in_files.clear();
+    lib_files.clear();
+    jobs = std::thread::hardware_concurrency();
+    flat_ast = false;
+    emit_llvm = false;
+    run_program_now = false;
+    interpret_now = false;
+    fuse_bytecode = true;
+    fold_program = true;
+    use_cache = true;
+    time_passes = false;
+    show_pass_times = false;
+    trace_file.clear();
+}
 
 
 void get_library_files() {
@@ -61,82 +146,571 @@ void get_library_files() {
 }
 
 
+// Each file is lexed and parsed on its own, into a subtree under a private
+// root, so files can be processed concurrently.
+struct FileUnit {
+    std::string path;
+    std::string name;
+    uint32_t file_id;
+    AST* root;
+    bool lexed;
+    std::exception_ptr error;
+    bool needed;
+    bool skipped = false;             // After another file failed.
+    std::string errors;               // From lexing, printed once all are done.
+    uint64_t content_hash = 0;
+    bool cached = false;              // Parsed tree from the build cache.
+    bool linked = false;              // Links too.
+    vector<BuildLink> links;
+};
+
+
+// Lexes and parses the given units. Traces are only readable in file order,
+// so tracing is serial.
+void process_units(std::vector<FileUnit>& units, const vector<size_t>& indices, AST* global) {
+    std::atomic<bool> failed { false };
+    parallel_for(tracing_any() ? 1 : jobs, indices.size(), [&](size_t i) {
+        auto& unit = units[indices[i]];
+        if (failed) {
+            unit.skipped = true;
+            return;
+        }
+        Stopwatch whole;
+        Stopwatch lexing;
+        whole.start();
+
+        // 1. Tokenize and 2. Parse, a scope at a time
+        TokenStream tokens(unit.file_id);
+        std::ostringstream errors;
+        tokens.lexing = time_passes ? &lexing : nullptr;
+        tokens.errors = &errors;
+        unit.root = NEW_AST(AST_SCOPE, global->name, global->depth, true);
+        try {
+            parse_to_ast(tokens, unit.root);
+        } catch (...) {
+            unit.error = std::current_exception();
+        }
+
+        // Lexing errors take precedence, as they would have stopped the file
+        // being parsed at all.
+        tokens.finish();
+        unit.lexed = !tokens.failed();
+        unit.errors = errors.str();
+        if (!unit.lexed || unit.error) {
+            failed = true;
+        }
+
+        whole.stop();
+        if (time_passes) {
+            pass_timer().add_parse(unit.name, whole, lexing);
+        } else {
+            pass_timer().add("parse", unit.name, whole);
+        }
+    });
+
+    // Time spent here was recorded file by file.
+    pass_timer().skip_pass();
+}
+
+
+// Prints what lexing reported, then reports the first failure, both in file
+// order. Returns false if lexing failed, and rethrows parse errors. Files
+// without a root were never processed, and those skipped after another file
+// failed are left unreported.
+bool check_units(std::vector<FileUnit>& units) {
+    for (auto& unit: units) {
+        if (!unit.errors.empty()) {
+            trace_flush();
+            std::cerr << unit.errors;
+            unit.errors.clear();
+        }
+    }
+    for (auto& unit: units) {
+        if (!unit.root || unit.skipped) {
+            continue;
+        }
+        if (!unit.lexed) {
+            trace_flush();
+            std::cerr << "LEXING FAILED" << std::endl;
+            return false;
+        }
+        if (unit.error) {
+            std::rethrow_exception(unit.error);
+        }
+    }
+    return true;
+}
+
+
+// Adds each library module the tree refers to, such as stream in
+// {stream.writeline writeline}, to found if it isn't already wanted.
+void find_module_references(
+    AST* ast,
+    const std::unordered_map<Symbol, size_t>& modules,
+    vector<bool>& wanted,
+    vector<size_t>& found
+) {
+    if (ast->type == AST_IDENTIFIER) {
+        auto module = modules.find(ast->sym);
+        if (module != modules.end() && !wanted[module->second]) {
+            wanted[module->second] = true;
+            found.push_back(module->second);
+        }
+    }
+    if (ast->next) {
+        find_module_references(ast->next, modules, wanted, found);
+    }
+    if (ast->type != AST_IDENTIFIER && ast->alt) {
+        find_module_references(ast->alt, modules, wanted, found);
+    }
+    for (auto c: ast->children) {
+        find_module_references(c, modules, wanted, found);
+    }
+}
+
+
+bool ends_with(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+// Writes IR, an object, or an executable, as output is named. Executables are
+// linked by the system's compiler driver, against the runtime.
+int write_output(Program& program) {
+    if (emit_llvm || ends_with(output, ".o")) {
+        if (!write_program(program, output, emit_llvm ? OUTPUT_IR : OUTPUT_OBJECT)) {
+            std::cerr << "Unable to write " << output << std::endl;
+            return 1;
+        }
+        pass_timer().end_pass("emit");
+        return 0;
+    }
+
+    char object[] = "/tmp/scandi-XXXXXX.o";
+    auto fd = mkstemps(object, 2);
+    if (fd < 0) {
+        std::cerr << "Unable to create a temporary file" << std::endl;
+        return 1;
+    }
+    close(fd);
+    if (!write_program(program, object, OUTPUT_OBJECT)) {
+        std::cerr << "Unable to write " << object << std::endl;
+        unlink(object);
+        return 1;
+    }
+    pass_timer().end_pass("emit");
+
+    // Spawned with its arguments as they are, so no name is read by a shell.
+    vector<string> command = { "c++", object, runtime, "-o", output };
+    vector<char*> argv;
+    for (auto& arg: command) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    TRACE( TRACE_DRIVER, TRACE_SUMMARY, "LINKING: " << command[0] << " " << object << " " << runtime << " -o " << output; )
+    trace_flush();
+    pid_t linker;
+    int status;
+    auto linked = posix_spawnp(&linker, argv[0], nullptr, nullptr, argv.data(), environ) == 0
+        && waitpid(linker, &status, 0) == linker && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    unlink(object);
+    pass_timer().end_pass("link");
+    if (!linked) {
+        std::cerr << "Unable to link " << output << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+
 int run() {
-    auto global = SHARE(AST, AST_SCOPE, "global", -1, true);
+    auto global = NEW_AST(AST_SCOPE, "global", -1, true);
 
     in_files.insert(in_files.begin(), lib_files.begin(), lib_files.end());
 
+    // Sources are all opened up front, so lexing threads never add to the
+    // source registry.
+    std::vector<FileUnit> units;
     for (auto f: in_files) {
-        std::vector<Token> tokens;
-
-        // 1. Tokenize
-        std::ifstream file(f);
         auto name_start = f.find_last_of("/") + 1;
         auto name_end = f.find(".scandi", name_start);
         auto name = f.substr(name_start, name_end - name_start);
-        if (!tokenize_stream(tokens, file, name)) {
+        try {
+            units.push_back({ f, name, open_source_file(f, name), nullptr, false, nullptr, true });
+        } catch (domain_error& de) {
+            trace_flush();
+            std::cerr << "LEXER: " << de.what() << std::endl;
             std::cerr << "LEXING FAILED" << std::endl;
             return 1;
         }
-        file.close();
+    }
 
-        // 2. Parse
-        parse_to_ast(tokens, global);
+    // The library comes ready parsed from the cache, unless its sources or
+    // the compiler have changed since the cache was written.
+    auto library_count = lib_files.size();
+    auto cache_path = lib_dir + LIBRARY_CACHE;
+    auto compiler_hash = hash_bytes("scandi " + std::to_string(SCANDI_VERSION));
+    auto library_hash = compiler_hash;
+    vector<string> library_modules;
+    std::unordered_map<Symbol, size_t> library_index;
+    for (size_t i = 0; i < library_count; i++) {
+        auto text = source_file(units[i].file_id).text;
+        library_hash = hash_bytes(units[i].name + ":" + std::to_string(text.size()) + ":", library_hash);
+        library_hash = hash_bytes(text, library_hash);
+        library_modules.push_back(units[i].name);
+        library_index.emplace(intern(units[i].name), i);
+        units[i].needed = false;
     }
-    DEBUG( "After parsing:" << std::endl << global << std::endl; )
+    vector<AST*> library_roots;
+    bool library_cached = (
+        use_cache
+     && library_count > 0
+     && load_library_cache(cache_path, library_hash, library_modules, vector<bool>(library_count, false), library_roots)
+    );
 
-    // 3. Semantic analysis
-    analyse_semantics(global);
-    DEBUG( "After semantics:" << std::endl << global << std::endl; )
+    pass_timer().end_pass("open");
 
-    // 4. Generate LLVM IR
-    generate_code(global);
-    DEBUG( ""; )
+    // Program files come from the build cache when they haven't changed.
+    size_t parse_hits = 0;
+    for (size_t i = library_count; use_cache && i < units.size(); i++) {
+        auto& unit = units[i];
+        Stopwatch loading;
+        loading.start();
+        auto text = source_file(unit.file_id).text;
+        unit.content_hash = hash_bytes(unit.name + ":" + std::to_string(text.size()) + ":", compiler_hash);
+        unit.content_hash = hash_bytes(text, unit.content_hash);
+        if (load_build_entry(cache_dir, unit.path, unit.content_hash, unit.name, unit.root, unit.linked, unit.links)) {
+            TRACE( TRACE_DRIVER, TRACE_SUMMARY, "LOADED " << unit.name << " FROM " << cache_dir; )
+            unit.cached = true;
+            unit.lexed = true;
+            parse_hits++;
+        }
+        loading.stop();
+        pass_timer().add("load", unit.name, loading);
+    }
+    pass_timer().skip_pass();
 
-    return 0;
-}
+    // Without a cache the whole library is parsed once, alongside the
+    // program, so that the cache can be written.
+    vector<size_t> first;
+    for (size_t i = (use_cache && !library_cached) ? 0 : library_count; i < units.size(); i++) {
+        if (!units[i].cached) {
+            first.push_back(i);
+        }
+    }
+    process_units(units, first, global);
+    if (!check_units(units)) {
+        ast_arena().release();
+        return 1;
+    }
 
+    // Written before merging, while each module is still under its own root.
+    if (use_cache && library_count > 0 && !library_cached) {
+        vector<AST*> roots;
+        for (size_t i = 0; i < library_count; i++) {
+            roots.push_back(units[i].root);
+        }
+        if (!save_library_cache(cache_path, library_hash, library_modules, roots)) {
+            TRACE( TRACE_DRIVER, TRACE_SUMMARY, "UNABLE TO WRITE " << cache_path; )
+        }
+        pass_timer().end_pass("cache");
+    }
 
-int main( int argc,  char* argv[]) {
+    // Only the library modules the program refers to are kept, and those
+    // they refer to in turn. Modules not yet parsed are loaded as found.
+    vector<bool> wanted(library_count, false);
+    vector<size_t> found;
+    for (size_t i = library_count; i < units.size(); i++) {
+        find_module_references(units[i].root, library_index, wanted, found);
+    }
+    while (!found.empty()) {
+        vector<size_t> loading;
+        for (auto i: found) {
+            units[i].needed = true;
+            if (!units[i].root) {
+                loading.push_back(i);
+            }
+        }
+        vector<bool> loading_wanted(library_count, false);
+        for (auto i: loading) {
+            loading_wanted[i] = true;
+        }
+        if (
+            library_cached && !loading.empty()
+         && load_library_cache(cache_path, library_hash, library_modules, loading_wanted, library_roots)
+        ) {
+            for (auto i: loading) {
+                TRACE( TRACE_DRIVER, TRACE_SUMMARY, "LOADED " << units[i].name << " FROM " << cache_path; )
+                units[i].root = library_roots[i];
+                units[i].lexed = true;
+            }
+        } else {
+            pass_timer().end_pass("load");
+            process_units(units, loading, global);
+            if (!check_units(units)) {
+                ast_arena().release();
+                return 1;
+            }
+        }
 
+        auto scanning = std::move(found);
+        found.clear();
+        for (auto i: scanning) {
+            find_module_references(units[i].root, library_index, wanted, found);
+        }
+    }
+
+    // Merge in file order, so the tree doesn't depend on scheduling.
+    for (auto& unit: units) {
+        if (!unit.needed) {
+            continue;
+        }
+        for (auto& c: unit.root->children) {
+            c->parent = global;
+            global->add_child(c);
+        }
+    }
+    pass_timer().end_pass("load");
+    TRACE( TRACE_PARSER, TRACE_SUMMARY, "After parsing:" << std::endl << global << std::endl; )
+
+    // 3. Semantic analysis. With the build cache, or when timing passes,
+    // files are analysed one at a time, so unchanged files can be linked as
+    // they were last time, and each file's cost is known.
+    size_t semantic_hits = 0;
+    if (flat_ast) {
+        FlatAST flat(global);
+        analyse_semantics(flat);
+        flat.link_tree(global);
+        pass_timer().end_pass("semantics");
+        TRACE( TRACE_SEMANTICS, TRACE_SUMMARY, "After semantics:" << std::endl << flat << std::endl; )
+    } else if (!use_cache && !time_passes) {
+        analyse_semantics(global);
+        pass_timer().end_pass("semantics");
+        TRACE( TRACE_SEMANTICS, TRACE_SUMMARY, "After semantics:" << std::endl << global << std::endl; )
+    } else {
+        for (auto& unit: units) {
+            if (!unit.needed) {
+                continue;
+            }
+            Stopwatch analysing;
+            analysing.start();
+            if (unit.linked) {
+                for (auto& link: unit.links) {
+                    link.first->alt = link.second ? link.second : global->get_member(link.first->sym);
+                }
+                semantic_hits++;
+            } else {
+                for (auto c: unit.root->children) {
+                    analyse_semantics(c, global);
+                }
+            }
+            analysing.stop();
+            pass_timer().add("semantics", unit.name, analysing);
+        }
+        pass_timer().skip_pass();
+        TRACE( TRACE_SEMANTICS, TRACE_SUMMARY, "After semantics:" << std::endl << global << std::endl; )
+    }
+
+    // Entries are written for files that missed in either phase. The flat
+    // layout doesn't link the tree, so it only writes parsed trees.
+    if (use_cache) {
+        auto program_count = units.size() - library_count;
+        for (size_t i = library_count; i < units.size(); i++) {
+            auto& unit = units[i];
+            if (unit.cached && (unit.linked || flat_ast)) {
+                continue;
+            }
+            if (!save_build_entry(cache_dir, unit.path, unit.content_hash, unit.name, unit.root, !flat_ast)) {
+                TRACE( TRACE_DRIVER, TRACE_SUMMARY, "UNABLE TO WRITE " << cache_dir; )
+            }
+        }
+        pass_timer().end_pass("cache");
+        TRACE( TRACE_DRIVER, TRACE_SUMMARY,
+            "BUILD CACHE: lexing and parsing " << parse_hits << " hits, " << program_count - parse_hits << " misses;"
+            << " semantics " << semantic_hits << " hits, " << program_count - semantic_hits << " misses";
+        )
+    }
+
+    // 4. Variables are given slots, and constants are folded over the whole
+    // program, after the cache has the trees as they were linked. Then loops
+    // are found, and types inferred.
+    assign_slots(global);
+    pass_timer().end_pass("slots");
+    if (fold_program) {
+        fold_constants(global);
+        pass_timer().end_pass("fold");
+        TRACE( TRACE_SEMANTICS, TRACE_SUMMARY, "After folding:" << std::endl << global << std::endl; )
+    }
+    find_loops(global);
+    pass_timer().end_pass("loops");
+    infer_types(global);
+    pass_timer().end_pass("types");
+
+    // 5. Run the bytecode, or generate LLVM IR
+    if (interpret_now) {
+        auto bytecode = lower_program(global);
+        pass_timer().end_pass("lower");
+        if (fuse_bytecode) {
+            fuse_instructions(bytecode);
+            pass_timer().end_pass("fuse");
+        }
+        TRACE( TRACE_CODEGEN, TRACE_DETAIL, "Bytecode:" << std::endl << bytecode; )
+        ast_arena().release();
+        trace_flush();
+        auto status = interpret(bytecode);
+        pass_timer().end_pass("run");
+        return status;
+    }
+    auto program = generate_program(global);
+    pass_timer().end_pass("codegen");
+    TRACE( TRACE_CODEGEN, TRACE_SUMMARY, ""; )
+
+    // The whole tree goes at once.
+    ast_arena().release();
+
+    if (run_program_now) {
+        trace_flush();
+        auto status = run_program(std::move(program));
+        pass_timer().end_pass("run");
+        return status;
+    }
+    optimise_program(program);
+    pass_timer().end_pass("optimise");
+    return write_output(program);
+}
+
+
+void parse_arguments(const vector<string>& args) {
     // Arguments accepted:
     // --version
     // --help
+    // --debug
+    // --debug=<categories>
     // --libdir <libdir>
+    // --jobs <n>
+    // --flat-ast
+    // --no-cache
+    // --cache-dir <dir>
+    // --server <socket>
+    // --time-passes
+    // --trace <file>
+    // --run
+    // --interp
+    // --no-fuse
+    // --no-fold
+    // --emit-llvm
+    // --runtime <file>
     // -o output
     // all other arguments presumed imput files
-    for (int i = 1; i < argc; i++) {
-        if (std::strcmp(argv[i], "--version") == 0) {
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "--version") {
             get_version();
             
-        } else if (std::strcmp(argv[i], "--help") == 0) {
+        } else if (args[i] == "--help") {
             get_help();
             
-        } else if (std::strcmp(argv[i], "--debug") == 0) {
-            debug_set = true;
+        } else if (args[i] == "--debug") {
+            trace_select("all");
             
-        } else if (std::strcmp(argv[i], "--libdir") == 0) {
-            if (i + 1 < argc) {
-                lib_dir = argv[i + 1];
+        } else if (args[i].rfind("--debug=", 0) == 0) {
+            trace_select(args[i].substr(8));
+            
+        } else if (args[i] == "--time-passes") {
+            time_passes = true;
+            show_pass_times = true;
+            
+        } else if (args[i] == "--trace") {
+            if (i + 1 < args.size()) {
+                time_passes = true;
+                trace_file = args[i + 1];
+            } else {
+                std::cerr << "Invalid argument, trace file expected" << std::endl;
+            }
+            i++;
+            
+        } else if (args[i] == "--flat-ast") {
+            flat_ast = true;
+            
+        } else if (args[i] == "--no-cache") {
+            use_cache = false;
+            
+        } else if (args[i] == "--libdir") {
+            if (i + 1 < args.size()) {
+                lib_dir = args[i + 1];
             } else {
                 std::cerr << "Invalid argument, libs directory expected" << std::endl;
             }
             i++;
             
-        } else if (std::strcmp(argv[i], "-o") == 0) {
-            if (i + 1 < argc) {
-                output = argv[i + 1];
+        } else if (args[i] == "--cache-dir") {
+            if (i + 1 < args.size()) {
+                cache_dir = args[i + 1];
+                if (cache_dir.back() != '/') {
+                    cache_dir += '/';
+                }
+            } else {
+                std::cerr << "Invalid argument, cache directory expected" << std::endl;
+            }
+            i++;
+            
+        } else if (args[i] == "--server") {
+            if (i + 1 < args.size()) {
+                server_socket = args[i + 1];
+            } else {
+                std::cerr << "Invalid argument, socket path expected" << std::endl;
+            }
+            i++;
+            
+        } else if (args[i] == "--jobs") {
+            if (i + 1 < args.size() && std::atoi(args[i + 1].c_str()) > 0) {
+                jobs = std::atoi(args[i + 1].c_str());
+            } else {
+                std::cerr << "Invalid argument, number of jobs expected" << std::endl;
+            }
+            i++;
+            
+        } else if (args[i] == "--run") {
+            run_program_now = true;
+            
+        } else if (args[i] == "--interp") {
+            interpret_now = true;
+            
+        } else if (args[i] == "--no-fuse") {
+            fuse_bytecode = false;
+            
+        } else if (args[i] == "--no-fold") {
+            fold_program = false;
+            
+        } else if (args[i] == "--emit-llvm") {
+            emit_llvm = true;
+            
+        } else if (args[i] == "--runtime") {
+            if (i + 1 < args.size()) {
+                runtime = args[i + 1];
+            } else {
+                std::cerr << "Invalid argument, runtime object expected" << std::endl;
+            }
+            i++;
+            
+        } else if (args[i] == "-o") {
+            if (i + 1 < args.size()) {
+                output = args[i + 1];
             } else {
                 std::cerr << "Invalid argument, outfile expected" << std::endl;
             }
             i++;
             
         } else {
-            in_files.push_back(argv[i]);
+            in_files.push_back(args[i]);
             
         }
     }
+}
+
 
+// What scandi does for a command line, once its arguments are parsed.
+int compile() {
+    pass_timer().start();
     if (in_files.empty()) {
         std::cerr << "No input files" << std::endl;
         return 1;
@@ -144,17 +718,105 @@ int main( int argc,  char* argv[]) {
 
     get_library_files();
 
-    if (debug_set) {
-        std::cout << std::endl << "Processing:";
+    if (TRACING( TRACE_DRIVER, TRACE_SUMMARY )) {
+        trace_out() << '\n' << "Processing:";
         for (auto f : in_files) {
-            std::cout << std::endl << "    " << f;
+            trace_out() << '\n' << "    " << f;
         }
-        std::cout << std::endl << "Libraries: " << lib_dir;
+        trace_out() << '\n' << "Libraries: " << lib_dir;
         for (auto l : lib_files) {
-            std::cout << std::endl << "    " << l;
+            trace_out() << '\n' << "    " << l;
         }
-        std::cout << std::endl;
+        trace_out() << '\n';
     }
 
-    return run();
+    auto status = run();
+    trace_flush();
+    if (show_pass_times) {
+        pass_timer().print_summary(std::cerr);
+    }
+    if (!trace_file.empty() && !pass_timer().write_trace(trace_file)) {
+        std::cerr << "Unable to write " << trace_file << std::endl;
+    }
+    return status;
+}
+
+
+// Runs one compile for the server, with the options the server was started
+// with as defaults. Everything the compile prints goes in the reply.
+std::string compile_request(const vector<string>& defaults, const vector<string>& args) {
+    std::ostringstream reply;
+    auto cout_buffer = std::cout.rdbuf(reply.rdbuf());
+    auto cerr_buffer = std::cerr.rdbuf(reply.rdbuf());
+
+    int status = 1;
+    pass_timer().start();
+    reset_options();
+    parse_arguments(defaults);
+    parse_arguments(args);
+    if (!server_socket.empty()) {
+        std::cerr << "Already serving" << std::endl;
+    } else if (run_program_now || interpret_now) {
+        // Programs would share the server's runtime, and its output.
+        std::cerr << "The server doesn't run programs" << std::endl;
+    } else {
+        try {
+            status = compile();
+        } catch (std::exception& e) {
+            trace_flush();
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    // Nothing of this compile is kept but the caches.
+    ast_arena().release();
+    close_source_files();
+    reset_symbols();
+    trace_flush();
+    std::cout.rdbuf(cout_buffer);
+    std::cerr.rdbuf(cerr_buffer);
+
+    reply << std::endl;
+    for (auto& pass: pass_timer().totals()) {
+        reply << "TIME " << pass.pass << " " << pass.wall_ms << std::endl;
+    }
+    reply << "EXIT " << status << std::endl;
+    return reply.str();
+}
+
+
+int main( int argc,  char* argv[]) {
+    vector<string> args(argv + 1, argv + argc);
+    reset_options();
+    parse_arguments(args);
+    if (server_socket.empty()) {
+        try {
+            return compile();
+        } catch (...) {
+            trace_flush();
+            throw;
+        }
+    }
+
+    // Files are given with each request. Everything else the server was
+    // started with applies to every request.
+    if (!in_files.empty()) {
+        std::cerr << "The server takes files with each request" << std::endl;
+        return 1;
+    }
+    vector<string> defaults;
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "--server") {
+            i++;
+        } else {
+            defaults.push_back(args[i]);
+        }
+    }
+    copy_stable_names();
+    keep_caches_resident();
+    // Each request resets the options, server_socket among them.
+    const string socket_path = server_socket;
+    return serve(socket_path, [&](const vector<string>& request) {
+        return compile_request(defaults, request);
+    });
 }
@@ -0,0 +1,139 @@
+// Scandi: scanner.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+//
+// Finds the end of character runs for the lexer a vector at a time, so tokens
+// can be sliced out of a line in one go. Each scan returns the position of the
+// first character not in the run (or end). AVX2 and SSE2 are used when the
+// compiler targets them; SCANDI_NO_SIMD forces the scalar fallback.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#if !defined(SCANDI_NO_SIMD) && defined(__AVX2__)
+    #include <immintrin.h>
+    #define SCAN_AVX2
+#elif !defined(SCANDI_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+    #include <emmintrin.h>
+    #define SCAN_SSE2
+#endif
+
+
+namespace scan {
+
+inline bool is_digit(unsigned char c) { return static_cast<unsigned>(c - '0') < 10u; }
+inline bool is_alpha(unsigned char c) { return static_cast<unsigned>((c | 0x20) - 'a') < 26u; }
+inline bool is_alnum(unsigned char c) { return is_digit(c) || is_alpha(c); }
+inline bool is_xdigit(unsigned char c) { return is_digit(c) || static_cast<unsigned>((c | 0x20) - 'a') < 6u; }
+
+
+#if defined(SCAN_AVX2)
+    #define SCAN_WIDTH          32
+    typedef __m256i             vec;
+    #define VLOAD( p )          _mm256_loadu_si256(reinterpret_cast<const __m256i*>( p ))
+    #define VSET( c )           _mm256_set1_epi8( c )
+    #define VEQ( a, b )         _mm256_cmpeq_epi8( a, b )
+    #define VGT( a, b )         _mm256_cmpgt_epi8( a, b )
+    #define VAND( a, b )        _mm256_and_si256( a, b )
+    #define VOR( a, b )         _mm256_or_si256( a, b )
+    #define VMASK( a )          static_cast<uint32_t>(_mm256_movemask_epi8( a ))
+#elif defined(SCAN_SSE2)
+    #define SCAN_WIDTH          16
+    typedef __m128i             vec;
+    #define VLOAD( p )          _mm_loadu_si128(reinterpret_cast<const __m128i*>( p ))
+    #define VSET( c )           _mm_set1_epi8( c )
+    #define VEQ( a, b )         _mm_cmpeq_epi8( a, b )
+    #define VGT( a, b )         _mm_cmpgt_epi8( a, b )
+    #define VAND( a, b )        _mm_and_si128( a, b )
+    #define VOR( a, b )         _mm_or_si128( a, b )
+    #define VMASK( a )          static_cast<uint32_t>(_mm_movemask_epi8( a ))
+#endif
+
+#if defined(SCAN_WIDTH)
+    // Lanes set where lo <= c <= hi. Only valid for ASCII bounds, as the
+    // compare is signed; bytes >= 0x80 are never in range.
+    #define VRANGE( v, lo, hi ) VAND(VGT( v, VSET((lo) - 1) ), VGT( VSET((hi) + 1), v ))
+    #define VFULL               (SCAN_WIDTH == 32 ? 0xFFFFFFFFu : 0xFFFFu)
+
+    // Runs over whole blocks, returning at the first lane set in STOP. Leaves
+    // pos at the tail for the scalar loop.
+    #define VSCAN( STOP )                                                   \
+        while (pos + SCAN_WIDTH <= end) {                                   \
+            vec v = VLOAD(data + pos);                                      \
+            uint32_t stop = STOP;                                           \
+            if (stop) {                                                     \
+                return pos + __builtin_ctz(stop);                           \
+            }                                                               \
+            pos += SCAN_WIDTH;                                              \
+        }
+    #define VSCAN_WHILE( TEST )     VSCAN( ~VMASK( TEST ) & VFULL )
+    #define VSCAN_UNTIL( TEST )     VSCAN( VMASK( TEST ) )
+#else
+    #define VSCAN_WHILE( TEST )
+    #define VSCAN_UNTIL( TEST )
+#endif
+
+
+inline size_t spaces(const char* data, size_t pos, size_t end) {
+    VSCAN_WHILE( VEQ(v, VSET(' ')) )
+    while (pos < end && data[pos] == ' ') {
+        pos++;
+    }
+    return pos;
+}
+
+
+inline size_t alnums(const char* data, size_t pos, size_t end) {
+    VSCAN_WHILE( VOR(VRANGE(v, '0', '9'), VOR(VRANGE(v, 'a', 'z'), VRANGE(v, 'A', 'Z'))) )
+    while (pos < end && is_alnum(data[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+
+// Digits and the given separator, for numbers with a decimal point.
+inline size_t digits(const char* data, size_t pos, size_t end, char separator) {
+    VSCAN_WHILE( VOR(VRANGE(v, '0', '9'), VEQ(v, VSET(separator))) )
+    while (pos < end && (is_digit(data[pos]) || data[pos] == separator)) {
+        pos++;
+    }
+    return pos;
+}
+
+
+inline size_t hex_digits(const char* data, size_t pos, size_t end) {
+    VSCAN_WHILE( VOR(VRANGE(v, '0', '9'), VOR(VRANGE(v, 'a', 'f'), VRANGE(v, 'A', 'F'))) )
+    while (pos < end && is_xdigit(data[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+
+// Everything up to the next delimiter, such as a closing quote.
+inline size_t until(const char* data, size_t pos, size_t end, char delimiter) {
+    VSCAN_UNTIL( VEQ(v, VSET(delimiter)) )
+    while (pos < end && data[pos] != delimiter) {
+        pos++;
+    }
+    return pos;
+}
+
+}
+
+#undef VSCAN
+#undef VSCAN_WHILE
+#undef VSCAN_UNTIL
+#undef VRANGE
+#undef VFULL
+#undef VLOAD
+#undef VSET
+#undef VEQ
+#undef VGT
+#undef VAND
+#undef VOR
+#undef VMASK
@@ -8,6 +8,7 @@
 #include <iterator>
 #include <vector>
 #include "ast.h"
+#include "flat_ast.h"
 #include "globals.h"
 #include "lexer.h"
 #include "parser.h"
@@ -18,11 +19,13 @@
  *
  * 1. All items can see the global space.
  * 2. All identifiers are linked to their declarations.
+ *
+ *  And then gives declared variables their slots.
  */
 
-void check_for_global_access(const SHARED(AST) ast, const SHARED(AST) global) {
-    DEBUG("CHECKING " << ast->name;)
-    if (!ast->can_see(global->name)) {
+void check_for_global_access(AST* ast, AST* global) {
+    TRACE( TRACE_SEMANTICS, TRACE_DETAIL, "CHECKING " << ast->name;)
+    if (!ast->can_see(global->sym)) {
         DERR("Could not see global namespace from " + ast->shorthand());
     }
     // Check each member.
@@ -38,10 +41,10 @@ void check_for_global_access(const SHARED(AST) ast, const SHARED(AST) global) {
 }
 
 
-void link_identifiers(SHARED(AST) ast) {
+void link_identifiers(AST* ast) {
     if (ast->type == AST_IDENTIFIER) {
-        DEBUG("LOOKING FOR " << ast->name;)
-        auto link = ast->get_member(ast->name);
+        TRACE( TRACE_SEMANTICS, TRACE_DETAIL, "LOOKING FOR " << ast->name;)
+        auto link = ast->get_member(ast->sym);
         if (link && !(link->type == AST_ALIAS && link == ast->parent)) {  // Don't link an alias to itself.
             ast->alt = link;
         } else {
@@ -61,9 +64,85 @@ void link_identifiers(SHARED(AST) ast) {
 }
 
 
-void analyse_semantics(SHARED(AST) ast) {
-    DEBUG(endl << "CHECKING GLOBAL ACCESS CONSISTENCY (note this is for compiler debugging)";)
-    check_for_global_access(ast, ast);
-    DEBUG(endl << "LINKING IDENTIFIERS";)
+void analyse_semantics(AST* ast) {
+    analyse_semantics(ast, ast);
+}
+
+
+void analyse_semantics(AST* ast, AST* global) {
+    TRACE( TRACE_SEMANTICS, TRACE_SUMMARY, endl << "CHECKING GLOBAL ACCESS CONSISTENCY (note this is for compiler debugging)";)
+    check_for_global_access(ast, global);
+    TRACE( TRACE_SEMANTICS, TRACE_SUMMARY, endl << "LINKING IDENTIFIERS";)
     link_identifiers(ast);
 }
+
+
+// The same checks over the flat layout. Nodes are stored in the order the
+// passes above visit them, so each pass is a single loop.
+void analyse_semantics(FlatAST& ast) {
+    TRACE( TRACE_SEMANTICS, TRACE_SUMMARY, endl << "CHECKING GLOBAL ACCESS CONSISTENCY (note this is for compiler debugging)";)
+    // A parent almost always comes before its children, so whether it can see
+    // the global namespace is already known.
+    auto global = ast.name[0];
+    vector<char> sees_global(ast.size(), 0);
+    for (NodeId id = 0; id < ast.size(); id++) {
+        TRACE( TRACE_SEMANTICS, TRACE_DETAIL, "CHECKING " << symbol_name(ast.name[id]);)
+        auto parent = ast.parent[id];
+        if (parent < id && sees_global[parent]) {
+            sees_global[id] = true;
+        } else {
+            sees_global[id] = ast.can_see(id, global);
+        }
+        if (!sees_global[id]) {
+            DERR("Could not see global namespace from " + ast.shorthand(id));
+        }
+    }
+
+    TRACE( TRACE_SEMANTICS, TRACE_SUMMARY, endl << "LINKING IDENTIFIERS";)
+    for (NodeId id = 0; id < ast.size(); id++) {
+        if (ast.type[id] == AST_IDENTIFIER) {
+            TRACE( TRACE_SEMANTICS, TRACE_DETAIL, "LOOKING FOR " << symbol_name(ast.name[id]);)
+            auto link = ast.get_member(id, ast.name[id]);
+            if (link != NO_NODE && !(ast.type[link] == AST_ALIAS && link == ast.parent[id])) {  // Don't link an alias to itself.
+                ast.alt[id] = link;
+            }
+        }
+    }
+}
+
+
+// A function's frame has its parameters, left to right, and then the
+// variables declared within it, but not within functions of its own.
+void number_slots(AST* ast, AST* function, AST* global) {
+    for (auto c: ast->children) {
+        if (c->type == AST_VARIABLE) {
+            auto owner = (function && !c->get_property(AST::OPT_STATIC)) ? function : global;
+            c->slot = owner->slot++;
+            TRACE( TRACE_SEMANTICS, TRACE_DETAIL, (owner == global ? "GLOBAL SLOT " : "SLOT ") << c->slot << " FOR " << c->name;)
+        }
+        if (c->type == AST_FUNCTION) {
+            c->slot = 0;
+            for (auto p = c->next; p; p = p->next) {
+                c->slot++;
+            }
+            auto last = c->slot;
+            for (auto p = c->next; p; p = p->next) {
+                p->slot = --last;
+                TRACE( TRACE_SEMANTICS, TRACE_DETAIL, "SLOT " << p->slot << " FOR " << p->name;)
+            }
+            number_slots(c, c, global);
+        } else {
+            number_slots(c, function, global);
+        }
+    }
+    if (ast->type == AST_CONDITIONAL && ast->alt) {
+        number_slots(ast->alt, function, global);
+    }
+}
+
+
+void assign_slots(AST* global) {
+    TRACE( TRACE_SEMANTICS, TRACE_SUMMARY, endl << "ASSIGNING SLOTS";)
+    global->slot = 0;
+    number_slots(global, nullptr, global);
+}
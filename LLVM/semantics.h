@@ -6,7 +6,16 @@
 
 #pragma once
 #include "ast.h"
+#include "flat_ast.h"
 #include "globals.h"
 
 
-void analyse_semantics(SHARED(AST));
+void analyse_semantics(AST*);
+// Analyses part of the tree, such as one file, once merged under global.
+void analyse_semantics(AST*, AST* global);
+void analyse_semantics(FlatAST&);
+
+// Gives each declared variable a slot, once the whole program is linked:
+// parameters and locals in their function's frame, and statics and the rest
+// among the globals. Only names that are found at runtime are kept by name.
+void assign_slots(AST* global);
@@ -0,0 +1,166 @@
+// Scandi: server.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.h"
+
+
+#define MAX_REQUEST     (1024 * 1024)
+
+
+volatile std::sig_atomic_t stopping = 0;
+
+
+void stop_serving(int) {
+    stopping = 1;
+}
+
+
+// Reads arguments until an empty line, or until the client stops writing.
+bool read_request(int client, std::vector<std::string>& args) {
+    std::string request;
+    char buffer[4096];
+    while (request.find("\n\n") == std::string::npos && request.size() < MAX_REQUEST) {
+        auto got = read(client, buffer, sizeof(buffer));
+        if (got < 0 && errno == EINTR && !stopping) {
+            continue;
+        } else if (got < 0) {
+            return false;
+        } else if (got == 0) {
+            break;
+        }
+        request.append(buffer, got);
+    }
+
+    size_t start = 0;
+    for (auto end = request.find('\n'); end != std::string::npos; end = request.find('\n', start)) {
+        if (end == start) {
+            return true;
+        }
+        args.push_back(request.substr(start, end - start));
+        start = end + 1;
+    }
+    if (start < request.size()) {
+        args.push_back(request.substr(start));
+    }
+    return true;
+}
+
+
+void write_reply(int client, const std::string& reply) {
+    size_t sent = 0;
+    while (sent < reply.size()) {
+        auto wrote = write(client, reply.data() + sent, reply.size() - sent);
+        if (wrote < 0 && errno == EINTR && !stopping) {
+            continue;
+        } else if (wrote <= 0) {
+            return;
+        }
+        sent += wrote;
+    }
+}
+
+
+// A socket left by a server that didn't stop cleanly would block bind, so
+// it is removed, but only once nothing answers on it. Anything else at the
+// path is left for its owner.
+bool clear_socket_path(const std::string& socket_path, const sockaddr_un& address) {
+    struct stat status;
+    if (lstat(socket_path.c_str(), &status) != 0) {
+        return errno == ENOENT;
+    }
+    if (!S_ISSOCK(status.st_mode)) {
+        std::cerr << "Not a socket, so not replacing it: " << socket_path << std::endl;
+        return false;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool live = probe >= 0 && connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+    if (probe >= 0) {
+        close(probe);
+    }
+    if (live) {
+        std::cerr << "Already being served: " << socket_path << std::endl;
+        return false;
+    }
+    return unlink(socket_path.c_str()) == 0 || errno == ENOENT;
+}
+
+
+// Whether the path is still the socket this server bound, rather than one
+// that replaced it.
+bool is_own_socket(const std::string& socket_path, const struct stat& bound) {
+    struct stat status;
+    return lstat(socket_path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)
+        && status.st_dev == bound.st_dev && status.st_ino == bound.st_ino;
+}
+
+
+int serve(const std::string& socket_path, CompileHandler compile) {
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << socket_path << std::endl;
+        return 1;
+    }
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "Unable to create socket: " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    if (!clear_socket_path(socket_path, address)) {
+        close(listener);
+        return 1;
+    }
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        std::cerr << "Unable to listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+        close(listener);
+        return 1;
+    }
+    struct stat bound;
+    if (lstat(socket_path.c_str(), &bound) != 0 || listen(listener, 16) != 0) {
+        std::cerr << "Unable to listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+        close(listener);
+        unlink(socket_path.c_str());
+        return 1;
+    }
+
+    // Signals interrupt accept, rather than restarting it, so the loop sees
+    // it should stop. A client going away mustn't stop the server.
+    struct sigaction action {};
+    action.sa_handler = stop_serving;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cerr << "Serving on " << socket_path << std::endl;
+    while (!stopping) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            continue;
+        }
+        std::vector<std::string> args;
+        if (read_request(client, args)) {
+            write_reply(client, compile(args));
+        }
+        close(client);
+    }
+
+    close(listener);
+    if (is_own_socket(socket_path, bound)) {
+        unlink(socket_path.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+// Scandi: server.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+
+// The compile server keeps the compiler resident, so that editors and test
+// loops don't pay for starting it, or for loading the library, on every
+// compile. It listens on a Unix socket and takes one request per connection:
+// the arguments as they would be given to scandi, one per line, ended by an
+// empty line or the end of the stream. For example:
+//
+//     printf 'test.scandi\n--debug\n\n' | nc -U scandi.sock
+//
+// The reply is whatever the compile printed, then the time taken by each
+// phase and the exit status:
+//
+//     TIME <phase> <milliseconds>
+//     EXIT <status>
+//
+// Compiles are handled one at a time, in the order they arrive.
+typedef std::function<std::string(const std::vector<std::string>&)> CompileHandler;
+
+// Serves until interrupted or terminated, then removes the socket, if the
+// path is still its own. Refuses a path that isn't a socket, or that a server
+// already answers on.
+int serve(const std::string& socket_path, CompileHandler compile);
@@ -0,0 +1,100 @@
+// Scandi: source.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <cstdint>
+#include <fcntl.h>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "globals.h"
+#include "source.h"
+
+
+std::vector<std::unique_ptr<SourceFile>> source_files;
+
+
+SourceFile::~SourceFile() {
+    if (mapped) {
+        munmap(mapped, mapped_size);
+    }
+}
+
+
+bool SourceFile::map_file() {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    // Empty files can't be mapped, but are perfectly valid.
+    if (st.st_size > 0) {
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        mapped = map;
+        mapped_size = st.st_size;
+        text = std::string_view(static_cast<const char*>(map), mapped_size);
+    }
+    close(fd);
+    return true;
+}
+
+
+void SourceFile::read_stream(std::istream& stream_in) {
+    owned.assign(std::istreambuf_iterator<char>(stream_in), std::istreambuf_iterator<char>());
+    text = owned;
+}
+
+
+std::string_view SourceFile::keep(std::string str) {
+    materialized.push_back(std::move(str));
+    return materialized.back();
+}
+
+
+// Tokens keep the ID in 16 bits.
+uint32_t add_source_file(std::unique_ptr<SourceFile> source) {
+    if (source_files.size() > UINT16_MAX) {
+        DERR("Too many source files, at " + source->name);
+    }
+    source_files.push_back(std::move(source));
+    return source_files.size() - 1;
+}
+
+
+uint32_t open_source_file(const std::string& path, const std::string& name) {
+    auto source = std::unique_ptr<SourceFile>(new SourceFile(name, path));
+    if (!source->map_file()) {
+        DERR("Unable to open " + path);
+    }
+    return add_source_file(std::move(source));
+}
+
+
+uint32_t open_source_stream(std::istream& stream_in, const std::string& name) {
+    auto source = std::unique_ptr<SourceFile>(new SourceFile(name, name));
+    source->read_stream(stream_in);
+    return add_source_file(std::move(source));
+}
+
+
+SourceFile& source_file(uint32_t id) {
+    return *source_files.at(id);
+}
+
+
+void close_source_files() {
+    source_files.clear();
+}
@@ -0,0 +1,60 @@
+// Scandi: source.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// A source file held in memory for the whole compilation. Files on disk are
+// memory-mapped, so tokens can refer straight into the mapped text rather than
+// owning copies of it.
+class SourceFile {
+    public:
+        std::string name;             // The module name, used for file scope.
+        std::string path;
+        std::string_view text;        // The whole file contents.
+
+        SourceFile(std::string name, std::string path) : name(name), path(path) {}
+        ~SourceFile();
+
+        SourceFile(const SourceFile&) = delete;
+        SourceFile& operator=(const SourceFile&) = delete;
+
+        // Maps the file at path. Returns false if it can't be opened.
+        bool map_file();
+
+        // Reads the whole stream into an owned buffer instead.
+        void read_stream(std::istream&);
+
+        // Stores text that does not exist contiguously in the source (such as
+        // continued strings) for the lifetime of the file.
+        std::string_view keep(std::string);
+
+    private:
+        void* mapped = nullptr;
+        size_t mapped_size = 0;
+        std::string owned;
+        std::deque<std::string> materialized;
+};
+
+
+// Source files are referred to by ID, so that tokens don't carry a filename.
+// There can be at most 65536 open at once, as tokens keep the ID in 16 bits.
+// Sources are opened by the driver before lexing is spread over threads, so
+// source_file doesn't need to lock.
+uint32_t open_source_file(const std::string& path, const std::string& name);
+uint32_t open_source_stream(std::istream& stream_in, const std::string& name);
+SourceFile& source_file(uint32_t id);
+
+// Closes every source, for the compile server between compiles. Nothing may
+// still refer to their text.
+void close_source_files();
@@ -0,0 +1,157 @@
+// Scandi: symbols.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <atomic>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <unordered_map>
+#include "globals.h"
+#include "lexer.h"
+#include "symbols.h"
+
+
+// Sources are lexed concurrently, so the index is split into shards by hash,
+// each with its own lock. Names are stored in fixed chunks that never move, so
+// a symbol's name can be read without a lock: any thread holding an ID got it
+// from a write that happened before.
+#define CHUNK_BITS      12
+#define CHUNK_SIZE      (1 << CHUNK_BITS)
+#define MAX_CHUNKS      (1 << 12)
+#define SHARDS          16
+
+
+class SymbolTable {
+    public:
+        SymbolTable() {
+            for (int c = 0; c < 256; c++) {
+                chars[c] = static_cast<char>(c);
+                find_or_add(std::string_view(&chars[c], c == 0 ? 0 : 1), true);
+            }
+            // Must be in the same order as FixedSymbols.
+            for (auto digraph: {
+                LEX_RAW_BEGIN,
+                LEX_RAW_END,
+                LEX_VARIABLE_STATIC,
+                LEX_FUNCTION_STATIC,
+                LEX_NULL,
+                LEX_VARARGS_CONTENTS,
+                LEX_SHL,
+                LEX_SHR,
+                LEX_SSHR,
+                LEX_LTE,
+                LEX_GTE
+            }) {
+                find_or_add(digraph, true);
+            }
+        }
+
+        ~SymbolTable() {
+            for (auto& chunk: chunks) {
+                delete[] chunk.load();
+            }
+        }
+
+        std::string_view name(Symbol sym) {
+            return chunks[sym >> CHUNK_BITS].load(std::memory_order_acquire)[sym & (CHUNK_SIZE - 1)];
+        }
+
+        bool copy_stable = false;
+
+        Symbol find_or_add(std::string_view name, bool stable) {
+            auto& shard = shards[std::hash<std::string_view>()(name) % SHARDS];
+            std::lock_guard<std::mutex> locked(shard.lock);
+            auto found = shard.index.find(name);
+            if (found != shard.index.end()) {
+                return found->second;
+            }
+            if (!stable || copy_stable) {
+                shard.owned.push_back(string(name));
+                name = shard.owned.back();
+            }
+            auto sym = add(name);
+            shard.index[name] = sym;
+            return sym;
+        }
+
+        // Forgets every symbol but the fixed ones, and frees the chunks only
+        // they used. Nothing may be lexing, nor hold a later symbol.
+        void reset() {
+            for (auto& shard: shards) {
+                for (auto i = shard.index.begin(); i != shard.index.end();) {
+                    i = i->second < SYM_FIRST_DYNAMIC ? std::next(i) : shard.index.erase(i);
+                }
+                shard.owned.clear();
+            }
+            for (size_t c = (SYM_FIRST_DYNAMIC >> CHUNK_BITS) + 1; c < MAX_CHUNKS; c++) {
+                delete[] chunks[c].exchange(nullptr);
+            }
+            count = SYM_FIRST_DYNAMIC;
+        }
+
+    private:
+        struct Shard {
+            std::mutex lock;
+            std::unordered_map<std::string_view, Symbol> index;
+            std::deque<std::string> owned;
+        };
+
+        Shard shards[SHARDS];
+        std::atomic<std::string_view*> chunks[MAX_CHUNKS] {};
+        std::atomic<Symbol> count { 0 };
+        char chars[256];
+
+        Symbol add(std::string_view name) {
+            Symbol sym = count++;
+            if ((sym >> CHUNK_BITS) >= MAX_CHUNKS) {
+                DERR("Symbol table is full");
+            }
+            auto& chunk = chunks[sym >> CHUNK_BITS];
+            auto names = chunk.load(std::memory_order_acquire);
+            if (!names) {
+                // Another shard may be allocating the same chunk.
+                auto fresh = new std::string_view[CHUNK_SIZE];
+                if (chunk.compare_exchange_strong(names, fresh, std::memory_order_acq_rel)) {
+                    names = fresh;
+                } else {
+                    delete[] fresh;
+                }
+            }
+            names[sym & (CHUNK_SIZE - 1)] = name;
+            return sym;
+        }
+};
+
+
+SymbolTable& symbols() {
+    static SymbolTable table;
+    return table;
+}
+
+
+Symbol intern(std::string_view name) {
+    return symbols().find_or_add(name, false);
+}
+
+
+Symbol intern_stable(std::string_view name) {
+    return symbols().find_or_add(name, true);
+}
+
+
+void copy_stable_names() {
+    symbols().copy_stable = true;
+}
+
+
+void reset_symbols() {
+    symbols().reset();
+}
+
+
+std::string_view symbol_name(Symbol sym) {
+    return symbols().name(sym);
+}
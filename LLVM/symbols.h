@@ -0,0 +1,52 @@
+// Scandi: symbols.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+
+// Every identifier, operator, string and filename is interned once, and
+// referred to by its ID from then on. Comparing symbols is an integer compare.
+typedef uint32_t Symbol;
+
+
+// Single characters are their own ID, so an operator can be compared against
+// its LEX_ character directly. Digraphs have fixed IDs following those.
+enum FixedSymbols : Symbol {
+    SYM_EMPTY             = 0,
+    SYM_RAW_BEGIN         = 256,
+    SYM_RAW_END,
+    SYM_VARIABLE_STATIC,
+    SYM_FUNCTION_STATIC,
+    SYM_NULL,
+    SYM_VARARGS_CONTENTS,
+    SYM_SHL,
+    SYM_SHR,
+    SYM_SSHR,
+    SYM_LTE,
+    SYM_GTE,
+    SYM_FIRST_DYNAMIC
+};
+
+
+// Returns the ID for the text, copying it into the table if it is new.
+Symbol intern(std::string_view);
+
+// As above, but the caller guarantees the text outlives the compilation (such
+// as text in a mapped source file), so it is never copied.
+Symbol intern_stable(std::string_view);
+
+// The compile server closes sources between compiles, while the table lives
+// on, so it has intern_stable copy as well. Must be called before lexing.
+void copy_stable_names();
+
+// The table only grows, up to 16M symbols, so the compile server empties it
+// after each compile, once nothing of it is left, keeping the fixed symbols.
+void reset_symbols();
+
+std::string_view symbol_name(Symbol);
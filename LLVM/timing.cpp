@@ -0,0 +1,266 @@
+// Scandi: timing.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <new>
+#include <sstream>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "timing.h"
+
+
+bool time_passes = false;
+
+
+// Allocations are counted per thread, so that counting costs no more than an
+// increment, and each file's passes can be told apart. Only while passes are
+// timed, so that other compiles don't pay for it.
+thread_local uint64_t allocations_here = 0;
+
+
+void* operator new(std::size_t size) {
+    if (time_passes) {
+        allocations_here++;
+    }
+    for (;;) {
+        if (auto p = std::malloc(size ? size : 1)) {
+            return p;
+        }
+        auto handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+
+uint64_t thread_allocations() {
+    return allocations_here;
+}
+
+
+double clock_ms(clockid_t clock) {
+    timespec now;
+    clock_gettime(clock, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+
+long peak_rss_kb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+// Threads are numbered in the order they first record anything, for traces.
+unsigned thread_number() {
+    static std::atomic<unsigned> next_thread { 0 };
+    thread_local unsigned number = next_thread++;
+    return number;
+}
+
+
+void Stopwatch::start() {
+    if (depth++ > 0) {
+        return;
+    }
+    if (started_ms < 0) {
+        started_ms = pass_timer().elapsed_ms();
+    }
+    allocations_start = thread_allocations();
+    cpu_start = clock_ms(CLOCK_THREAD_CPUTIME_ID);
+    wall_start = Clock::now();
+}
+
+
+void Stopwatch::stop() {
+    if (--depth > 0) {
+        return;
+    }
+    wall_ms += std::chrono::duration<double, std::milli>(Clock::now() - wall_start).count();
+    cpu_ms += clock_ms(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    allocations += thread_allocations() - allocations_start;
+}
+
+
+void PassTimer::start() {
+    std::lock_guard<std::mutex> locked(lock);
+    records.clear();
+    compile_start = Stopwatch::Clock::now();
+    cpu_at_start = clock_ms(CLOCK_PROCESS_CPUTIME_ID);
+    lap = Stopwatch();
+    lap.start();
+}
+
+
+void PassTimer::end_pass(const std::string& pass) {
+    lap.stop();
+    add(pass, "", lap);
+    skip_pass();
+}
+
+
+void PassTimer::skip_pass() {
+    lap = Stopwatch();
+    lap.start();
+}
+
+
+void PassTimer::add(const std::string& pass, const std::string& file, const Stopwatch& watch) {
+    add_record({
+        pass, file, watch.started_ms, watch.wall_ms,
+        watch.wall_ms, watch.cpu_ms, watch.allocations, peak_rss_kb(), thread_number()
+    });
+}
+
+
+void PassTimer::add_parse(const std::string& file, const Stopwatch& whole, const Stopwatch& lexing) {
+    add_record({
+        "tokenize", file, whole.started_ms, lexing.wall_ms,
+        lexing.wall_ms, lexing.cpu_ms, lexing.allocations, peak_rss_kb(), thread_number()
+    });
+    add_record({
+        "parse", file, whole.started_ms, whole.wall_ms,
+        whole.wall_ms - lexing.wall_ms, whole.cpu_ms - lexing.cpu_ms,
+        whole.allocations - lexing.allocations, peak_rss_kb(), thread_number()
+    });
+}
+
+
+void PassTimer::add_record(PassRecord record) {
+    std::lock_guard<std::mutex> locked(lock);
+    records.push_back(std::move(record));
+}
+
+
+double PassTimer::elapsed_ms() const {
+    return std::chrono::duration<double, std::milli>(Stopwatch::Clock::now() - compile_start).count();
+}
+
+
+std::vector<PassRecord> PassTimer::totals() const {
+    std::lock_guard<std::mutex> locked(lock);
+    std::vector<PassRecord> totals;
+    for (auto& record: records) {
+        auto total = std::find_if(totals.begin(), totals.end(), [&](const PassRecord& t) {
+            return t.pass == record.pass;
+        });
+        if (total == totals.end()) {
+            totals.push_back(record);
+            totals.back().file.clear();
+            continue;
+        }
+        total->start_ms = std::min(total->start_ms, record.start_ms);
+        total->span_ms += record.span_ms;
+        total->wall_ms += record.wall_ms;
+        total->cpu_ms += record.cpu_ms;
+        total->allocations += record.allocations;
+        total->peak_rss_kb = std::max(total->peak_rss_kb, record.peak_rss_kb);
+    }
+    return totals;
+}
+
+
+void print_row(std::ostream& os, const std::string& pass, const std::string& file, const PassRecord& r) {
+    os << std::left << std::setw(12) << pass << std::setw(24) << file << std::right
+       << std::fixed << std::setprecision(3)
+       << std::setw(12) << r.wall_ms << std::setw(12) << r.cpu_ms
+       << std::setw(12) << r.allocations << std::setw(14) << r.peak_rss_kb << std::endl;
+}
+
+
+void PassTimer::print_summary(std::ostream& os) const {
+    auto flags = os.flags();
+    auto precision = os.precision();
+    auto pass_totals = totals();
+
+    os << std::endl << "Pass timings. Files are timed on their own threads, so with several jobs a"
+       << std::endl << "pass can take more than the time elapsed." << std::endl << std::endl;
+    os << std::left << std::setw(12) << "Pass" << std::setw(24) << "File" << std::right
+       << std::setw(12) << "Wall ms" << std::setw(12) << "CPU ms"
+       << std::setw(12) << "Allocs" << std::setw(14) << "Peak RSS KB" << std::endl;
+    PassRecord all { "", "", 0, 0, elapsed_ms(), clock_ms(CLOCK_PROCESS_CPUTIME_ID) - cpu_at_start, 0, peak_rss_kb(), 0 };
+    for (auto& total: pass_totals) {
+        bool by_file = false;
+        {
+            std::lock_guard<std::mutex> locked(lock);
+            for (auto& record: records) {
+                if (record.pass == total.pass && !record.file.empty()) {
+                    print_row(os, record.pass, record.file, record);
+                    by_file = true;
+                }
+            }
+        }
+        print_row(os, total.pass, by_file ? "(all)" : "", total);
+        all.allocations += total.allocations;
+    }
+    print_row(os, "Total", "", all);
+
+    os.flags(flags);
+    os.precision(precision);
+}
+
+
+std::string json_string(const std::string& text) {
+    std::ostringstream out;
+    out << '"';
+    for (unsigned char c: text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c < ' ') {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+
+// Chrome's trace event format, which chrome://tracing and Perfetto both read.
+bool PassTimer::write_trace(const std::string& path) const {
+    std::ofstream trace(path);
+    trace << std::fixed << std::setprecision(3) << "{\"traceEvents\": [";
+    std::lock_guard<std::mutex> locked(lock);
+    for (size_t r = 0; r < records.size(); r++) {
+        auto& record = records[r];
+        trace << (r ? "," : "") << std::endl
+              << "  {\"name\": " << json_string(record.file.empty() ? record.pass : record.pass + " " + record.file)
+              << ", \"cat\": " << json_string(record.pass)
+              << ", \"ph\": \"X\", \"pid\": " << getpid() << ", \"tid\": " << record.thread
+              << ", \"ts\": " << record.start_ms * 1e3 << ", \"dur\": " << record.span_ms * 1e3
+              << ", \"args\": {\"file\": " << json_string(record.file)
+              << ", \"wall_ms\": " << record.wall_ms << ", \"cpu_ms\": " << record.cpu_ms
+              << ", \"allocations\": " << record.allocations << ", \"peak_rss_kb\": " << record.peak_rss_kb << "}}";
+    }
+    trace << std::endl << "], \"displayTimeUnit\": \"ms\"}" << std::endl;
+    trace.close();
+    return static_cast<bool>(trace);
+}
+
+
+PassTimer& pass_timer() {
+    static PassTimer timer;
+    return timer;
+}
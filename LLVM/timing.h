@@ -0,0 +1,114 @@
+// Scandi: timing.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// Set by --time-passes or --trace, to have passes timed file by file, and
+// lexing apart from parsing.
+extern bool time_passes;
+
+
+// Heap allocations made by the calling thread so far, counted while time_passes
+// is set.
+uint64_t thread_allocations();
+
+
+// Measures what the calling thread spends between start and stop. Both may be
+// called repeatedly, to add up work interleaved with other work, and nest, so
+// only the outermost pair counts.
+class Stopwatch {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        void start();
+        void stop();
+
+        double started_ms = -1;       // When first started, from the start of the compile.
+        double wall_ms = 0;
+        double cpu_ms = 0;
+        uint64_t allocations = 0;
+
+        // Runs a stopwatch, if there is one, for the life of the scope.
+        class Running {
+            public:
+                Running(Stopwatch* watch) : watch(watch) { if (watch) watch->start(); }
+                ~Running() { if (watch) watch->stop(); }
+            private:
+                Stopwatch* watch;
+        };
+
+    private:
+        int depth = 0;
+        Clock::time_point wall_start;
+        double cpu_start;
+        uint64_t allocations_start;
+};
+
+
+// What one pass cost. Passes over a single file name it; passes over the whole
+// program leave it empty.
+struct PassRecord {
+    std::string pass;
+    std::string file;
+    double start_ms;                  // From the start of the compile.
+    double span_ms;                   // How long it is drawn for in a trace.
+    double wall_ms;
+    double cpu_ms;
+    uint64_t allocations;
+    long peak_rss_kb;                 // The process's high water mark at its end.
+    unsigned thread;
+};
+
+
+// Collects the passes of a compile. Whole program passes run on the driving
+// thread, one after another, each from the end of the last. Passes over files
+// may run on any thread, and are measured by the caller.
+class PassTimer {
+    public:
+        // Starts a compile, forgetting any before.
+        void start();
+
+        // Ends the whole program pass that has run since the last ended.
+        void end_pass(const std::string& pass);
+
+        // Starts the next whole program pass now, leaving out the time since
+        // the last, which was recorded file by file.
+        void skip_pass();
+
+        void add(const std::string& pass, const std::string& file, const Stopwatch& watch);
+
+        // A file's lexing is interleaved with its parsing, a scope at a time.
+        // Parsing is recorded less the lexing, but drawn in a trace around
+        // it, with the lexing drawn at its start.
+        void add_parse(const std::string& file, const Stopwatch& whole, const Stopwatch& lexing);
+
+        double elapsed_ms() const;
+
+        // Total cost of each pass, in the order they first ran.
+        std::vector<PassRecord> totals() const;
+
+        void print_summary(std::ostream&) const;
+        bool write_trace(const std::string& path) const;
+
+    private:
+        Stopwatch::Clock::time_point compile_start;
+        double cpu_at_start;
+        Stopwatch lap;
+        mutable std::mutex lock;
+        std::vector<PassRecord> records;
+
+        void add_record(PassRecord);
+};
+
+
+PassTimer& pass_timer();
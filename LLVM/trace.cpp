@@ -0,0 +1,131 @@
+// Scandi: trace.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include "trace.h"
+
+
+#define TRACE_BUFFER_SIZE   (64 * 1024)
+
+
+TraceLevel trace_levels[TRACE_CATEGORIES] = {};
+
+
+const char* trace_category_names[TRACE_CATEGORIES] = {
+    "driver",
+    "lexer",
+    "parser",
+    "semantics",
+    "codegen"
+};
+
+
+// Writes through to whatever cout writes to when it is flushed, so that traces
+// follow cout if it is redirected, as the compile server does. Flushing the
+// stream (such as with endl) doesn't write anything.
+class TraceBuffer : public std::streambuf {
+    public:
+        TraceBuffer() {
+            setp(buffer, buffer + sizeof(buffer));
+        }
+
+        void write_out() {
+            std::cout.rdbuf()->sputn(pbase(), pptr() - pbase());
+            setp(buffer, buffer + sizeof(buffer));
+        }
+
+    protected:
+        int overflow(int c) override {
+            write_out();
+            if (c != traits_type::eof()) {
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        int sync() override {
+            return 0;
+        }
+
+    private:
+        char buffer[TRACE_BUFFER_SIZE];
+};
+
+
+TraceBuffer& trace_buffer() {
+    static TraceBuffer buffer;
+    return buffer;
+}
+
+
+std::ostream& trace_out() {
+    static std::ostream out(&trace_buffer());
+    return out;
+}
+
+
+void trace_flush() {
+    trace_buffer().write_out();
+    std::cout.flush();
+}
+
+
+bool trace_select(const std::string& spec) {
+#ifdef SCANDI_NO_TRACE
+    std::cerr << "This build has no tracing" << std::endl;
+    return false;
+#else
+    std::istringstream items(spec);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        auto level = TRACE_DETAIL;
+        auto colon = item.find(':');
+        if (colon != std::string::npos) {
+            auto level_name = item.substr(colon + 1);
+            if (level_name == "1") {
+                level = TRACE_SUMMARY;
+            } else if (level_name != "2") {
+                std::cerr << "Invalid trace level " << level_name << std::endl;
+                return false;
+            }
+            item.resize(colon);
+        }
+
+        bool found = false;
+        for (int c = 0; c < TRACE_CATEGORIES; c++) {
+            if (item == "all" || item == trace_category_names[c]) {
+                trace_levels[c] = level;
+                found = true;
+            }
+        }
+        if (!found) {
+            std::cerr << "Invalid trace category " << item << std::endl;
+            return false;
+        }
+    }
+    return true;
+#endif
+}
+
+
+void trace_reset() {
+    for (auto& level: trace_levels) {
+        level = TRACE_OFF;
+    }
+}
+
+
+bool tracing_any() {
+    for (auto level: trace_levels) {
+        if (level != TRACE_OFF) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,66 @@
+// Scandi: trace.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+
+// Compiler tracing, for debugging the compiler itself. Each category of trace
+// is turned on to a level at runtime, by --debug. Checking whether a trace is
+// on is a single compare, and the output is buffered rather than flushed line
+// by line, so tracing large inputs is practical.
+//
+// Release builds (NDEBUG) leave tracing out altogether, so that no call site
+// costs anything. Define SCANDI_TRACE to keep it in anyway.
+#if defined(NDEBUG) && !defined(SCANDI_TRACE)
+#define SCANDI_NO_TRACE
+#endif
+
+
+enum TraceCategory : uint8_t {
+    TRACE_DRIVER,                     // Files, caches.
+    TRACE_LEXER,
+    TRACE_PARSER,
+    TRACE_SEMANTICS,
+    TRACE_CODEGEN,
+    TRACE_CATEGORIES
+};
+
+
+enum TraceLevel : uint8_t {
+    TRACE_OFF,
+    TRACE_SUMMARY,                    // Phases, trees.
+    TRACE_DETAIL                      // Every token, node or lookup.
+};
+
+
+extern TraceLevel trace_levels[TRACE_CATEGORIES];
+
+
+#ifdef SCANDI_NO_TRACE
+#define TRACING( CATEGORY, LEVEL )      false
+#else
+#define TRACING( CATEGORY, LEVEL )      __builtin_expect(trace_levels[ CATEGORY ] >= LEVEL, 0)
+#endif
+
+// Each trace starts a new line, as the trees it prints leave lines open.
+#define TRACE( CATEGORY, LEVEL, ... )   if (TRACING( CATEGORY, LEVEL )) { trace_out() << '\n' << __VA_ARGS__ }
+
+
+// Where traces go: a buffer in front of cout. Lines are only written out when
+// the buffer fills, or by trace_flush, which is called before any error is
+// reported so that errors follow the traces that led to them.
+std::ostream& trace_out();
+void trace_flush();
+
+// Turns categories on, given as "all", or a comma separated list of names
+// each with an optional level, such as "parser,semantics:1". Returns false if
+// spec can't be read, or this build has no tracing.
+bool trace_select(const std::string& spec);
+void trace_reset();
+bool tracing_any();
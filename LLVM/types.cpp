@@ -0,0 +1,416 @@
+// Scandi: types.cpp
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#include <unordered_map>
+#include <unordered_set>
+#include "codegen.h"
+#include "globals.h"
+#include "lines.h"
+#include "loops.h"
+#include "runtime.h"
+#include "types.h"
+
+
+/*
+ *  Operations, by what runtime.cpp does with each type of operand. Null
+ *  counts as 0, and strings are read as numbers, so arithmetic on either could
+ *  give a long or a double. Anything else fails, so gives nothing.
+ */
+
+uint8_t number_types(uint8_t type) {
+    switch (type) {
+        case TYPE_NULL:
+        case TYPE_LONG:     return TYPE_LONG;
+        case TYPE_DOUBLE:   return TYPE_DOUBLE;
+        case TYPE_STRING:   return TYPE_LONG | TYPE_DOUBLE;
+        default:            return 0;
+    }
+}
+
+
+// For one type of each operand.
+uint8_t single_operation_types(int64_t operation, uint8_t a, uint8_t b) {
+    switch (operation) {
+        case OP_ADD:
+            if (a == TYPE_STRING && b == TYPE_STRING) {
+                return TYPE_STRING;
+            }
+            if (a == TYPE_STRING || b == TYPE_STRING) {
+                return TYPE_STRING | TYPE_LONG | TYPE_DOUBLE;
+            }
+            [[fallthrough]];
+        case OP_SUB:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULUS: {
+            auto x = number_types(a);
+            auto y = number_types(b);
+            if (!x || !y) {
+                return 0;
+            }
+            uint8_t types = 0;
+            if ((x & TYPE_LONG) && (y & TYPE_LONG)) {
+                types |= TYPE_LONG;
+            }
+            if ((x | y) & TYPE_DOUBLE) {
+                types |= TYPE_DOUBLE;
+            }
+            return types;
+        }
+        default:
+            return TYPE_LONG;
+    }
+}
+
+
+uint8_t operation_types(int64_t operation, uint8_t a, uint8_t b) {
+    uint8_t types = 0;
+    for (uint8_t x = 1; x < TYPE_ANY; x <<= 1) {
+        for (uint8_t y = 1; y < TYPE_ANY; y <<= 1) {
+            if ((a & x) && (b & y)) {
+                types |= single_operation_types(operation, x, y);
+            }
+        }
+    }
+    return types;
+}
+
+
+/*
+ *  Inference. Each function's lines are followed as codegen generates them,
+ *  with what each of its variables can hold: a conditional's branches meet
+ *  after it, and a label is reached both from the line before it and by the
+ *  jumps to it, so its function is followed again until what reaches it by
+ *  jumps stops growing. Then every function is followed again until what
+ *  each is passed and returns stops growing too.
+ *
+ *  A function's variables start null, and its parameters as passed. Main's
+ *  are the globals, other than those a function assigns to, which could be
+ *  anything. Reads through aliases are shared between lines, so are left.
+ */
+
+// What inference keeps of an operand.
+struct Types {
+    uint8_t types = TYPE_ANY;         // A value's.
+};
+typedef Operand<Types> Typed;
+
+
+// What each variable can hold, by slot. Nothing reaches the code after a jump.
+struct Flow {
+    vector<uint8_t> types;
+    bool reached = true;
+};
+
+
+// Lines are followed by lines.h, for the function in owner.
+struct Inference : LinePass {
+    typedef Typed Item;
+
+    vector<uint8_t> globals;          // What main's start with.
+    std::unordered_set<AST*> shared;  // Globals that functions assign to.
+    bool changed = false;             // What a function is passed or returns, or shared.
+
+    Flow flow;
+    std::unordered_map<AST*, Flow> labels;  // What reaches each label by jumps.
+    bool labels_changed = false;
+
+    bool reached() {
+        return flow.reached;
+    }
+
+    void read(Typed& operand);
+    void constant(AST* ast, Typed& constant);
+    void field(Typed& container, bool is_target, Typed& field);
+    void call(AST* function, vector<Typed>& args, Typed& result);
+    void jump(AST* label, AST* read);
+    void assign(AST* op, Typed& target, Typed& value);
+    void operate(AST* op, int64_t operation, Typed& a, Typed& b, Typed& result);
+    void complement(AST* op, Typed& a, Typed& result);
+    void count(AST* op, Typed* a, Typed& result);
+};
+
+
+void follow_lines(AST* ast, Inference& in);
+
+
+bool join(Flow& into, const Flow& from) {
+    if (!from.reached) {
+        return false;
+    }
+    if (!into.reached) {
+        into = from;
+        return true;
+    }
+    bool changed = false;
+    for (size_t i = 0; i < into.types.size(); i++) {
+        auto types = into.types[i] | from.types[i];
+        if (types != into.types[i]) {
+            into.types[i] = types;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+
+void widen(AST* ast, uint8_t types, Inference& in) {
+    if ((ast->types | types) != ast->types) {
+        ast->types |= types;
+        in.changed = true;
+    }
+}
+
+
+// The function's own variables, or for main, the globals no function assigns to.
+bool is_followed(AST* decl, Inference& in) {
+    if (!decl || decl->type != AST_VARIABLE || decl->slot < 0) {
+        return false;
+    }
+    if (in.owner) {
+        return !is_global(decl) && owning_function(decl) == in.owner;
+    }
+    return is_global(decl) && !in.shared.count(decl);
+}
+
+
+// Reading a variable records what it can hold there, on the identifier.
+uint8_t value_of(const Typed& operand, Inference& in) {
+    switch (operand.kind) {
+        case Typed::VALUE:
+            return operand.types;
+        case Typed::VARIABLE: {
+            auto types = is_followed(operand.decl, in) ? in.flow.types[operand.decl->slot] : static_cast<uint8_t>(TYPE_ANY);
+            if (operand.read && !in.in_alias) {
+                operand.read->types |= types;
+            }
+            return types;
+        }
+        default:
+            return TYPE_ANY;
+    }
+}
+
+
+// Setting a field stores back a table. A value is copied back to the
+// variable it was read from.
+void store_types(const Typed& target, uint8_t types, Inference& in) {
+    if (target.kind == Typed::RESULT) {
+        widen(in.owner, types, in);
+        in.flow.reached = false;
+        return;
+    }
+    if (target.kind == Typed::FIELD) {
+        types = TYPE_OTHER;
+    }
+    auto decl = stored_variable(target);
+    if (!decl) {
+        return;
+    }
+    if (is_followed(decl, in)) {
+        in.flow.types[decl->slot] = types;
+    } else if (in.owner && is_global(decl) && in.shared.insert(decl).second) {
+        in.changed = true;
+    }
+}
+
+
+Flow& label_flow(AST* label, Inference& in) {
+    auto found = in.labels.find(label);
+    if (found == in.labels.end()) {
+        Flow none { vector<uint8_t>(in.flow.types.size()), false };
+        found = in.labels.emplace(label, none).first;
+    }
+    return found->second;
+}
+
+
+void jump(AST* label, Inference& in) {
+    if (owning_function(label) == in.owner && join(label_flow(label, in), in.flow)) {
+        in.labels_changed = true;
+    }
+    in.flow.reached = false;
+}
+
+
+void Inference::read(Typed& operand) {
+    operand.types = value_of(operand, *this);
+}
+
+
+void Inference::constant(AST* ast, Typed& constant) {
+    switch (ast->type) {
+        case AST_BINARY:
+        case AST_STRING:    constant.types = TYPE_STRING;   break;
+        case AST_LONG:      constant.types = TYPE_LONG;     break;
+        case AST_DOUBLE:    constant.types = TYPE_DOUBLE;   break;
+        default:            constant.types = TYPE_NULL;     break;
+    }
+}
+
+
+// A field's container is read when it is made.
+void Inference::field(Typed& container, bool is_target, Typed& field) {
+    value_of(container, *this);
+}
+
+
+// Parameters are passed the last operands taken, and null if there are none.
+void Inference::call(AST* function, vector<Typed>& args, Typed& result) {
+    if (has_raw(function)) {
+        return;
+    }
+    auto named = parameters(function);
+    auto taken = args.size();
+    for (size_t i = 0; i < named.size(); i++) {
+        widen(named[i], taken + i >= named.size() ? args[taken + i - named.size()].types : TYPE_NULL, *this);
+    }
+    result.types = function->types;
+}
+
+
+void Inference::jump(AST* label, AST* read) {
+    ::jump(label, *this);
+}
+
+
+void Inference::assign(AST* op, Typed& target, Typed& value) {
+    store_types(target, value.types, *this);
+}
+
+
+void Inference::operate(AST* op, int64_t operation, Typed& a, Typed& b, Typed& result) {
+    result.types = operation_types(operation, a.types, b.types);
+}
+
+
+void Inference::complement(AST* op, Typed& a, Typed& result) {
+    result.types = TYPE_LONG;
+}
+
+
+void Inference::count(AST* op, Typed* a, Typed& result) {
+    result.types = TYPE_LONG;
+}
+
+
+// A conditional reads the last two operands of its line, or the last.
+void follow_conditional(AST* ast, Inference& in) {
+    if (in.flow.reached) {
+        vector<Typed> stack;
+        follow_chain(ast->next, stack, 0, in);
+        take(stack, std::min<size_t>(stack.size(), 2), in);
+    }
+    auto otherwise = in.flow;
+    for (auto c: ast->children) {
+        follow_lines(c, in);
+    }
+    if (ast->alt) {
+        auto holds = in.flow;
+        in.flow = otherwise;
+        for (auto e: ast->alt->children) {
+            follow_lines(e, in);
+        }
+        join(in.flow, holds);
+    } else {
+        join(in.flow, otherwise);
+    }
+}
+
+
+void follow_lines(AST* ast, Inference& in) {
+    switch (ast->type) {
+        case AST_RAW:
+        case AST_ALIAS:
+        case AST_FUNCTION:
+            return;
+        case AST_CONDITIONAL:
+            follow_conditional(ast, in);
+            return;
+        case AST_LABEL:
+            join(in.flow, label_flow(ast, in));
+            break;
+        case AST_SCOPE:
+        case AST_VARIABLE:
+            break;
+        default:
+            if (in.flow.reached) {
+                follow_line(ast, in);
+            }
+            break;
+    }
+    for (auto c: ast->children) {
+        follow_lines(c, in);
+    }
+}
+
+
+// Falling off the end of a function returns null.
+void follow_function(AST* owner, AST* body, Inference& in) {
+    in.owner = owner;
+    in.labels.clear();
+    do {
+        in.flow = { owner ? vector<uint8_t>(owner->slot, TYPE_NULL) : in.globals };
+        for (auto p = owner ? owner->next : nullptr; p; p = p->next) {
+            in.flow.types[p->slot] = p->types;
+        }
+        in.labels_changed = false;
+        for (auto c: body->children) {
+            follow_lines(c, in);
+        }
+    } while (in.labels_changed);
+    if (owner && in.flow.reached) {
+        widen(owner, TYPE_NULL, in);
+    }
+}
+
+
+string type_names(uint8_t types) {
+    static const char* names[] = { "NULL", "LONG", "DOUBLE", "STRING", "OTHER" };
+    if (types == TYPE_ANY) {
+        return "ANY";
+    }
+    string text;
+    for (int i = 0; i < 5; i++) {
+        if (types & (1 << i)) {
+            text += (text.empty() ? "" : " OR ") + string(names[i]);
+        }
+    }
+    return text.empty() ? "NOTHING" : text;
+}
+
+
+void infer_types(AST* global) {
+    TRACE( TRACE_SEMANTICS, TRACE_SUMMARY, endl << "INFERRING TYPES";)
+    Inference in;
+    in.globals.assign(global->slot, TYPE_NULL);
+    vector<AST*> functions;
+    for (auto f: declarations_of(global, AST_FUNCTION)) {
+        if (!has_raw(f)) {
+            functions.push_back(f);
+        }
+    }
+    // Embedded code gives these their first values.
+    for (auto v: declarations_of(global, AST_VARIABLE)) {
+        if (has_raw(v) && is_global(v)) {
+            in.globals.at(v->slot) = TYPE_ANY;
+        }
+    }
+    do {
+        in.changed = false;
+        follow_function(nullptr, global, in);
+        for (auto f: functions) {
+            follow_function(f, f, in);
+        }
+    } while (in.changed);
+
+    for (auto f: functions) {
+        TRACE( TRACE_SEMANTICS, TRACE_DETAIL, "FUNCTION " << f->name << " RETURNS " << type_names(f->types);)
+        for (auto p: parameters(f)) {
+            TRACE( TRACE_SEMANTICS, TRACE_DETAIL, "  PARAMETER " << p->name << " IS " << type_names(p->types);)
+        }
+    }
+}
@@ -0,0 +1,33 @@
+// Scandi: types.h
+//
+// Author: Neil Bradley
+// Copyright: Neil Bradley
+// License: GPL 3.0
+
+#pragma once
+#include <cstdint>
+#include "ast.h"
+#include "globals.h"
+
+
+// What a value can be, as a set of runtime.h's tags. 0 is nothing yet, and
+// where a value isn't known at all, it can be anything.
+enum ValueTypes : uint8_t {
+    TYPE_NULL =     1,
+    TYPE_LONG =     2,
+    TYPE_DOUBLE =   4,
+    TYPE_STRING =   8,
+    TYPE_OTHER =    16,               // Tables and streams.
+    TYPE_ANY =      31
+};
+
+
+// What scandi_operate can give for operands of these types.
+uint8_t operation_types(int64_t operation, uint8_t a, uint8_t b);
+
+// Follows each function's lines, as codegen follows them, to find what each
+// variable can hold at each point, and what each function is passed and
+// returns. Where an identifier reads a variable, AST::types is what it can
+// hold there. On a function, it is what it can return, and on a parameter,
+// what it can be passed.
+void infer_types(AST* global);